@@ -0,0 +1,49 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/bitboard.h"
+
+namespace minigo {
+
+constexpr int BitBoard::kNumWords;
+
+const BitBoard BitBoard::kAll = []() {
+  BitBoard result;
+  for (int c = 0; c < kN * kN; ++c) {
+    result.set(c);
+  }
+  return result;
+}();
+
+const BitBoard BitBoard::kNotFirstColumn = []() {
+  BitBoard result;
+  for (int row = 0; row < kN; ++row) {
+    for (int col = 1; col < kN; ++col) {
+      result.set(Coord(row, col));
+    }
+  }
+  return result;
+}();
+
+const BitBoard BitBoard::kNotLastColumn = []() {
+  BitBoard result;
+  for (int row = 0; row < kN; ++row) {
+    for (int col = 0; col < kN - 1; ++col) {
+      result.set(Coord(row, col));
+    }
+  }
+  return result;
+}();
+
+}  // namespace minigo
@@ -0,0 +1,204 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_BITBOARD_H_
+#define CC_BITBOARD_H_
+
+#include <array>
+#include <cstdint>
+
+#include "cc/check.h"
+#include "cc/constants.h"
+#include "cc/coord.h"
+
+namespace minigo {
+
+// BitBoard is a set of points on the board, packed into 64-bit words: point c
+// is stored in bit (c % 64) of word (c / 64). A 19x19 board requires 6 words
+// and a 9x9 board requires 2.
+//
+// All set operations work a whole word at a time. Neighbors() is implemented
+// with shifts & masks, which makes flood fills (finding a chain of stones, its
+// liberties, or the empty points reachable from a color) cheap compared to
+// visiting the board one point at a time.
+//
+// The bits past the last point on the board are always zero.
+class BitBoard {
+ public:
+  static constexpr int kNumWords = (kN * kN + 63) / 64;
+
+  BitBoard() : words_() {}
+
+  // Constructs a BitBoard containing the single point c.
+  explicit BitBoard(Coord c) : words_() { set(c); }
+
+  // Set containing every point on the board.
+  static const BitBoard kAll;
+
+  bool test(Coord c) const { return (words_[c / 64] >> (c % 64)) & 1; }
+  void set(Coord c) { words_[c / 64] |= uint64_t(1) << (c % 64); }
+  void reset(Coord c) { words_[c / 64] &= ~(uint64_t(1) << (c % 64)); }
+
+  // Returns true if the set contains no points.
+  bool empty() const {
+    uint64_t x = 0;
+    for (auto w : words_) {
+      x |= w;
+    }
+    return x == 0;
+  }
+
+  // Returns the number of points in the set.
+  int count() const {
+    int n = 0;
+    for (auto w : words_) {
+      n += __builtin_popcountll(w);
+    }
+    return n;
+  }
+
+  // Returns the point with the smallest coordinate in the set.
+  // The set must not be empty.
+  Coord first() const {
+    for (int i = 0; i < kNumWords; ++i) {
+      if (words_[i] != 0) {
+        return i * 64 + __builtin_ctzll(words_[i]);
+      }
+    }
+    MG_DCHECK(false) << "first() called on an empty BitBoard";
+    return Coord::kInvalid;
+  }
+
+  // Calls f(c) for every point c in the set, in increasing order of c.
+  template <typename F>
+  void ForEach(F f) const {
+    for (int i = 0; i < kNumWords; ++i) {
+      for (uint64_t w = words_[i]; w != 0; w &= w - 1) {
+        f(Coord(i * 64 + __builtin_ctzll(w)));
+      }
+    }
+  }
+
+  // Returns the set of points that are horizontally or vertically adjacent to
+  // at least one point in this set. A point in this set is only included in
+  // the result if it's adjacent to another point in this set.
+  BitBoard Neighbors() const {
+    BitBoard east = ShiftUp<1>() & kNotFirstColumn;
+    BitBoard west = ShiftDown<1>() & kNotLastColumn;
+    BitBoard south = ShiftUp<kN>() & kAll;
+    BitBoard north = ShiftDown<kN>();
+    return east | west | south | north;
+  }
+
+  // Returns the set of points in mask that are connected to this set by a path
+  // of horizontally or vertically adjacent points in mask. Points in this set
+  // that aren't in mask are not included in the result.
+  BitBoard FloodFill(const BitBoard& mask) const {
+    BitBoard result = *this & mask;
+    for (;;) {
+      BitBoard grown = (result | result.Neighbors()) & mask;
+      if (grown == result) {
+        return result;
+      }
+      result = grown;
+    }
+  }
+
+  BitBoard& operator|=(const BitBoard& other) {
+    for (int i = 0; i < kNumWords; ++i) {
+      words_[i] |= other.words_[i];
+    }
+    return *this;
+  }
+  BitBoard& operator&=(const BitBoard& other) {
+    for (int i = 0; i < kNumWords; ++i) {
+      words_[i] &= other.words_[i];
+    }
+    return *this;
+  }
+  BitBoard& operator^=(const BitBoard& other) {
+    for (int i = 0; i < kNumWords; ++i) {
+      words_[i] ^= other.words_[i];
+    }
+    return *this;
+  }
+
+  BitBoard operator|(const BitBoard& other) const {
+    BitBoard result = *this;
+    return result |= other;
+  }
+  BitBoard operator&(const BitBoard& other) const {
+    BitBoard result = *this;
+    return result &= other;
+  }
+  BitBoard operator^(const BitBoard& other) const {
+    BitBoard result = *this;
+    return result ^= other;
+  }
+
+  // Returns the set of points on the board that are not in this set.
+  BitBoard operator~() const {
+    BitBoard result;
+    for (int i = 0; i < kNumWords; ++i) {
+      result.words_[i] = ~words_[i] & kAll.words_[i];
+    }
+    return result;
+  }
+
+  bool operator==(const BitBoard& other) const {
+    return words_ == other.words_;
+  }
+  bool operator!=(const BitBoard& other) const { return !(*this == other); }
+
+ private:
+  // Sets of points that are not in the first & last columns of the board
+  // respectively. Used to mask out the bits that wrap around from one row to
+  // the next when shifting east or west.
+  static const BitBoard kNotFirstColumn;
+  static const BitBoard kNotLastColumn;
+
+  // Moves every point c in the set to c + kShift. Points shifted past the end
+  // of the board are not masked out.
+  template <int kShift>
+  BitBoard ShiftUp() const {
+    static_assert(kShift > 0 && kShift < 64, "invalid shift");
+    BitBoard result;
+    result.words_[0] = words_[0] << kShift;
+    for (int i = 1; i < kNumWords; ++i) {
+      result.words_[i] =
+          (words_[i] << kShift) | (words_[i - 1] >> (64 - kShift));
+    }
+    return result;
+  }
+
+  // Moves every point c in the set to c - kShift, dropping points that would
+  // have a negative coordinate.
+  template <int kShift>
+  BitBoard ShiftDown() const {
+    static_assert(kShift > 0 && kShift < 64, "invalid shift");
+    BitBoard result;
+    for (int i = 0; i < kNumWords - 1; ++i) {
+      result.words_[i] =
+          (words_[i] >> kShift) | (words_[i + 1] << (64 - kShift));
+    }
+    result.words_[kNumWords - 1] = words_[kNumWords - 1] >> kShift;
+    return result;
+  }
+
+  std::array<uint64_t, kNumWords> words_;
+};
+
+}  // namespace minigo
+
+#endif  // CC_BITBOARD_H_
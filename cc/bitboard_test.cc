@@ -0,0 +1,124 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/bitboard.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+BitBoard MakeBitBoard(const std::vector<Coord>& coords) {
+  BitBoard result;
+  for (auto c : coords) {
+    result.set(c);
+  }
+  return result;
+}
+
+TEST(BitBoardTest, SetTestReset) {
+  BitBoard bb;
+  EXPECT_TRUE(bb.empty());
+  EXPECT_EQ(0, bb.count());
+
+  for (int c = 0; c < kN * kN; ++c) {
+    ASSERT_FALSE(bb.test(c));
+    bb.set(c);
+    ASSERT_TRUE(bb.test(c));
+    ASSERT_EQ(c + 1, bb.count());
+  }
+  EXPECT_EQ(BitBoard::kAll, bb);
+
+  for (int c = 0; c < kN * kN; ++c) {
+    bb.reset(c);
+    ASSERT_FALSE(bb.test(c));
+  }
+  EXPECT_TRUE(bb.empty());
+}
+
+TEST(BitBoardTest, Complement) {
+  EXPECT_TRUE((~BitBoard::kAll).empty());
+  EXPECT_EQ(BitBoard::kAll, ~BitBoard());
+
+  BitBoard bb(Coord(1, 2));
+  auto not_bb = ~bb;
+  EXPECT_EQ(kN * kN - 1, not_bb.count());
+  EXPECT_FALSE(not_bb.test(Coord(1, 2)));
+}
+
+TEST(BitBoardTest, ForEach) {
+  std::vector<Coord> expected = {Coord(0, 0), Coord(0, kN - 1),
+                                 Coord(kN / 2, 3), Coord(kN - 1, kN - 1)};
+  std::vector<Coord> actual;
+  MakeBitBoard(expected).ForEach([&](Coord c) { actual.push_back(c); });
+  EXPECT_EQ(expected, actual);
+  EXPECT_EQ(expected[0], MakeBitBoard(expected).first());
+}
+
+TEST(BitBoardTest, Neighbors) {
+  // Corners.
+  EXPECT_EQ(MakeBitBoard({Coord(0, 1), Coord(1, 0)}),
+            BitBoard(Coord(0, 0)).Neighbors());
+  EXPECT_EQ(MakeBitBoard({Coord(0, kN - 2), Coord(1, kN - 1)}),
+            BitBoard(Coord(0, kN - 1)).Neighbors());
+  EXPECT_EQ(MakeBitBoard({Coord(kN - 2, 0), Coord(kN - 1, 1)}),
+            BitBoard(Coord(kN - 1, 0)).Neighbors());
+  EXPECT_EQ(MakeBitBoard({Coord(kN - 2, kN - 1), Coord(kN - 1, kN - 2)}),
+            BitBoard(Coord(kN - 1, kN - 1)).Neighbors());
+
+  // Edges: points at the end of one row must not leak into the next row.
+  EXPECT_EQ(MakeBitBoard({Coord(2, kN - 2), Coord(1, kN - 1), Coord(3, kN - 1)}),
+            BitBoard(Coord(2, kN - 1)).Neighbors());
+  EXPECT_EQ(MakeBitBoard({Coord(2, 1), Coord(1, 0), Coord(3, 0)}),
+            BitBoard(Coord(2, 0)).Neighbors());
+
+  // Every point's neighbors should match a brute force calculation.
+  for (int row = 0; row < kN; ++row) {
+    for (int col = 0; col < kN; ++col) {
+      std::vector<Coord> expected;
+      if (row > 0) expected.emplace_back(row - 1, col);
+      if (col > 0) expected.emplace_back(row, col - 1);
+      if (col < kN - 1) expected.emplace_back(row, col + 1);
+      if (row < kN - 1) expected.emplace_back(row + 1, col);
+      ASSERT_EQ(MakeBitBoard(expected), BitBoard(Coord(row, col)).Neighbors())
+          << Coord(row, col);
+    }
+  }
+}
+
+TEST(BitBoardTest, FloodFill) {
+  // A wall down column 2 separates the left of the board from the right.
+  BitBoard wall;
+  for (int row = 0; row < kN; ++row) {
+    wall.set(Coord(row, 2));
+  }
+  auto open = ~wall;
+
+  auto left = BitBoard(Coord(0, 0)).FloodFill(open);
+  EXPECT_EQ(kN * 2, left.count());
+  EXPECT_TRUE(left.test(Coord(kN - 1, 1)));
+  EXPECT_FALSE(left.test(Coord(0, 3)));
+
+  auto right = BitBoard(Coord(kN - 1, kN - 1)).FloodFill(open);
+  EXPECT_EQ(kN * (kN - 3), right.count());
+  EXPECT_EQ(open, left | right);
+
+  // Seeds outside of the mask are ignored.
+  EXPECT_TRUE(BitBoard(Coord(0, 2)).FloodFill(open).empty());
+}
+
+}  // namespace
+}  // namespace minigo
@@ -22,48 +22,67 @@ namespace minigo {
 constexpr int DualNet::kNumStoneFeatures;
 constexpr int DualNet::kNumBoardFeatures;
 
-void DualNet::SetFeatures(absl::Span<const Position::Stones* const> history,
-                          Color to_play, BoardFeatures* features) {
-  MG_CHECK(history.size() <= kMoveHistory);
+namespace {
+
+// Generates the board features from history_size positions, where
+// get_color(j, c) returns the color of the stone at point c j moves ago.
+template <typename GetColor>
+void SetFeaturesImpl(size_t history_size, GetColor get_color, Color to_play,
+                     DualNet::BoardFeatures* features) {
+  MG_CHECK(history_size <= DualNet::kMoveHistory);
   Color my_color = to_play;
   Color their_color = OtherColor(my_color);
 
   // Write the features for the position history that we have.
   size_t j = 0;
-  for (j = 0; j < history.size(); ++j) {
+  for (j = 0; j < history_size; ++j) {
     auto* dst = features->data() + j * 2;
-    const auto* end = dst + kNumBoardFeatures;
-    const auto* src = history[j]->data();
-    while (dst < end) {
-      auto color = src->color();
-      ++src;
+    for (int c = 0; c < kN * kN; ++c) {
+      auto color = get_color(j, c);
       dst[0] = color == my_color ? 1 : 0;
       dst[1] = color == their_color ? 1 : 0;
-      dst += kNumStoneFeatures;
+      dst += DualNet::kNumStoneFeatures;
     }
   }
 
   // Pad the features with zeros if we have fewer than 8 moves of history.
-  for (; j < kMoveHistory; ++j) {
+  for (; j < DualNet::kMoveHistory; ++j) {
     auto* dst = features->data() + j * 2;
-    const auto* end = dst + kNumBoardFeatures;
+    const auto* end = dst + DualNet::kNumBoardFeatures;
     while (dst < end) {
       dst[0] = 0;
       dst[1] = 0;
-      dst += kNumStoneFeatures;
+      dst += DualNet::kNumStoneFeatures;
     }
   }
 
   // Set the "to play" feature plane.
   float to_play_feature = to_play == Color::kBlack ? 1 : 0;
-  auto* dst = features->data() + kPlayerFeature;
-  const auto* end = dst + kNumBoardFeatures;
+  auto* dst = features->data() + DualNet::kPlayerFeature;
+  const auto* end = dst + DualNet::kNumBoardFeatures;
   while (dst < end) {
     dst[0] = to_play_feature;
-    dst += kNumStoneFeatures;
+    dst += DualNet::kNumStoneFeatures;
   }
 }
 
+}  // namespace
+
+void DualNet::SetFeatures(absl::Span<const Position::Stones* const> history,
+                          Color to_play, BoardFeatures* features) {
+  SetFeaturesImpl(
+      history.size(),
+      [history](size_t j, int c) { return (*history[j])[c].color(); },
+      to_play, features);
+}
+
+void DualNet::SetFeatures(absl::Span<const PackedPosition* const> history,
+                          Color to_play, BoardFeatures* features) {
+  SetFeaturesImpl(history.size(),
+                  [history](size_t j, int c) { return history[j]->color(c); },
+                  to_play, features);
+}
+
 DualNet::~DualNet() = default;
 
 DualNet::InputLayout DualNet::GetInputLayout() const {
@@ -22,6 +22,7 @@
 
 #include "absl/types/span.h"
 #include "cc/constants.h"
+#include "cc/packed_position.h"
 #include "cc/position.h"
 
 namespace minigo {
@@ -66,6 +67,11 @@ class DualNet {
   static void SetFeatures(absl::Span<const Position::Stones* const> history,
                           Color to_play, BoardFeatures* features);
 
+  // Same as above, reading the stones from the packed snapshots stored in the
+  // search tree.
+  static void SetFeatures(absl::Span<const PackedPosition* const> history,
+                          Color to_play, BoardFeatures* features);
+
   struct Output {
     std::array<float, kNumMoves> policy;
     float value;
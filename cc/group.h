@@ -17,6 +17,7 @@
 
 #include <cstdint>
 
+#include "cc/bitboard.h"
 #include "cc/constants.h"
 #include "cc/inline_vector.h"
 
@@ -26,12 +27,13 @@ namespace minigo {
 using GroupId = uint16_t;
 
 // Group represents a group (string) of stones.
-// A group only keeps track of the count of its current liberties, not their
-// location.
+// A group keeps track of the exact set of its liberties, which makes merging
+// groups a simple set union. The number of liberties is cached alongside the
+// set so that atari & capture checks don't need to count them.
 struct Group {
   Group() = default;
-  Group(uint16_t size, uint16_t num_liberties)
-      : size(size), num_liberties(num_liberties) {}
+  Group(uint16_t size, const BitBoard& liberties)
+      : size(size), num_liberties(liberties.count()), liberties(liberties) {}
 
   // Maximum number of potential groups on the board.
   // Used in various places to pre-allocate buffers.
@@ -39,33 +41,93 @@ struct Group {
   // groups a bit: https://senseis.xmp.net/?MaximumNumberOfLiveGroups
   static constexpr int kMaxNumGroups = kN * kN;
 
+  // Adds the point c to the group's liberties if it isn't one already.
+  void AddLiberty(Coord c) {
+    if (!liberties.test(c)) {
+      liberties.set(c);
+      ++num_liberties;
+    }
+  }
+
+  // Removes the point c from the group's liberties if it is one.
+  void RemoveLiberty(Coord c) {
+    if (liberties.test(c)) {
+      liberties.reset(c);
+      --num_liberties;
+    }
+  }
+
+  // Adds all the points in ls to the group's liberties.
+  void AddLiberties(const BitBoard& ls) {
+    liberties |= ls;
+    num_liberties = liberties.count();
+  }
+
   uint16_t size = 0;
   uint16_t num_liberties = 0;
+  BitBoard liberties;
 };
 
 // GroupPool is a simple memory pool for Group objects.
 class GroupPool {
  public:
-  // Allocates a new Group with the given size and number of liberties, and
-  // returns the group's ID.
-  GroupId alloc(uint16_t size, uint16_t num_liberties) {
+  // Allocates a new Group with the given size and liberties, and returns the
+  // group's ID.
+  GroupId alloc(uint16_t size, const BitBoard& liberties) {
     GroupId id;
     if (!free_ids_.empty()) {
       // We have at least one previously acclocated then freed group, return it.
       id = free_ids_.back();
       free_ids_.pop_back();
-      groups_[id] = {size, num_liberties};
+      groups_[id] = {size, liberties};
     } else {
       // Allocate a new group from the pool.
       id = static_cast<GroupId>(groups_.size());
-      groups_.emplace_back(size, num_liberties);
+      groups_.emplace_back(size, liberties);
     }
     return id;
   }
 
+  // Frees all groups.
+  void clear() {
+    groups_.clear();
+    free_ids_.clear();
+  }
+
   // Free the group, returning it the pool.
   void free(GroupId id) { free_ids_.push_back(id); }
 
+  // Checkpoint records the allocation state of the pool, so that allocations
+  // and frees can be reverted.
+  struct Checkpoint {
+    int num_groups;
+    int num_free_ids;
+    GroupId last_free_id;
+  };
+
+  Checkpoint checkpoint() const {
+    return {groups_.size(), free_ids_.size(),
+            free_ids_.empty() ? GroupId(0) : free_ids_.back()};
+  }
+
+  // Reverts the pool to the state recorded in checkpoint. Only valid if, since
+  // the checkpoint was taken, alloc was called at most once and before any
+  // calls to free. This is the pattern of allocations made when playing a
+  // single move.
+  void restore(const Checkpoint& checkpoint) {
+    while (groups_.size() > checkpoint.num_groups) {
+      groups_.pop_back();
+    }
+    if (checkpoint.num_free_ids == 0) {
+      free_ids_.clear();
+    } else {
+      while (free_ids_.size() >= checkpoint.num_free_ids) {
+        free_ids_.pop_back();
+      }
+      free_ids_.push_back(checkpoint.last_free_id);
+    }
+  }
+
   // Access the Group object by ID.
   Group& operator[](GroupId id) { return groups_[id]; }
   const Group& operator[](GroupId id) const { return groups_[id]; }
@@ -15,6 +15,7 @@
 #include "cc/gtp_player.h"
 
 #include <algorithm>
+#include <array>
 #include <cctype>
 #include <cmath>
 #include <fstream>
@@ -32,8 +33,10 @@
 
 namespace minigo {
 
-GtpPlayer::GtpPlayer(std::unique_ptr<DualNet> network, const Options& options)
-    : MctsPlayer(std::move(network), options),
+GtpPlayer::GtpPlayer(std::unique_ptr<DualNet> network,
+                     std::shared_ptr<InferenceCache> inference_cache,
+                     const Options& options)
+    : MctsPlayer(std::move(network), std::move(inference_cache), options),
       ponder_limit_(options.ponder_limit),
       courtesy_pass_(options.courtesy_pass) {
   RegisterCmd("benchmark", &GtpPlayer::HandleBenchmark);
@@ -94,6 +97,8 @@ bool GtpPlayer::MaybePonder() {
        last_genmove_ != root()->position.to_play());
 
   if (!should_ponder) {
+    // Let the next command see the results of all the pondering.
+    FinishPipelinedBatches();
     ponder_count_ = 0;
     return false;
   }
@@ -104,8 +109,9 @@ bool GtpPlayer::MaybePonder() {
 
   TreeSearch();
 
-  ponder_count_ += options().batch_size;
+  ponder_count_ += options().batch_size * options().num_search_threads;
   if (ponder_count_ >= ponder_limit_) {
+    FinishPipelinedBatches();
     std::cerr << root()->Describe() << "\n";
     std::cerr << "finished pondering" << std::endl;
   }
@@ -262,7 +268,7 @@ GtpPlayer::Response GtpPlayer::HandleFinalScore(absl::string_view cmd,
     // Game isn't over yet, calculate the current score using Tromp-Taylor
     // scoring.
     return Response::Ok(
-        FormatScore(root()->position.CalculateScore(options().komi)));
+        FormatScore(root_position().CalculateScore(options().komi)));
   } else {
     // Game is over, we have the result available.
     return Response::Ok(result_string());
@@ -305,6 +311,9 @@ GtpPlayer::Response GtpPlayer::HandleInfo(absl::string_view cmd, CmdArgs args) {
   std::ostringstream oss;
   oss << options();
   oss << " report_search_interval:" << report_search_interval_;
+  auto tree_size = root()->CalculateSubtreeSize();
+  oss << " tree_nodes:" << tree_size.num_nodes
+      << " tree_bytes:" << tree_size.num_bytes;
   return Response::Ok(oss.str());
 }
 
@@ -380,7 +389,7 @@ GtpPlayer::Response GtpPlayer::HandleLoadsgf(absl::string_view cmd,
   NewGame();
 
   for (const auto& move : sgf::GetMainLineMoves(ast)) {
-    if (!root()->legal_moves[move.c]) {
+    if (!root()->IsLegalMove(move.c)) {
       return Response::Error("illegal move");
     }
 
@@ -491,7 +500,7 @@ GtpPlayer::Response GtpPlayer::HandleReportSearchInterval(absl::string_view cmd,
 }
 
 void GtpPlayer::ReportSearchStatus(const MctsNode* last_read) {
-  const auto& pos = root()->position;
+  const auto& pos = root_position();
 
   nlohmann::json j = {
       {"moveNum", pos.n()},
@@ -507,15 +516,28 @@ void GtpPlayer::ReportSearchStatus(const MctsNode* last_read) {
     search.push_back((*it)->move.ToKgs());
   }
 
+  // The root only has edges for legal moves. Report the others as unvisited,
+  // with the value the root was expanded with as their Q, like an unvisited
+  // edge.
+  std::array<float, kNumMoves> child_Q;
+  std::array<float, kNumMoves> child_N;
+  child_Q.fill(root()->expanded_value);
+  child_N.fill(0);
+  const auto& edges = root()->edges;
+  for (int i = 0; i < edges.size; ++i) {
+    child_Q[edges.move[i]] = edges.W[i] / (1 + edges.N[i]);
+    child_N[edges.move[i]] = edges.N[i];
+  }
+
   auto& qs = j["dq"];
   for (int i = 0; i < kNumMoves; ++i) {
-    float dq = root()->child_Q(i) - root()->Q();
+    float dq = child_Q[i] - root()->Q();
     qs.push_back(static_cast<int>(std::round(dq * 100)));
   }
 
   auto& ns = j["n"];
-  for (const auto& edge : root()->edges) {
-    ns.push_back(static_cast<int>(edge.N));
+  for (int i = 0; i < kNumMoves; ++i) {
+    ns.push_back(static_cast<int>(child_N[i]));
   }
 
   // Only report the principal variation when it changes.
@@ -532,7 +554,7 @@ void GtpPlayer::ReportSearchStatus(const MctsNode* last_read) {
 }
 
 void GtpPlayer::ReportGameState() const {
-  const auto& position = root()->position;
+  const auto& position = root_position();
 
   std::ostringstream oss;
   for (const auto& stone : position.stones()) {
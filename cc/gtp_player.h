@@ -28,6 +28,7 @@
 #include "absl/types/span.h"
 #include "cc/color.h"
 #include "cc/dual_net/dual_net.h"
+#include "cc/inference_cache.h"
 #include "cc/mcts_player.h"
 
 namespace minigo {
@@ -47,7 +48,9 @@ class GtpPlayer : public MctsPlayer {
     bool courtesy_pass = false;
   };
 
-  GtpPlayer(std::unique_ptr<DualNet> network, const Options& options);
+  GtpPlayer(std::unique_ptr<DualNet> network,
+            std::shared_ptr<InferenceCache> inference_cache,
+            const Options& options);
 
   void Run();
 
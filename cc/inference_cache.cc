@@ -0,0 +1,145 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/inference_cache.h"
+
+#include "absl/memory/memory.h"
+#include "cc/check.h"
+
+namespace minigo {
+
+size_t InferenceCache::CalculateCapacity(size_t size_mb) {
+  // Each entry also costs a few pointers in its shard's hash map, which are
+  // small compared to the output itself.
+  size_t entry_size = sizeof(DualNet::Output) + 4 * sizeof(void*);
+  return size_mb * 1024 * 1024 / entry_size;
+}
+
+InferenceCache::InferenceCache(size_t capacity, int num_shards) {
+  MG_CHECK(num_shards > 0);
+  MG_CHECK(capacity >= static_cast<size_t>(num_shards))
+      << "capacity " << capacity << " must be at least num_shards "
+      << num_shards;
+  for (int i = 0; i < num_shards; ++i) {
+    // Spread any remainder over the first shards.
+    size_t shard_capacity = capacity / num_shards;
+    if (static_cast<size_t>(i) < capacity % num_shards) {
+      shard_capacity += 1;
+    }
+    shards_.push_back(absl::make_unique<Shard>(shard_capacity));
+  }
+}
+
+bool InferenceCache::TryGet(Key key, DualNet::Output* output) {
+  return GetShard(key)->TryGet(key, output);
+}
+
+void InferenceCache::Add(Key key, const DualNet::Output& output) {
+  GetShard(key)->Add(key, output);
+}
+
+void InferenceCache::Clear() {
+  for (auto& shard : shards_) {
+    shard->Clear();
+  }
+}
+
+InferenceCache::Stats InferenceCache::GetStats() const {
+  Stats stats;
+  for (const auto& shard : shards_) {
+    shard->AddStats(&stats);
+  }
+  return stats;
+}
+
+InferenceCache::Shard::Shard(size_t capacity) : entries_(capacity) {
+  map_.reserve(capacity);
+  list_.prev = &list_;
+  list_.next = &list_;
+}
+
+bool InferenceCache::Shard::TryGet(Key key, DualNet::Output* output) {
+  absl::MutexLock lock(&mu_);
+  auto it = map_.find(key);
+  if (it == map_.end()) {
+    ++num_misses_;
+    return false;
+  }
+  ++num_hits_;
+  auto* entry = it->second;
+  Unlink(entry);
+  PushFront(entry);
+  *output = entry->output;
+  return true;
+}
+
+void InferenceCache::Shard::Add(Key key, const DualNet::Output& output) {
+  absl::MutexLock lock(&mu_);
+  if (map_.contains(key)) {
+    return;
+  }
+
+  Entry* entry;
+  if (num_used_ < entries_.size()) {
+    entry = &entries_[num_used_++];
+  } else {
+    // Evict the least recently used entry.
+    entry = list_.prev;
+    Unlink(entry);
+    map_.erase(entry->key);
+  }
+  entry->key = key;
+  entry->output = output;
+  PushFront(entry);
+  map_.emplace(key, entry);
+}
+
+void InferenceCache::Shard::Clear() {
+  absl::MutexLock lock(&mu_);
+  map_.clear();
+  num_used_ = 0;
+  list_.prev = &list_;
+  list_.next = &list_;
+}
+
+void InferenceCache::Shard::AddStats(Stats* stats) const {
+  absl::MutexLock lock(&mu_);
+  stats->num_hits += num_hits_;
+  stats->num_misses += num_misses_;
+  stats->size += map_.size();
+  stats->capacity += entries_.size();
+}
+
+void InferenceCache::Shard::Unlink(Entry* entry) {
+  entry->prev->next = entry->next;
+  entry->next->prev = entry->prev;
+}
+
+void InferenceCache::Shard::PushFront(Entry* entry) {
+  entry->prev = &list_;
+  entry->next = list_.next;
+  list_.next->prev = entry;
+  list_.next = entry;
+}
+
+std::ostream& operator<<(std::ostream& os, const InferenceCache::Stats& stats) {
+  size_t num_lookups = stats.num_hits + stats.num_misses;
+  return os << "size:" << stats.size << " capacity:" << stats.capacity
+            << " hits:" << stats.num_hits << " misses:" << stats.num_misses
+            << " hit_rate:"
+            << (num_lookups != 0 ? 100.0 * stats.num_hits / num_lookups : 0)
+            << "%";
+}
+
+}  // namespace minigo
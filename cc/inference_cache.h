@@ -0,0 +1,120 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_INFERENCE_CACHE_H_
+#define CC_INFERENCE_CACHE_H_
+
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "cc/dual_net/dual_net.h"
+#include "cc/zobrist.h"
+
+namespace minigo {
+
+// A bounded cache of DualNet outputs, which evicts the least recently used
+// output when it's full. Outputs are keyed by a hash of everything that
+// determines the input features of a position, i.e. MctsNode::history_hash, so
+// that positions which were evaluated before (for example in the opening of an
+// earlier selfplay game, or by another thread) don't need to be evaluated
+// again.
+//
+// The cache is split into shards that each have their own mutex & LRU list,
+// so it can be shared by many threads without them all contending for the
+// same lock. The outputs are stored without any symmetry applied, and all the
+// players that share a cache must use the same model.
+class InferenceCache {
+ public:
+  using Key = zobrist::Hash;
+
+  struct Stats {
+    size_t num_hits = 0;
+    size_t num_misses = 0;
+    size_t size = 0;
+    size_t capacity = 0;
+  };
+
+  // Returns the number of outputs that fit in a cache of size_mb megabytes.
+  static size_t CalculateCapacity(size_t size_mb);
+
+  // Creates a cache that holds up to capacity outputs, split evenly between
+  // num_shards shards.
+  InferenceCache(size_t capacity, int num_shards);
+
+  InferenceCache(const InferenceCache&) = delete;
+  InferenceCache& operator=(const InferenceCache&) = delete;
+
+  // If the cache has an output for key, copies it to output, marks it as the
+  // most recently used & returns true. Otherwise returns false.
+  bool TryGet(Key key, DualNet::Output* output);
+
+  // Adds the output for key to the cache, evicting the least recently used
+  // output in key's shard if the shard is full. Does nothing if the cache
+  // already has an output for key.
+  void Add(Key key, const DualNet::Output& output);
+
+  // Removes all the outputs from the cache. The stats aren't reset.
+  void Clear();
+
+  // Returns the stats summed over all the shards.
+  Stats GetStats() const;
+
+ private:
+  // An LRU cache with a fixed capacity. The entries are allocated up front and
+  // form a doubly linked list in order of use, starting with the most recently
+  // used entry.
+  class Shard {
+   public:
+    explicit Shard(size_t capacity);
+
+    bool TryGet(Key key, DualNet::Output* output);
+    void Add(Key key, const DualNet::Output& output);
+    void Clear();
+    void AddStats(Stats* stats) const;
+
+   private:
+    struct Entry {
+      Key key;
+      Entry* prev;
+      Entry* next;
+      DualNet::Output output;
+    };
+
+    void Unlink(Entry* entry) EXCLUSIVE_LOCKS_REQUIRED(&mu_);
+    void PushFront(Entry* entry) EXCLUSIVE_LOCKS_REQUIRED(&mu_);
+
+    mutable absl::Mutex mu_;
+    std::vector<Entry> entries_ GUARDED_BY(&mu_);
+    size_t num_used_ GUARDED_BY(&mu_) = 0;
+    Entry list_ GUARDED_BY(&mu_);
+    absl::flat_hash_map<Key, Entry*> map_ GUARDED_BY(&mu_);
+    size_t num_hits_ GUARDED_BY(&mu_) = 0;
+    size_t num_misses_ GUARDED_BY(&mu_) = 0;
+  };
+
+  Shard* GetShard(Key key) { return shards_[key % shards_.size()].get(); }
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+std::ostream& operator<<(std::ostream& os, const InferenceCache::Stats& stats);
+
+}  // namespace minigo
+
+#endif  // CC_INFERENCE_CACHE_H_
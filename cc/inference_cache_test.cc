@@ -0,0 +1,103 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/inference_cache.h"
+
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+DualNet::Output MakeOutput(float value) {
+  DualNet::Output output;
+  output.policy.fill(value);
+  output.value = value;
+  return output;
+}
+
+TEST(InferenceCacheTest, TryGetAndAdd) {
+  InferenceCache cache(4, 1);
+  DualNet::Output output;
+  EXPECT_FALSE(cache.TryGet(1, &output));
+
+  cache.Add(1, MakeOutput(0.5));
+  ASSERT_TRUE(cache.TryGet(1, &output));
+  EXPECT_EQ(0.5, output.value);
+  EXPECT_EQ(0.5, output.policy[0]);
+  EXPECT_FALSE(cache.TryGet(2, &output));
+
+  // Adding an output for a key that's already cached keeps the old output.
+  cache.Add(1, MakeOutput(0.25));
+  ASSERT_TRUE(cache.TryGet(1, &output));
+  EXPECT_EQ(0.5, output.value);
+
+  auto stats = cache.GetStats();
+  EXPECT_EQ(2, stats.num_hits);
+  EXPECT_EQ(2, stats.num_misses);
+  EXPECT_EQ(1, stats.size);
+  EXPECT_EQ(4, stats.capacity);
+}
+
+TEST(InferenceCacheTest, EvictsLeastRecentlyUsed) {
+  InferenceCache cache(3, 1);
+  DualNet::Output output;
+  cache.Add(1, MakeOutput(1));
+  cache.Add(2, MakeOutput(2));
+  cache.Add(3, MakeOutput(3));
+
+  // Using 1 makes 2 the least recently used output.
+  EXPECT_TRUE(cache.TryGet(1, &output));
+  cache.Add(4, MakeOutput(4));
+  EXPECT_FALSE(cache.TryGet(2, &output));
+  EXPECT_TRUE(cache.TryGet(1, &output));
+  EXPECT_TRUE(cache.TryGet(3, &output));
+  ASSERT_TRUE(cache.TryGet(4, &output));
+  EXPECT_EQ(4, output.value);
+  EXPECT_EQ(3, cache.GetStats().size);
+
+  // The least recently used is now 1.
+  cache.Add(5, MakeOutput(5));
+  EXPECT_FALSE(cache.TryGet(1, &output));
+  EXPECT_TRUE(cache.TryGet(5, &output));
+}
+
+TEST(InferenceCacheTest, Shards) {
+  InferenceCache cache(10, 3);
+  EXPECT_EQ(10, cache.GetStats().capacity);
+
+  // Fill the cache many times over: no shard can hold more than its share of
+  // the capacity.
+  for (InferenceCache::Key key = 0; key < 100; ++key) {
+    cache.Add(key, MakeOutput(key));
+  }
+  EXPECT_EQ(10, cache.GetStats().size);
+
+  // The last few keys added to each shard are still cached.
+  DualNet::Output output;
+  for (InferenceCache::Key key = 97; key < 100; ++key) {
+    ASSERT_TRUE(cache.TryGet(key, &output));
+    EXPECT_EQ(key, output.value);
+  }
+
+  cache.Clear();
+  EXPECT_EQ(0, cache.GetStats().size);
+  EXPECT_FALSE(cache.TryGet(99, &output));
+  for (InferenceCache::Key key = 0; key < 100; ++key) {
+    cache.Add(key, MakeOutput(key));
+  }
+  EXPECT_EQ(10, cache.GetStats().size);
+}
+
+}  // namespace
+}  // namespace minigo
@@ -43,6 +43,7 @@
 #include "cc/file/path.h"
 #include "cc/file/utils.h"
 #include "cc/gtp_player.h"
+#include "cc/inference_cache.h"
 #include "cc/init.h"
 #include "cc/mcts_player.h"
 #include "cc/random.h"
@@ -65,6 +66,10 @@ DEFINE_double(resign_threshold, -0.999, "Resign threshold.");
 DEFINE_double(komi, minigo::kDefaultKomi, "Komi.");
 DEFINE_double(disable_resign_pct, 0.1,
               "Fraction of games to disable resignation for.");
+DEFINE_bool(adjudicate_pass_alive, false,
+            "If true and in selfplay mode, end each game as soon as the "
+            "pass-alive stones & territory of the two players decide the "
+            "result, instead of playing on until both players pass.");
 DEFINE_uint64(seed, 0,
               "Random seed. Use default value of 0 to use a time-based seed. "
               "This seed is used to control the moves played, not whether a "
@@ -73,8 +78,51 @@ DEFINE_uint64(seed, 0,
 // Tree search flags.
 DEFINE_int32(num_readouts, 100,
              "Number of readouts to make during tree search for each move.");
+DEFINE_int32(fast_readouts, 0,
+             "If non-zero and in selfplay mode, playout cap randomization is "
+             "enabled: each move is searched in full with probability "
+             "full_search_probability and with this many readouts otherwise. "
+             "Only positions that were searched in full are written as "
+             "training examples.");
+DEFINE_double(full_search_probability, 0.25,
+              "If fast_readouts is non-zero, the probability that a move is "
+              "searched with the full num_readouts.");
+DEFINE_bool(gumbel_root_search, false,
+            "If true and in selfplay mode, the root of each search samples "
+            "gumbel_num_sampled_actions moves with Gumbel noise and splits the "
+            "readouts between them by sequential halving, instead of using "
+            "PUCT with Dirichlet noise. The training targets are made from the "
+            "completed Q-values of the root's moves instead of their visit "
+            "counts, which makes much smaller values of num_readouts useful.");
+DEFINE_int32(gumbel_num_sampled_actions, 16,
+             "If gumbel_root_search is true, the number of moves that are "
+             "sampled at the root of each search.");
 DEFINE_int32(virtual_losses, 8,
              "Number of virtual losses when running tree search.");
+DEFINE_int32(num_search_threads, 1,
+             "Number of threads that search the tree in parallel in gtp mode. "
+             "If greater than 1, the model is run without batching and its "
+             "engine must support concurrent inference.");
+DEFINE_int32(pipeline_depth, 0,
+             "Number of batches of tree search to pipeline in gtp mode, so that "
+             "the next batch is selected while earlier ones run inference. If "
+             "0, the number of inference requests the engine can have in "
+             "flight at once is used. If greater than 1, the model is run "
+             "without batching.");
+DEFINE_bool(use_transposition_table, false,
+            "If true, positions that are reached by different sequences of "
+            "moves during tree search share a node in the search tree.");
+DEFINE_int32(max_tree_nodes, 0,
+             "If non-zero, the maximum number of nodes in the search tree. "
+             "When the tree grows past this, the subtrees with the fewest "
+             "visits are freed.");
+DEFINE_int32(cache_size_mb, 0,
+             "Size in megabytes of the cache of inference results that is "
+             "shared by all the players that use the same model. If 0, "
+             "inference results aren't cached.");
+DEFINE_int32(cache_shards, 8,
+             "Number of ways to shard the inference cache. Each shard has its "
+             "own lock, so more shards reduce contention between threads.");
 DEFINE_bool(inject_noise, true,
             "If true, inject noise into the root position at the start of "
             "each tree search.");
@@ -104,6 +152,13 @@ DEFINE_double(
 DEFINE_double(decay_factor, 0.98,
               "If time_limit is non-zero, the decay factor used to shorten the "
               "amount of time spent thinking as the game progresses.");
+DEFINE_bool(early_termination, false,
+            "If true, stop searching for a move as soon as the most visited "
+            "move can't be overtaken in the readouts or time that are left, "
+            "and with a time_limit, let a search whose best move is unstable "
+            "use some of the time that earlier moves saved. Intended for eval "
+            "& gtp modes: in selfplay, it changes the visit counts that "
+            "training targets are made from.");
 DEFINE_bool(run_forever, false,
             "When running 'selfplay' mode, whether to run forever.");
 
@@ -117,6 +172,11 @@ DEFINE_string(model_two, "",
               "When running 'eval' mode, provide a path to a second minigo "
               "model, also serialized as a GraphDef proto.");
 DEFINE_int32(parallel_games, 32, "Number of games to play in parallel.");
+DEFINE_int32(num_selfplay_threads, 0,
+             "If non-zero and in selfplay mode, the parallel_games games are "
+             "multiplexed on this many threads, each of which searches its "
+             "games in turn and runs inference on all their leaves in a single "
+             "batch. If 0, each game is played on its own thread.");
 
 // Output flags.
 DEFINE_string(output_dir, "",
@@ -147,20 +207,55 @@ namespace minigo {
 namespace {
 
 std::unique_ptr<DualNetFactory> NewDualNetFactory(const std::string& model_path,
-                                                  int num_parallel_games) {
+                                                  int num_parallel_games,
+                                                  int games_per_client) {
   auto dual_net = NewDualNet(model_path);
   // Calculate batch size suiteable for a DualNet which handles inference
   // requests from num_parallel_games each with at most virtual_losses features
   // each so that the maximum number of features in flight results in
-  // buffer_count batches.
+  // buffer_count batches. A client that plays games_per_client games sends the
+  // features of all of them in one request, which must fit in a batch.
   int buffer_count = dual_net->GetBufferCount();
   size_t batch_size =
       std::max((FLAGS_virtual_losses * num_parallel_games + buffer_count - 1) /
                    buffer_count,
-               FLAGS_virtual_losses);
+               FLAGS_virtual_losses * games_per_client);
   return NewBatchingFactory(std::move(dual_net), batch_size);
 }
 
+// References a pointer to an actual DualNet. Allows updating the pointer
+// after the MctsPlayer has been constructed.
+class WrappedDualNet : public DualNet {
+ public:
+  explicit WrappedDualNet(const std::unique_ptr<DualNet>* dual_net)
+      : dual_net_(dual_net) {
+    MG_CHECK(dual_net);
+  }
+
+ private:
+  void RunMany(std::vector<const BoardFeatures*> features,
+               std::vector<Output*> outputs, std::string* model) override {
+    dual_net_->get()->RunMany(std::move(features), std::move(outputs), model);
+  };
+
+  InputLayout GetInputLayout() const override {
+    return dual_net_->get()->GetInputLayout();
+  }
+
+  const std::unique_ptr<DualNet>* const dual_net_;
+};
+
+// Returns a new inference cache of --cache_size_mb megabytes, or nullptr if
+// caching is disabled.
+std::shared_ptr<InferenceCache> NewInferenceCache() {
+  if (FLAGS_cache_size_mb == 0) {
+    return nullptr;
+  }
+  return std::make_shared<InferenceCache>(
+      InferenceCache::CalculateCapacity(FLAGS_cache_size_mb),
+      FLAGS_cache_shards);
+}
+
 std::string GetOutputName(absl::Time now, size_t i) {
   auto timestamp = absl::ToUnixSeconds(now);
   std::string output_name;
@@ -248,23 +343,51 @@ void ParseMctsPlayerOptionsFromFlags(MctsPlayer::Options* options) {
   options->random_symmetry = FLAGS_random_symmetry;
   options->resign_threshold = FLAGS_resign_threshold;
   options->batch_size = FLAGS_virtual_losses;
+  options->use_transposition_table = FLAGS_use_transposition_table;
+  options->max_tree_nodes = FLAGS_max_tree_nodes;
   options->komi = FLAGS_komi;
   options->random_seed = FLAGS_seed;
   options->num_readouts = FLAGS_num_readouts;
   options->seconds_per_move = FLAGS_seconds_per_move;
   options->time_limit = FLAGS_time_limit;
   options->decay_factor = FLAGS_decay_factor;
+  options->early_termination = FLAGS_early_termination;
 }
 
 class SelfPlayer {
  public:
   void Run() {
+    // Only print the board using ANSI colors if stderr is sent to the
+    // terminal.
+    use_ansi_colors_ = isatty(fileno(stderr));
+
+    bigtable_spec_ = absl::StrSplit(FLAGS_output_bigtable, ',');
+    if (!FLAGS_output_bigtable.empty() && bigtable_spec_.size() != 3) {
+      MG_FATAL()
+          << "Bigtable output must be of the form: project,instance,table";
+      return;
+    }
+
+    int num_threads = FLAGS_num_selfplay_threads;
     {
       absl::MutexLock lock(&mutex_);
-      dual_net_factory_ = NewDualNetFactory(FLAGS_model, FLAGS_parallel_games);
+      int games_per_thread =
+          num_threads > 0
+              ? (FLAGS_parallel_games + num_threads - 1) / num_threads
+              : 1;
+      dual_net_factory_ = NewDualNetFactory(
+          FLAGS_model, FLAGS_parallel_games, games_per_thread);
+      inference_cache_ = NewInferenceCache();
     }
-    for (int i = 0; i < FLAGS_parallel_games; ++i) {
-      threads_.emplace_back(std::bind(&SelfPlayer::ThreadRun, this, i));
+    if (num_threads > 0) {
+      for (int i = 0; i < num_threads; ++i) {
+        threads_.emplace_back(std::bind(&SelfPlayer::MultiplexedThreadRun,
+                                        this, i, num_threads));
+      }
+    } else {
+      for (int i = 0; i < FLAGS_parallel_games; ++i) {
+        threads_.emplace_back(std::bind(&SelfPlayer::ThreadRun, this, i));
+      }
     }
     for (auto& t : threads_) {
       t.join();
@@ -286,6 +409,12 @@ class SelfPlayer {
         player_options.random_seed += 1299283 * thread_id;
       }
       player_options.resign_enabled = (*rnd)() >= FLAGS_disable_resign_pct;
+      player_options.adjudicate_pass_alive = FLAGS_adjudicate_pass_alive;
+      player_options.fast_readouts = FLAGS_fast_readouts;
+      player_options.full_search_probability = FLAGS_full_search_probability;
+      player_options.gumbel_root_search = FLAGS_gumbel_root_search;
+      player_options.gumbel_num_sampled_actions =
+          FLAGS_gumbel_num_sampled_actions;
 
       run_forever = FLAGS_run_forever;
       holdout_pct = FLAGS_holdout_pct;
@@ -302,11 +431,25 @@ class SelfPlayer {
     std::string sgf_dir;
   };
 
+  // A game that's being played, and the options it was started with.
+  struct Game {
+    explicit Game(int game_id) : game_id(game_id) {}
+
+    int game_id;
+    GameOptions options;
+    std::unique_ptr<MctsPlayer> player;
+    absl::Time start_time;
+  };
+
   void LogEndGameInfo(MctsPlayer* player, absl::Duration game_time) {
     std::cout << player->result_string() << std::endl;
     std::cout << "Playing game: " << absl::ToDoubleSeconds(game_time)
               << std::endl;
     std::cout << "Played moves: " << player->root()->position.n() << std::endl;
+    if (inference_cache_ != nullptr) {
+      std::cout << "Inference cache: " << inference_cache_->GetStats()
+                << std::endl;
+    }
 
     const auto& history = player->history();
     if (history.empty()) {
@@ -351,89 +494,148 @@ class SelfPlayer {
     }
   }
 
-  void ThreadRun(int thread_id) {
-    // Only print the board using ANSI colors if stderr is sent to the
-    // terminal.
-    const bool use_ansi_colors = isatty(fileno(stderr));
+  // Starts a new game with the latest flags. If dual_net is null, the game's
+  // player gets its own client of the batching service. Otherwise, it runs
+  // inference on *dual_net.
+  void StartGame(const std::unique_ptr<DualNet>* dual_net, Game* game) {
+    game->player.reset();
+    absl::MutexLock lock(&mutex_);
+    auto old_model = FLAGS_model;
+    MaybeReloadFlags();
+    MG_CHECK(old_model == FLAGS_model)
+        << "Manually changing the model during selfplay is not supported.";
+    game->options.Init(game->game_id, &rnd_);
+    std::unique_ptr<DualNet> player_dual_net;
+    if (dual_net == nullptr) {
+      player_dual_net = dual_net_factory_->New();
+    } else {
+      player_dual_net = absl::make_unique<WrappedDualNet>(dual_net);
+    }
+    game->player = absl::make_unique<MctsPlayer>(
+        std::move(player_dual_net), inference_cache_,
+        game->options.player_options);
+    game->start_time = absl::Now();
+  }
 
-    GameOptions game_options;
-    std::vector<std::string> bigtable_spec =
-        absl::StrSplit(FLAGS_output_bigtable, ',');
-    bool use_bigtable = bigtable_spec.size() == 3;
-    if (!FLAGS_output_bigtable.empty() && !use_bigtable) {
-      MG_FATAL()
-          << "Bigtable output must be of the form: project,instance,table";
-      return;
+  void PlayMove(Game* game, Coord move) {
+    auto* player = game->player.get();
+    if (player->options().verbose) {
+      const auto& position = player->root_position();
+      std::cerr << position.ToPrettyString(use_ansi_colors_);
+      std::cerr << "Move: " << position.n()
+                << " Captures X: " << position.num_captures()[0]
+                << " O: " << position.num_captures()[1] << std::endl;
+      std::cerr << player->root()->Describe() << std::endl;
+    }
+    player->PlayMove(move);
+  }
+
+  // Logs the result of a game that's over and writes its outputs.
+  void EndGame(Game* game) {
+    const auto& game_options = game->options;
+    const auto* player = game->player.get();
+    {
+      // Log the end game info with the shared mutex held to prevent the
+      // outputs from multiple threads being interleaved.
+      absl::MutexLock lock(&mutex_);
+      LogEndGameInfo(game->player.get(), absl::Now() - game->start_time);
     }
 
+    // Write the outputs.
+    auto now = absl::Now();
+    auto output_name = GetOutputName(now, game->game_id);
+
+    bool is_holdout;
+    {
+      absl::MutexLock lock(&mutex_);
+      is_holdout = rnd_() < game_options.holdout_pct;
+    }
+    auto example_dir =
+        is_holdout ? game_options.holdout_dir : game_options.output_dir;
+    if (!example_dir.empty()) {
+      tf_utils::WriteGameExamples(GetOutputDir(now, example_dir), output_name,
+                                  *player);
+    }
+    if (bigtable_spec_.size() == 3) {
+      const auto& gcp_project_name = bigtable_spec_[0];
+      const auto& instance_name = bigtable_spec_[1];
+      const auto& table_name = bigtable_spec_[2];
+      tf_utils::WriteGameExamples(gcp_project_name, instance_name, table_name,
+                                  *player);
+    }
+
+    if (!game_options.sgf_dir.empty()) {
+      WriteSgf(
+          GetOutputDir(now, file::JoinPath(game_options.sgf_dir, "clean")),
+          output_name, *player, false);
+      WriteSgf(GetOutputDir(now, file::JoinPath(game_options.sgf_dir, "full")),
+               output_name, *player, true);
+    }
+  }
+
+  void ThreadRun(int thread_id) {
+    Game game(thread_id);
     do {
-      std::unique_ptr<MctsPlayer> player;
-
-      {
-        absl::MutexLock lock(&mutex_);
-        auto old_model = FLAGS_model;
-        MaybeReloadFlags();
-        MG_CHECK(old_model == FLAGS_model)
-            << "Manually changing the model during selfplay is not supported.";
-        game_options.Init(thread_id, &rnd_);
-        player = absl::make_unique<MctsPlayer>(dual_net_factory_->New(),
-                                               game_options.player_options);
+      StartGame(nullptr, &game);
+      while (!game.player->game_over()) {
+        PlayMove(&game, game.player->SuggestMove());
       }
+      EndGame(&game);
+    } while (game.options.run_forever);
 
-      // Play the game.
-      auto start_time = absl::Now();
-      while (!player->game_over()) {
-        auto move = player->SuggestMove();
-        if (player->options().verbose) {
-          const auto& position = player->root()->position;
-          std::cerr << player->root()->position.ToPrettyString(use_ansi_colors);
-          std::cerr << "Move: " << position.n()
-                    << " Captures X: " << position.num_captures()[0]
-                    << " O: " << position.num_captures()[1] << std::endl;
-          std::cerr << player->root()->Describe() << std::endl;
-        }
-        player->PlayMove(move);
-      }
+    std::cerr << "Thread " << thread_id << " stopping" << std::endl;
+  }
 
-      {
-        // Log the end game info with the shared mutex held to prevent the
-        // outputs from multiple threads being interleaved.
-        absl::MutexLock lock(&mutex_);
-        LogEndGameInfo(player.get(), absl::Now() - start_time);
-      }
+  // Plays every num_threads'th game, starting with game thread_id. Instead of
+  // blocking on inference for one game at a time, the thread searches each of
+  // its games until it has a batch of leaves to evaluate, then runs inference
+  // on the leaves of all its games in a single request.
+  void MultiplexedThreadRun(int thread_id, int num_threads) {
+    std::unique_ptr<DualNet> dual_net;
+    {
+      absl::MutexLock lock(&mutex_);
+      dual_net = dual_net_factory_->New();
+    }
 
-      // Write the outputs.
-      auto now = absl::Now();
-      auto output_name = GetOutputName(now, thread_id);
+    std::vector<std::unique_ptr<Game>> games;
+    for (int i = thread_id; i < FLAGS_parallel_games; i += num_threads) {
+      games.push_back(absl::make_unique<Game>(i));
+      StartGame(&dual_net, games.back().get());
+    }
 
-      bool is_holdout;
-      {
-        absl::MutexLock lock(&mutex_);
-        is_holdout = rnd_() < game_options.holdout_pct;
-      }
-      auto example_dir =
-          is_holdout ? game_options.holdout_dir : game_options.output_dir;
-      if (!example_dir.empty()) {
-        tf_utils::WriteGameExamples(GetOutputDir(now, example_dir), output_name,
-                                    *player);
+    std::vector<const DualNet::BoardFeatures*> features;
+    std::vector<DualNet::Output*> outputs;
+    std::string model;
+    while (!games.empty()) {
+      // Play the moves whose search has finished, replacing the games that
+      // end with new ones, until every game has leaves to evaluate.
+      features.clear();
+      outputs.clear();
+      for (auto it = games.begin(); it != games.end();) {
+        auto* game = it->get();
+        bool stopped = false;
+        while (!game->player->SelectLeavesForInference(&features, &outputs)) {
+          PlayMove(game, game->player->FinishSearch());
+          if (game->player->game_over()) {
+            EndGame(game);
+            if (!game->options.run_forever) {
+              stopped = true;
+              break;
+            }
+            StartGame(&dual_net, game);
+          }
+        }
+        it = stopped ? games.erase(it) : it + 1;
       }
-      if (use_bigtable) {
-        const auto& gcp_project_name = bigtable_spec[0];
-        const auto& instance_name = bigtable_spec[1];
-        const auto& table_name = bigtable_spec[2];
-        tf_utils::WriteGameExamples(gcp_project_name, instance_name, table_name,
-                                    *player);
+      if (games.empty()) {
+        break;
       }
 
-      if (!game_options.sgf_dir.empty()) {
-        WriteSgf(
-            GetOutputDir(now, file::JoinPath(game_options.sgf_dir, "clean")),
-            output_name, *player, false);
-        WriteSgf(
-            GetOutputDir(now, file::JoinPath(game_options.sgf_dir, "full")),
-            output_name, *player, true);
+      dual_net->RunMany(features, outputs, &model);
+      for (auto& game : games) {
+        game->player->IncorporateInferenceResults(model);
       }
-    } while (game_options.run_forever);
+    }
 
     std::cerr << "Thread " << thread_id << " stopping" << std::endl;
   }
@@ -480,9 +682,12 @@ class SelfPlayer {
 
   absl::Mutex mutex_;
   std::unique_ptr<DualNetFactory> dual_net_factory_ GUARDED_BY(&mutex_);
+  std::shared_ptr<InferenceCache> inference_cache_;
   Random rnd_ GUARDED_BY(&mutex_);
   std::vector<std::thread> threads_;
   uint64_t flags_timestamp_ = 0;
+  bool use_ansi_colors_ = false;
+  std::vector<std::string> bigtable_spec_;
 };
 
 class Evaluator {
@@ -528,32 +733,16 @@ class Evaluator {
     size_t generation_ GUARDED_BY(&mutex_);
   };
 
-  // References a pointer to an actual DualNet. Allows updating the pointer
-  // after the MctsPlayer has been constructed.
-  class WrappedDualNet : public DualNet {
-   public:
-    explicit WrappedDualNet(const std::unique_ptr<DualNet>* dual_net)
-        : dual_net_(dual_net) {
-      MG_CHECK(dual_net);
-    }
-
-   private:
-    void RunMany(std::vector<const BoardFeatures*> features,
-                 std::vector<Output*> outputs, std::string* model) override {
-      dual_net_->get()->RunMany(std::move(features), std::move(outputs), model);
-    };
-
-    const std::unique_ptr<DualNet>* const dual_net_;
-  };
-
   struct Model {
     Model(const std::string& model_path)
         : name(file::Stem(model_path)),
-          factory(NewDualNetFactory(model_path, FLAGS_parallel_games)),
+          factory(NewDualNetFactory(model_path, FLAGS_parallel_games, 1)),
+          inference_cache(NewInferenceCache()),
           black_wins(0),
           white_wins(0) {}
     std::string name;
     std::unique_ptr<DualNetFactory> factory;
+    std::shared_ptr<InferenceCache> inference_cache;
     std::atomic<int> black_wins;
     std::atomic<int> white_wins;
   };
@@ -646,12 +835,14 @@ class Evaluator {
     player_options.verbose = thread_id == 0;
     player_options.name = model->name;
     auto player = absl::make_unique<MctsPlayer>(
-        absl::make_unique<WrappedDualNet>(&dual_net), player_options);
+        absl::make_unique<WrappedDualNet>(&dual_net), model->inference_cache,
+        player_options);
 
     player_options.verbose = false;
     player_options.name = other_model->name;
     auto other_player = absl::make_unique<MctsPlayer>(
-        absl::make_unique<WrappedDualNet>(&dual_net), player_options);
+        absl::make_unique<WrappedDualNet>(&dual_net),
+        other_model->inference_cache, player_options);
 
     auto* black = player.get();
     auto* white = other_player.get();
@@ -678,7 +869,7 @@ class Evaluator {
       player->PlayMove(move);
       other_player->PlayMove(move);
       if (player->options().verbose) {
-        std::cerr << player->root()->position.ToPrettyString();
+        std::cerr << player->root_position().ToPrettyString();
       }
       std::swap(factory, other_factory);
       std::swap(player, other_player);
@@ -732,8 +923,21 @@ void Gtp() {
   options.name = absl::StrCat("minigo-", file::Basename(FLAGS_model));
   options.ponder_limit = FLAGS_ponder_limit;
   options.courtesy_pass = FLAGS_courtesy_pass;
-  auto dual_net_factory = NewDualNetFactory(FLAGS_model, 1);
-  auto player = absl::make_unique<GtpPlayer>(dual_net_factory->New(), options);
+  options.num_search_threads = FLAGS_num_search_threads;
+  std::unique_ptr<DualNetFactory> dual_net_factory;
+  auto dual_net = NewDualNet(FLAGS_model);
+  options.pipeline_depth = FLAGS_pipeline_depth != 0
+                               ? FLAGS_pipeline_depth
+                               : dual_net->GetBufferCount();
+  if (options.num_search_threads == 1 && options.pipeline_depth == 1) {
+    // A batching client only supports one inference request at a time, so
+    // it's only used if the player doesn't run inference concurrently.
+    dual_net_factory =
+        NewBatchingFactory(std::move(dual_net), FLAGS_virtual_losses);
+    dual_net = dual_net_factory->New();
+  }
+  auto player = absl::make_unique<GtpPlayer>(std::move(dual_net),
+                                             NewInferenceCache(), options);
   player->Run();
 }
 
@@ -759,7 +963,7 @@ void Puzzle() {
     games.emplace_back(std::move(moves));
   }
 
-  auto factory = NewDualNetFactory(FLAGS_model, parallel_games);
+  auto factory = NewDualNetFactory(FLAGS_model, parallel_games, 1);
   std::cerr << "DualNet factory created from " << FLAGS_model << " in "
             << absl::ToDoubleSeconds(absl::Now() - start_time) << " sec."
             << std::endl;
@@ -767,13 +971,14 @@ void Puzzle() {
   MctsPlayer::Options options;
   ParseMctsPlayerOptionsFromFlags(&options);
   options.verbose = false;
+  auto inference_cache = NewInferenceCache();
 
   using Pair = std::pair<std::unique_ptr<MctsPlayer>, Move>;
   std::vector<Pair> puzzles;
   for (const auto& moves : games) {
     std::vector<std::unique_ptr<MctsPlayer>> players(moves.size());
     for (auto& player : players) {
-      player.reset(new MctsPlayer(factory->New(), options));
+      player.reset(new MctsPlayer(factory->New(), inference_cache, options));
     }
     for (const auto& move : moves) {
       puzzles.emplace_back(std::move(players.back()), move);
@@ -16,138 +16,301 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <functional>
+#include <limits>
+#include <memory>
+#include <numeric>
 #include <tuple>
 #include <utility>
 
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
 #include "absl/strings/str_format.h"
-#include "cc/algorithm.h"
 #include "cc/check.h"
+#include "cc/dual_net/dual_net.h"
 
 namespace minigo {
 
 namespace {
 
-void InitLegalMoves(MctsNode* node) {
-  auto& position = node->position;
-  auto position_hash = position.stone_hash();
-  auto to_play = position.to_play();
+constexpr int kSuperKoCacheStride = 8;
+
+void InitSuperkoCache(MctsNode* node) {
+  // Insert a cache of ancestor Zobrist hashes at regular depths in the tree.
+  // See the comment for superko_cache in the mcts_node.h for more details.
+  const auto& position = node->position;
+  if ((position.n() % kSuperKoCacheStride) != 0) {
+    return;
+  }
+  auto& superko_cache = node->superko_cache;
+  superko_cache = absl::make_unique<MctsNode::SuperkoCache>();
+  superko_cache->reserve(position.n() + 1);
+  superko_cache->insert(position.stone_hash());
+  for (auto* n = node->parent; n != nullptr; n = n->parent) {
+    if (n->superko_cache != nullptr) {
+      superko_cache->insert(n->superko_cache->begin(),
+                            n->superko_cache->end());
+      break;
+    }
+    superko_cache->insert(n->position.stone_hash());
+  }
+}
+
+zobrist::Hash RotateLeft(zobrist::Hash h, int n) {
+  return (h << n) | (h >> (64 - n));
+}
+
+// The history hash of a node is the XOR of the stone hashes of the positions in
+// its history (see GetMoveHistory), with the stone hash of the position from i
+// moves ago rotated left by i bits, XORed with the to play hash. Missing
+// history hashes as an empty board, just as SetFeatures pads it with zeros.
+void InitHistoryHash(MctsNode* node) {
+  const auto& position = node->position;
+  auto h = position.stone_hash();
+  const auto* parent = node->parent;
+  if (parent != nullptr) {
+    // Rotate the parent's history one move further into the past, then remove
+    // the position that's now too old.
+    h ^= RotateLeft(
+        parent->history_hash ^ zobrist::ToPlayHash(parent->position.to_play()),
+        1);
+    const auto* oldest = parent;
+    for (int i = 1; i < DualNet::kMoveHistory && oldest != nullptr; ++i) {
+      oldest = oldest->parent;
+    }
+    if (oldest != nullptr) {
+      h ^= RotateLeft(oldest->position.stone_hash(), DualNet::kMoveHistory);
+    }
+  }
+  node->history_hash = h ^ zobrist::ToPlayHash(position.to_play());
+}
+
+void InitLegalMoves(MctsNode* node, const Position& position) {
+  // Classify all moves in one pass, which also gives us the stone hash of the
+  // position resulting from each legal move for the superko check.
+  std::array<bool, kN * kN> legal;
+  std::array<zobrist::Hash, kN * kN> stone_hashes;
+  position.ClassifyAllMoves(&legal, &stone_hashes);
   for (int c = 0; c < kN * kN; ++c) {
-    switch (position.ClassifyMove(c)) {
-      case Position::MoveType::kIllegal: {
-        // The move is trivially not legal.
-        node->legal_moves[c] = false;
-        break;
-      }
+    if (legal[c] && !node->HasPositionBeenPlayedBefore(stone_hashes[c])) {
+      node->legal_moves.set(c);
+    }
+  }
+}
 
-      case Position::MoveType::kNoCapture: {
-        // The move will not capture any stones: we can calculate the new
-        // position's stone hash directly.
-        auto new_hash = position_hash ^ zobrist::MoveHash(c, to_play);
-        node->legal_moves[c] = !node->HasPositionBeenPlayedBefore(new_hash);
-        break;
-      }
+// Allocates an edge for each of the node's legal moves, in move order.
+void AllocateEdges(MctsNode* node) {
+  auto& edges = node->edges;
+  edges.Allocate(node->legal_moves.count() + 1);
+  int i = 0;
+  node->legal_moves.ForEach([&edges, &i](Coord c) { edges.move[i++] = c; });
+  edges.move[i] = Coord::kPass;
+}
 
-      case Position::MoveType::kCapture: {
-        // The move will capture some opponent stones: in order to calculate the
-        // stone hash, we actually have to play the move.
-
-        Position new_position(position);
-        // It's safe to call AddStoneToBoard instead of PlayMove because:
-        //  - we know the move is not kPass.
-        //  - the move is legal (modulo superko).
-        //  - we only care about new_position's stone_hash and not the rest of
-        //    the bookkeeping that PlayMove updates.
-        new_position.AddStoneToBoard(c, to_play);
-        auto new_hash = new_position.stone_hash();
-        node->legal_moves[c] = !node->HasPositionBeenPlayedBefore(new_hash);
-        break;
-      }
+// Returns the index of parent's edge for move, allocating the parent's edges
+// if necessary.
+int GetChildEdge(MctsNode* parent, Coord move) {
+  if (parent->edges.empty()) {
+    AllocateEdges(parent);
+  }
+  int i = parent->FindEdge(move);
+  MG_CHECK(i >= 0) << "Move " << move << " is illegal";
+  return i;
+}
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+// Returns indices[i] for the i with the highest scores[i], choosing the lowest
+// index if there's a tie.
+int ReduceArgMax(const float* scores, const int32_t* indices, int n) {
+  int best = 0;
+  for (int i = 1; i < n; ++i) {
+    if (scores[i] > scores[best] ||
+        (scores[i] == scores[best] && indices[i] < indices[best])) {
+      best = i;
     }
   }
-  node->legal_moves[Coord::kPass] = true;
+  return indices[best];
 }
+#endif
 
-constexpr int kSuperKoCacheStride = 8;
+// Returns the number of edges that are allocated for a node with size edges,
+// and the number of bytes they use.
+int GetEdgeCapacity(int size) {
+  constexpr int kPadding = MctsNode::Edges::kPadding;
+  return (size + kPadding - 1) / kPadding * kPadding;
+}
+size_t GetEdgeBytes(int capacity) {
+  return capacity * (4 * sizeof(float) + sizeof(MctsNode*) + sizeof(Coord));
+}
 
 }  // namespace
 
-MctsNode::MctsNode(EdgeStats* stats, const Position& position)
-    : parent(nullptr), stats(stats), move(Coord::kInvalid), position(position) {
-  InitLegalMoves(this);
+constexpr int MctsNode::Edges::kPadding;
+
+void MctsNode::Edges::Allocate(int size) {
+  MG_DCHECK(buffer == nullptr);
+  constexpr size_t kAlignment = kPadding * sizeof(float);
+  int capacity = GetEdgeCapacity(size);
+  size_t num_bytes = GetEdgeBytes(capacity);
+  buffer.reset(new char[num_bytes + kAlignment - 1]);
+  auto address = reinterpret_cast<uintptr_t>(buffer.get());
+  auto* data = reinterpret_cast<char*>((address + kAlignment - 1) &
+                                       ~(uintptr_t(kAlignment) - 1));
+  std::memset(data, 0, num_bytes);
+
+  N = reinterpret_cast<float*>(data);
+  W = N + capacity;
+  P = W + capacity;
+  original_P = P + capacity;
+  child = reinterpret_cast<MctsNode**>(original_P + capacity);
+  move = reinterpret_cast<Coord*>(child + capacity);
+  std::fill(child, child + capacity, nullptr);
+  std::uninitialized_fill(move, move + capacity, Coord(Coord::kInvalid));
+  std::fill(P + size, P + capacity, -std::numeric_limits<float>::infinity());
+  this->size = size;
 }
 
-MctsNode::MctsNode(MctsNode* parent, Coord move)
-    : parent(parent),
-      stats(&parent->edges[move]),
-      move(move),
-      position(parent->position) {
-  position.PlayMove(move);
+MctsNode* MctsNode::TranspositionTable::Find(const Position& position) {
+  absl::MutexLock lock(&mu_);
+  auto it = nodes_.find(position.state_hash());
+  if (it == nodes_.end() || it->second->position.n() != position.n()) {
+    return nullptr;
+  }
+  return it->second;
+}
 
-  // Insert a cache of ancestor Zobrist hashes at regular depths in the tree.
-  // See the comment for superko_cache in the mcts_node.h for more details.
-  if ((position.n() % kSuperKoCacheStride) == 0) {
-    superko_cache = absl::make_unique<SuperkoCache>();
-    superko_cache->reserve(position.n() + 1);
-    superko_cache->insert(position.stone_hash());
-    for (auto* node = parent; node != nullptr; node = node->parent) {
-      if (node->superko_cache != nullptr) {
-        superko_cache->insert(node->superko_cache->begin(),
-                              node->superko_cache->end());
-        break;
+void MctsNode::TranspositionTable::Insert(MctsNode* node) {
+  absl::MutexLock lock(&mu_);
+  nodes_.emplace(node->position.state_hash(), node);
+}
+
+void MctsNode::TranspositionTable::Rebuild(MctsNode* root) {
+  absl::MutexLock lock(&mu_);
+  nodes_.clear();
+
+  // Each node is owned by the edge that added it, so following only the edges
+  // that a node owns visits each node in root's subtree once.
+  std::vector<MctsNode*> subtree;
+  absl::flat_hash_set<const MctsNode*> in_subtree;
+  subtree.push_back(root);
+  for (size_t j = 0; j < subtree.size(); ++j) {
+    auto* node = subtree[j];
+    in_subtree.insert(node);
+    nodes_.emplace(node->position.state_hash(), node);
+    for (int i = 0; i < node->edges.size; ++i) {
+      auto* child = node->edges.child[i];
+      if (child != nullptr && child->parent == node) {
+        subtree.push_back(child);
       }
-      superko_cache->insert(node->position.stone_hash());
     }
   }
 
-  InitLegalMoves(this);
+  for (auto* node : subtree) {
+    for (int i = 0; i < node->edges.size; ++i) {
+      auto* child = node->edges.child[i];
+      if (child != nullptr && !in_subtree.contains(child)) {
+        node->edges.child[i] = nullptr;
+      }
+    }
+  }
 }
 
-Coord MctsNode::GetMostVisitedMove() const {
-  // Find the set of moves with the largest N.
-  inline_vector<Coord, kNumMoves> moves;
-  moves.push_back(0);
-  int best_N = child_N(0);
-  for (int i = 1; i < kNumMoves; ++i) {
-    int cn = child_N(i);
-    if (cn > best_N) {
-      moves.clear();
-      moves.push_back(i);
-      best_N = cn;
-    } else if (cn == best_N) {
-      moves.push_back(i);
+void MctsNode::TranspositionTable::Clear() {
+  absl::MutexLock lock(&mu_);
+  nodes_.clear();
+}
+
+size_t MctsNode::TranspositionTable::size() {
+  absl::MutexLock lock(&mu_);
+  return nodes_.size();
+}
+
+MctsNode::MctsNode(Pool* pool, EdgeStats* stats, const Position& position)
+    : pool(pool),
+      parent(nullptr),
+      stats_N(&stats->N),
+      stats_W(&stats->W),
+      move(Coord::kInvalid),
+      position(position) {
+  InitHistoryHash(this);
+  InitLegalMoves(this, position);
+}
+
+MctsNode::MctsNode(MctsNode* parent, Coord move, const Position& position)
+    : MctsNode(parent->pool, parent, GetChildEdge(parent, move), position) {}
+
+MctsNode::MctsNode(Pool* pool, MctsNode* parent, int edge,
+                   const Position& position)
+    : pool(pool),
+      parent(parent),
+      stats_N(&parent->edges.N[edge]),
+      stats_W(&parent->edges.W[edge]),
+      move(parent->edges.move[edge]),
+      position(position) {
+  MG_DCHECK(position.n() == parent->position.n() + 1);
+  InitSuperkoCache(this);
+  InitHistoryHash(this);
+  InitLegalMoves(this, position);
+}
+
+MctsNode::~MctsNode() {
+  std::vector<MctsNode*> children;
+  for (int i = 0; i < edges.size; ++i) {
+    auto* child = edges.child[i];
+    if (child != nullptr && child->parent == this) {
+      children.push_back(child);
     }
   }
+  if (!children.empty()) {
+    DeleteSubtrees(children, false);
+  }
+}
 
-  // If there's only one move with the largest N, we're done.
-  if (moves.size() == 1) {
-    return moves[0];
+int MctsNode::FindEdge(Coord c) const {
+  const Coord* begin = edges.move;
+  const Coord* end = begin + edges.size;
+  const Coord* it = std::lower_bound(begin, end, c);
+  return it != end && *it == c ? static_cast<int>(it - begin) : -1;
+}
+
+Coord MctsNode::GetMostVisitedMove() const {
+  // A node without edges has no information about its moves.
+  if (edges.empty()) {
+    return Coord::kPass;
   }
 
-  // Otherwise, break score using the child action score.
+  // Find the edge with the largest N, breaking ties using the child action
+  // score.
   float to_play = position.to_play() == Color::kBlack ? 1 : -1;
   float U_scale = kPuct * std::sqrt(1.0f + N());
 
-  Coord c = moves[0];
-  float best_cas =
-      CalculateSingleMoveChildActionScore(to_play, U_scale, moves[0]);
-  for (int i = 0; i < moves.size(); ++i) {
-    float cas = CalculateSingleMoveChildActionScore(to_play, U_scale, moves[i]);
-    if (cas > best_cas) {
+  int best = 0;
+  float best_cas = CalculateSingleMoveChildActionScore(to_play, U_scale, 0);
+  for (int i = 1; i < edges.size; ++i) {
+    if (edges.N[i] < edges.N[best]) {
+      continue;
+    }
+    float cas = CalculateSingleMoveChildActionScore(to_play, U_scale, i);
+    if (edges.N[i] > edges.N[best] || cas > best_cas) {
+      best = i;
       best_cas = cas;
-      c = moves[i];
     }
   }
 
-  return c;
+  return edges.move[best];
 }
 
 std::string MctsNode::Describe() const {
   auto child_action_score = CalculateChildActionScore();
   using SortInfo = std::tuple<float, float, int>;
-  std::array<SortInfo, kNumMoves> sort_order;
-  for (int i = 0; i < kNumMoves; ++i) {
-    sort_order[i] = SortInfo(child_N(i), child_action_score[i], i);
+  std::vector<SortInfo> sort_order;
+  sort_order.reserve(edges.size);
+  for (int i = 0; i < edges.size; ++i) {
+    sort_order.emplace_back(edges.N[i], child_action_score[i], i);
   }
   std::sort(sort_order.begin(), sort_order.end(), std::greater<SortInfo>());
 
@@ -157,20 +320,24 @@ std::string MctsNode::Describe() const {
       Q(), MostVisitedPathString());
 
   float child_N_sum = 0;
-  for (const auto& e : edges) {
-    child_N_sum += e.N;
-  }
-  for (int rank = 0; rank < 15; ++rank) {
-    Coord i = std::get<2>(sort_order[rank]);
-    float soft_N = child_N(i) / child_N_sum;
-    float p_delta = soft_N - child_P(i);
-    float p_rel = p_delta / child_P(i);
+  for (int i = 0; i < edges.size; ++i) {
+    child_N_sum += edges.N[i];
+  }
+  float U_scale = kPuct * std::sqrt(std::max<float>(1, N() - 1));
+  int num_ranks = std::min<int>(15, sort_order.size());
+  for (int rank = 0; rank < num_ranks; ++rank) {
+    int i = std::get<2>(sort_order[rank]);
+    float N = edges.N[i];
+    float P = edges.P[i];
+    float soft_N = N / child_N_sum;
+    float p_delta = soft_N - P;
+    float p_rel = p_delta / P;
     absl::StrAppendFormat(
         &result,
         "\n%-5s: % 4.3f % 4.3f %0.3f %0.3f %0.3f %5d %0.4f % 6.5f % 3.2f",
-        i.ToKgs(), child_action_score[i], child_Q(i), child_U(i), child_P(i),
-        child_original_P(i), static_cast<int>(child_N(i)), soft_N, p_delta,
-        p_rel);
+        edges.move[i].ToKgs(), child_action_score[i], edges.W[i] / (1 + N),
+        U_scale * P / (1 + N), P, edges.original_P[i], static_cast<int>(N),
+        soft_N, p_delta, p_rel);
   }
   return result;
 }
@@ -178,12 +345,14 @@ std::string MctsNode::Describe() const {
 std::vector<Coord> MctsNode::MostVisitedPath() const {
   std::vector<Coord> path;
   const auto* node = this;
-  while (!node->children.empty()) {
-    Coord next_kid = node->GetMostVisitedMove();
-    path.push_back(next_kid);
-    auto it = node->children.find(next_kid);
-    MG_CHECK(it != node->children.end());
-    node = it->second.get();
+  while (!node->edges.empty()) {
+    Coord c = node->GetMostVisitedMove();
+    const auto* child = node->edges.child[node->FindEdge(c)];
+    if (child == nullptr) {
+      break;
+    }
+    path.push_back(c);
+    node = child;
   }
   return path;
 }
@@ -192,9 +361,7 @@ std::string MctsNode::MostVisitedPathString() const {
   std::string result;
   const auto* node = this;
   for (Coord c : MostVisitedPath()) {
-    auto it = node->children.find(c);
-    MG_CHECK(it != node->children.end());
-    node = it->second.get();
+    node = node->edges.child[node->FindEdge(c)];
     absl::StrAppendFormat(&result, "%s (%d) ==> ", node->move.ToKgs(),
                           static_cast<int>(node->N()));
   }
@@ -203,12 +370,12 @@ std::string MctsNode::MostVisitedPathString() const {
 }
 
 void MctsNode::GetMoveHistory(
-    int num_moves, std::vector<const Position::Stones*>* history) const {
+    int num_moves, std::vector<const PackedPosition*>* history) const {
   history->clear();
   history->reserve(num_moves);
   const auto* node = this;
   for (int j = 0; j < num_moves; ++j) {
-    history->push_back(&node->position.stones());
+    history->push_back(&node->position);
     node = node->parent;
     if (node == nullptr) {
       break;
@@ -221,73 +388,196 @@ void MctsNode::InjectNoise(const std::array<float, kNumMoves>& noise) {
   // Because dirichlet entries are independent we can simply zero and rescale.
 
   float scalar = 0;
-  for (int i = 0; i < kNumMoves; ++i) {
-    if (legal_moves[i]) {
-      scalar += noise[i];
-    }
+  for (int i = 0; i < edges.size; ++i) {
+    scalar += noise[edges.move[i]];
   }
 
   if (scalar > std::numeric_limits<float>::min()) {
     scalar = 1.0 / scalar;
   }
 
-  for (int i = 0; i < kNumMoves; ++i) {
-    float scaled_noise = scalar * (legal_moves[i] ? noise[i] : 0);
-    edges[i].P = 0.75f * edges[i].P + 0.25f * scaled_noise;
+  for (int i = 0; i < edges.size; ++i) {
+    float scaled_noise = scalar * noise[edges.move[i]];
+    edges.P[i] = 0.75f * edges.P[i] + 0.25f * scaled_noise;
   }
 }
 
 MctsNode* MctsNode::SelectLeaf() {
+  BoardVisitor bv;
+  GroupVisitor gv;
+  Position scratch(&bv, &gv, Color::kBlack);
+  position.Unpack(&scratch);
+  UndoJournal journal;
+  return SelectLeaf(&scratch, &journal, pool, nullptr, nullptr, false);
+}
+
+MctsNode* MctsNode::SelectLeaf(Position* position, UndoJournal* journal,
+                               Pool* pool, Path* path,
+                               TranspositionTable* table,
+                               bool add_virtual_loss, int first_edge) {
+  MG_DCHECK(table == nullptr || path != nullptr);
+  MG_DCHECK(!add_virtual_loss || path != nullptr);
+  MG_DCHECK(first_edge < 0 || is_expanded);
+  if (path != nullptr) {
+    path->clear();
+  }
+
+  // The visit count of each node on the way down is read from its parent's
+  // edges while the parent is locked, because the node's own mutex doesn't
+  // guard it.
+  float N;
+  {
+    absl::MutexLock lock(stats_mu());
+    N = this->N();
+  }
+
   auto* node = this;
+  bool is_linked = false;
   for (;;) {
-    // If a node has never been evaluated, we have no basis to select a child.
-    if (!node->is_expanded) {
-      return node;
+    int i = -1;
+    MctsNode* child;
+    {
+      absl::MutexLock lock(&node->mu);
+
+      // If a node has never been evaluated, we have no basis to select a
+      // child.
+      if (!node->is_expanded) {
+        break;
+      }
+
+      // The edge that led to a linked node only counts the visits made along
+      // it, but the node's edges count the visits along every path to it.
+      const auto& edges = node->edges;
+      if (is_linked) {
+        N = 1;
+        for (int j = 0; j < edges.size; ++j) {
+          N += edges.N[j];
+        }
+      }
+
+      if (first_edge >= 0) {
+        i = first_edge;
+        first_edge = -1;
+      } else if (node->position.previous_move() == Coord::kPass) {
+        // HACK: if last move was a pass, always investigate double-pass first
+        // to avoid situations where we auto-lose by passing too early.
+        i = node->FindEdge(Coord::kPass);
+        if (edges.N[i] != 0) {
+          i = -1;
+        }
+      }
+      if (i < 0) {
+        i = node->ArgMaxChildActionScore(N);
+      }
+      N = edges.N[i];
+      child = edges.child[i];
+      if (add_virtual_loss) {
+        // The virtual loss is for the player to play at the child, i.e. the
+        // node's opponent.
+        edges.W[i] += node->position.to_play() == Color::kBlack ? -1 : 1;
+      }
     }
-    // HACK: if last move was a pass, always investigate double-pass first
-    // to avoid situations where we auto-lose by passing too early.
-    if (node->position.previous_move() == Coord::kPass &&
-        node->child_N(Coord::kPass) == 0) {
-      node = node->MaybeAddChild(Coord::kPass);
-      continue;
+
+    if (path != nullptr) {
+      path->push_back({node, i});
+    }
+    position->PlayMove(node->edges.move[i], Color::kEmpty, journal);
+    if (child == nullptr) {
+      child = node->AddChild(i, *position, pool, table);
+    }
+    if (add_virtual_loss) {
+      ++child->num_virtual_losses_applied;
     }
+    is_linked = child->parent != node;
+    node = child;
+  }
 
-    auto child_action_score = node->CalculateChildActionScore();
-    Coord best_move = ArgMax(child_action_score);
-    node = node->MaybeAddChild(best_move);
+  // If the leaf is the node itself, its virtual loss goes on its own stats,
+  // which may be guarded by the mutex that was just released.
+  if (add_virtual_loss && node == this) {
+    AddVirtualLoss(*path);
   }
+  return node;
 }
 
-void MctsNode::IncorporateResults(absl::Span<const float> move_probabilities,
-                                  float value, MctsNode* up_to) {
+MctsNode* MctsNode::AddChild(int i, const Position& position, Pool* pool,
+                             TranspositionTable* table) {
+  // Initializing a node is relatively expensive, so do it before locking the
+  // node. If another thread adds a child first, the new node is thrown away.
+  MctsNode* child = nullptr;
+  if (table != nullptr) {
+    child = table->Find(position);
+  }
+  bool is_new = child == nullptr;
+  if (is_new) {
+    child = pool->New(pool, this, i, position);
+  }
+
+  MctsNode* existing;
+  {
+    absl::MutexLock lock(&mu);
+    existing = edges.child[i];
+    if (existing == nullptr) {
+      edges.child[i] = child;
+    }
+  }
+  if (existing != nullptr) {
+    if (is_new) {
+      pool->Delete(child);
+    }
+    return existing;
+  }
+  if (is_new && table != nullptr) {
+    table->Insert(child);
+  }
+  return child;
+}
+
+MctsNode::Path MctsNode::GetPathFrom(MctsNode* up_to) {
+  Path path;
+  for (auto* node = this; node != up_to && node->parent != nullptr;
+       node = node->parent) {
+    path.push_back({node->parent, node->parent->FindEdge(node->move)});
+  }
+  std::reverse(path.begin(), path.end());
+  return path;
+}
+
+bool MctsNode::Expand(absl::Span<const float> move_probabilities,
+                      float value) {
   assert(move_probabilities.size() == kNumMoves);
   // A finished game should not be going through this code path, it should
   // directly call BackupValue on the result of the game.
   assert(!position.is_game_over());
 
+  float policy_scalar = move_probabilities[Coord::kPass];
+  legal_moves.ForEach(
+      [&](Coord c) { policy_scalar += move_probabilities[c]; });
+  if (policy_scalar > std::numeric_limits<float>::min()) {
+    policy_scalar = 1 / policy_scalar;
+  }
+
+  absl::MutexLock lock(&mu);
+
   // If the node has already been selected for the next inference batch, we
   // shouldn't 'expand' it again.
   if (is_expanded) {
-    return;
-  }
-
-  float policy_scalar = 0;
-  for (int i = 0; i < kNumMoves; ++i) {
-    if (legal_moves[i]) {
-      policy_scalar += move_probabilities[i];
-    }
-  }
-  if (policy_scalar > std::numeric_limits<float>::min()) {
-    policy_scalar = 1 / policy_scalar;
+    return false;
   }
 
   is_expanded = true;
-  for (int i = 0; i < kNumMoves; ++i) {
-    // Zero out illegal moves, and re-normalize move_probabilities.
-    float move_prob =
-        legal_moves[i] ? policy_scalar * move_probabilities[i] : 0;
+  expanded_value = value;
 
-    edges[i].original_P = edges[i].P = move_prob;
+  // The edges will already have been allocated if a child was added before the
+  // node was expanded.
+  if (edges.empty()) {
+    AllocateEdges(this);
+  }
+  for (int i = 0; i < edges.size; ++i) {
+    // Illegal moves have no edges, so this re-normalizes move_probabilities
+    // over the legal moves.
+    edges.original_P[i] = edges.P[i] =
+        policy_scalar * move_probabilities[edges.move[i]];
     // Initialize child Q as current node's value, to prevent dynamics where
     // if B is winning, then B will only ever explore 1 move, because the Q
     // estimation will be so much larger than the 0 of the other moves.
@@ -298,74 +588,362 @@ void MctsNode::IncorporateResults(absl::Span<const float> move_probabilities,
     //
     // The value seeded here acts as a prior, and gets averaged into Q
     // calculations.
-    edges[i].W = value;
+    edges.W[i] = value;
   }
-  BackupValue(value, up_to);
+  return true;
+}
+
+void MctsNode::IncorporateResults(absl::Span<const float> move_probabilities,
+                                  float value, MctsNode* up_to) {
+  IncorporateResults(move_probabilities, value, GetPathFrom(up_to));
 }
 
 void MctsNode::IncorporateEndGameResult(float value, MctsNode* up_to) {
-  assert(position.is_game_over() || position.n() == kMaxSearchDepth);
-  assert(!is_expanded);
-  BackupValue(value, up_to);
+  IncorporateEndGameResult(value, GetPathFrom(up_to));
 }
 
 void MctsNode::BackupValue(float value, MctsNode* up_to) {
-  auto* node = this;
-  for (;;) {
-    node->stats->W += value;
-    ++node->stats->N;
-    if (node == up_to) {
-      return;
-    }
-    node = node->parent;
-  }
+  BackupValue(value, GetPathFrom(up_to));
 }
 
 void MctsNode::AddVirtualLoss(MctsNode* up_to) {
-  auto* node = this;
-  do {
-    ++node->num_virtual_losses_applied;
-    node->stats->W += node->position.to_play() == Color::kBlack ? 1 : -1;
-    node = node->parent;
-  } while (node != nullptr && node != up_to);
+  AddVirtualLoss(GetPathFrom(up_to));
 }
 
 void MctsNode::RevertVirtualLoss(MctsNode* up_to) {
-  auto* node = this;
-  do {
-    --node->num_virtual_losses_applied;
-    node->stats->W -= node->position.to_play() == Color::kBlack ? 1 : -1;
-    node = node->parent;
-  } while (node != nullptr && node != up_to);
+  RevertVirtualLoss(GetPathFrom(up_to));
+}
+
+void MctsNode::IncorporateResults(absl::Span<const float> move_probabilities,
+                                  float value, const Path& path) {
+  if (Expand(move_probabilities, value)) {
+    BackupValue(value, path);
+  }
+}
+
+void MctsNode::IncorporateEndGameResult(float value, const Path& path) {
+  assert(position.is_game_over() || position.n() == kMaxSearchDepth);
+  assert(!is_expanded);
+  BackupValue(value, path);
+}
+
+void MctsNode::BackupValue(float value, const Path& path) {
+  UpdatePath(path, value, 1, 0);
+}
+
+void MctsNode::AddVirtualLoss(const Path& path) { UpdatePath(path, 0, 0, 1); }
+
+void MctsNode::RevertVirtualLoss(const Path& path) {
+  UpdatePath(path, 0, 0, -1);
+}
+
+void MctsNode::IncorporateResultsAndRevertVirtualLoss(
+    absl::Span<const float> move_probabilities, float value,
+    const Path& path) {
+  if (Expand(move_probabilities, value)) {
+    UpdatePath(path, value, 1, -1);
+  } else {
+    UpdatePath(path, 0, 0, -1);
+  }
+}
+
+void MctsNode::IncorporateEndGameResultAndRevertVirtualLoss(float value,
+                                                            const Path& path) {
+  assert(position.is_game_over() || position.n() == kMaxSearchDepth);
+  assert(!is_expanded);
+  UpdatePath(path, value, 1, -1);
+}
+
+void MctsNode::UpdatePath(const Path& path, float value, int num_visits,
+                          int num_virtual_losses) {
+  // The virtual loss on the edge from each node is for the player to play at
+  // the node's child, i.e. the node's opponent.
+  auto* child = this;
+  for (auto it = path.rbegin(); it != path.rend(); ++it) {
+    auto* node = it->node;
+    absl::MutexLock lock(&node->mu);
+    auto& W = node->edges.W[it->edge];
+    W += value;
+    W += num_virtual_losses *
+         (node->position.to_play() == Color::kBlack ? -1 : 1);
+    node->edges.N[it->edge] += num_visits;
+    child->num_virtual_losses_applied += num_virtual_losses;
+    child = node;
+  }
+
+  // The root of a search is always selected, so virtual losses are only added
+  // to its stats if it's the leaf.
+  if (num_visits == 0 && !path.empty()) {
+    return;
+  }
+  absl::MutexLock lock(child->stats_mu());
+  *child->stats_W += value;
+  *child->stats_N += num_visits;
+  if (path.empty()) {
+    *child->stats_W +=
+        num_virtual_losses *
+        (child->position.to_play() == Color::kBlack ? 1 : -1);
+    child->num_virtual_losses_applied += num_virtual_losses;
+  }
 }
 
 void MctsNode::PruneChildren(Coord c) {
-  auto child = std::move(children[c]);
-  children.clear();
-  children[c] = std::move(child);
+  std::vector<MctsNode*> detached;
+  DetachChildren(c, &detached);
+  DeleteSubtrees(detached, false);
 }
 
-std::array<float, kNumMoves> MctsNode::CalculateChildActionScore() const {
+void MctsNode::DetachChildren(Coord c, std::vector<MctsNode*>* detached) {
+  for (int i = 0; i < edges.size; ++i) {
+    auto* child = edges.child[i];
+    if (child != nullptr && edges.move[i] != c) {
+      if (child->parent == this) {
+        detached->push_back(child);
+      }
+      edges.child[i] = nullptr;
+    }
+  }
+}
+
+void MctsNode::DeleteSubtrees(absl::Span<MctsNode* const> roots,
+                              bool concurrently) {
+  // Find all the nodes while they're still alive, clearing their edges so that
+  // their destructors don't delete any children.
+  std::vector<MctsNode*> nodes(roots.begin(), roots.end());
+  for (size_t j = 0; j < nodes.size(); ++j) {
+    auto* node = nodes[j];
+    auto& edges = node->edges;
+    for (int i = 0; i < edges.size; ++i) {
+      auto* child = edges.child[i];
+      if (child != nullptr && child->parent == node) {
+        nodes.push_back(child);
+      }
+      edges.child[i] = nullptr;
+    }
+  }
+  for (auto* node : nodes) {
+    if (concurrently) {
+      node->pool->DeleteConcurrently(node);
+    } else {
+      node->pool->Delete(node);
+    }
+  }
+}
+
+MctsNode::SubtreeSize MctsNode::CalculateSubtreeSize() const {
+  SubtreeSize size;
+  std::vector<const MctsNode*> nodes = {this};
+  while (!nodes.empty()) {
+    const auto* node = nodes.back();
+    nodes.pop_back();
+    size.num_nodes += 1;
+    size.num_bytes += sizeof(MctsNode);
+    if (!node->edges.empty()) {
+      size.num_bytes += GetEdgeBytes(GetEdgeCapacity(node->edges.size));
+    }
+    if (node->superko_cache != nullptr) {
+      size.num_bytes +=
+          node->superko_cache->capacity() * (sizeof(zobrist::Hash) + 1);
+    }
+    for (int i = 0; i < node->edges.size; ++i) {
+      const auto* child = node->edges.child[i];
+      if (child != nullptr && child->parent == node) {
+        nodes.push_back(child);
+      }
+    }
+  }
+  return size;
+}
+
+size_t MctsNode::EvictSubtrees(size_t max_nodes, TranspositionTable* table,
+                               std::vector<MctsNode*>* evicted) {
+  // Find the nodes in the subtree, parents before their children, and the
+  // size of each node's subtree.
+  struct SubtreeNode {
+    MctsNode* node;
+    int parent;
+    size_t size;
+    bool evicted;
+  };
+  std::vector<SubtreeNode> subtree = {{this, -1, 1, false}};
+  for (size_t j = 0; j < subtree.size(); ++j) {
+    auto* node = subtree[j].node;
+    for (int i = 0; i < node->edges.size; ++i) {
+      auto* child = node->edges.child[i];
+      if (child != nullptr && child->parent == node) {
+        subtree.push_back({child, static_cast<int>(j), 1, false});
+      }
+    }
+  }
+  size_t num_nodes = subtree.size();
+  if (num_nodes <= max_nodes) {
+    return 0;
+  }
+  for (size_t j = subtree.size() - 1; j > 0; --j) {
+    subtree[subtree[j].parent].size += subtree[j].size;
+  }
+
+  // Evict the subtrees with the fewest visits first, and the deepest ones
+  // first if there's a tie. A node usually has fewer visits than its parent,
+  // so most of the subtrees that are evicted are small. Once a subtree has been
+  // evicted, the size of each of its ancestors' subtrees is reduced by its
+  // size.
+  std::vector<int> order(subtree.size() - 1);
+  std::iota(order.begin(), order.end(), 1);
+  std::sort(order.begin(), order.end(), [&subtree](int a, int b) {
+    float N_a = subtree[a].node->N();
+    float N_b = subtree[b].node->N();
+    return N_a != N_b ? N_a < N_b : a > b;
+  });
+  std::vector<MctsNode*> roots;
+  for (int j : order) {
+    if (num_nodes <= max_nodes) {
+      break;
+    }
+    bool is_in_evicted_subtree = false;
+    for (int k = subtree[j].parent; k >= 0; k = subtree[k].parent) {
+      if (subtree[k].evicted) {
+        is_in_evicted_subtree = true;
+        break;
+      }
+    }
+    if (is_in_evicted_subtree) {
+      continue;
+    }
+    size_t size = subtree[j].size;
+    for (int k = subtree[j].parent; k >= 0; k = subtree[k].parent) {
+      subtree[k].size -= size;
+    }
+    num_nodes -= size;
+    subtree[j].evicted = true;
+    roots.push_back(subtree[j].node);
+  }
+
+  // Detach the evicted subtrees from the tree before deleting them, so that
+  // Rebuild clears any links to their nodes while they're still alive.
+  for (auto* node : roots) {
+    auto* parent = node->parent;
+    parent->edges.child[parent->FindEdge(node->move)] = nullptr;
+  }
+  if (table != nullptr) {
+    table->Rebuild(this);
+  }
+  if (evicted != nullptr) {
+    evicted->insert(evicted->end(), roots.begin(), roots.end());
+  } else {
+    DeleteSubtrees(roots, false);
+  }
+  return subtree.size() - num_nodes;
+}
+
+inline_vector<float, kNumMoves> MctsNode::CalculateChildActionScore() const {
   float to_play = position.to_play() == Color::kBlack ? 1 : -1;
   float U_scale = kPuct * std::sqrt(std::max<float>(1, N() - 1));
 
-  std::array<float, kNumMoves> result;
-  for (int i = 0; i < kNumMoves; ++i) {
-    result[i] = CalculateSingleMoveChildActionScore(to_play, U_scale, i);
+  inline_vector<float, kNumMoves> result;
+  for (int i = 0; i < edges.size; ++i) {
+    result.push_back(CalculateSingleMoveChildActionScore(to_play, U_scale, i));
   }
   return result;
 }
 
+int MctsNode::ArgMaxChildActionScore(float N) const {
+  MG_DCHECK(!edges.empty());
+  float to_play = position.to_play() == Color::kBlack ? 1 : -1;
+  float U_scale = kPuct * std::sqrt(std::max<float>(1, N - 1));
+
+  // The SIMD implementations process whole vectors, including the padding at
+  // the end of the edges, which never has the best score. Each lane keeps
+  // track of the first index with its best score, so reducing the lanes with
+  // ReduceArgMax returns the first index with the best score overall.
+#if defined(__AVX512F__)
+  static_assert(Edges::kPadding % 16 == 0, "");
+  const __m512 to_play_v = _mm512_set1_ps(to_play);
+  const __m512 U_scale_v = _mm512_set1_ps(U_scale);
+  const __m512 one = _mm512_set1_ps(1);
+  const __m512i step = _mm512_set1_epi32(16);
+  __m512i index = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12,
+                                    13, 14, 15);
+  __m512 best_score = _mm512_set1_ps(-std::numeric_limits<float>::infinity());
+  __m512i best_index = _mm512_setzero_si512();
+  for (int i = 0; i < edges.size; i += 16) {
+    __m512 N = _mm512_load_ps(edges.N + i);
+    __m512 W = _mm512_load_ps(edges.W + i);
+    __m512 P = _mm512_load_ps(edges.P + i);
+    __m512 score = _mm512_div_ps(
+        _mm512_add_ps(_mm512_mul_ps(W, to_play_v), _mm512_mul_ps(U_scale_v, P)),
+        _mm512_add_ps(one, N));
+    __mmask16 better = _mm512_cmp_ps_mask(score, best_score, _CMP_GT_OQ);
+    best_score = _mm512_mask_blend_ps(better, best_score, score);
+    best_index = _mm512_mask_blend_epi32(better, best_index, index);
+    index = _mm512_add_epi32(index, step);
+  }
+  alignas(64) float scores[16];
+  alignas(64) int32_t indices[16];
+  _mm512_store_ps(scores, best_score);
+  _mm512_store_si512(indices, best_index);
+  return ReduceArgMax(scores, indices, 16);
+#elif defined(__AVX2__)
+  static_assert(Edges::kPadding % 8 == 0, "");
+  const __m256 to_play_v = _mm256_set1_ps(to_play);
+  const __m256 U_scale_v = _mm256_set1_ps(U_scale);
+  const __m256 one = _mm256_set1_ps(1);
+  const __m256i step = _mm256_set1_epi32(8);
+  __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256 best_score = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+  __m256i best_index = _mm256_setzero_si256();
+  for (int i = 0; i < edges.size; i += 8) {
+    __m256 N = _mm256_load_ps(edges.N + i);
+    __m256 W = _mm256_load_ps(edges.W + i);
+    __m256 P = _mm256_load_ps(edges.P + i);
+    __m256 score = _mm256_div_ps(
+        _mm256_add_ps(_mm256_mul_ps(W, to_play_v), _mm256_mul_ps(U_scale_v, P)),
+        _mm256_add_ps(one, N));
+    __m256 better = _mm256_cmp_ps(score, best_score, _CMP_GT_OQ);
+    best_score = _mm256_blendv_ps(best_score, score, better);
+    best_index = _mm256_castps_si256(
+        _mm256_blendv_ps(_mm256_castsi256_ps(best_index),
+                         _mm256_castsi256_ps(index), better));
+    index = _mm256_add_epi32(index, step);
+  }
+  alignas(32) float scores[8];
+  alignas(32) int32_t indices[8];
+  _mm256_store_ps(scores, best_score);
+  _mm256_store_si256(reinterpret_cast<__m256i*>(indices), best_index);
+  return ReduceArgMax(scores, indices, 8);
+#else
+  int best = 0;
+  float best_score = CalculateSingleMoveChildActionScore(to_play, U_scale, 0);
+  for (int i = 1; i < edges.size; ++i) {
+    float score = CalculateSingleMoveChildActionScore(to_play, U_scale, i);
+    if (score > best_score) {
+      best = i;
+      best_score = score;
+    }
+  }
+  return best;
+#endif
+}
+
 MctsNode* MctsNode::MaybeAddChild(Coord c) {
-  auto it = children.find(c);
-  if (it == children.end()) {
-    auto child = absl::make_unique<MctsNode>(this, c);
-    MctsNode* result = child.get();
-    children[c] = std::move(child);
-    return result;
-  } else {
-    return it->second.get();
+  int i = GetChildEdge(this, c);
+  if (edges.child[i] == nullptr || edges.child[i]->parent != this) {
+    BoardVisitor bv;
+    GroupVisitor gv;
+    Position child_position(&bv, &gv, Color::kBlack);
+    position.Unpack(&child_position);
+    child_position.PlayMove(c);
+    edges.child[i] = pool->New(pool, this, i, child_position);
+  }
+  return edges.child[i];
+}
+
+MctsNode* MctsNode::MaybeAddChild(Coord c, const Position& position) {
+  int i = GetChildEdge(this, c);
+  if (edges.child[i] == nullptr || edges.child[i]->parent != this) {
+    edges.child[i] = pool->New(pool, this, i, position);
   }
+  return edges.child[i];
 }
 
 bool MctsNode::HasPositionBeenPlayedBefore(zobrist::Hash stone_hash) const {
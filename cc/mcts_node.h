@@ -16,6 +16,7 @@
 #define CC_MCTS_NODE_H_
 
 #include <array>
+#include <atomic>
 #include <cmath>
 #include <memory>
 #include <string>
@@ -25,50 +26,179 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
 #include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/types/span.h"
+#include "cc/bitboard.h"
 #include "cc/constants.h"
+#include "cc/inline_vector.h"
+#include "cc/object_pool.h"
+#include "cc/packed_position.h"
 #include "cc/position.h"
 #include "cc/zobrist.h"
 
 namespace minigo {
 
+// A node in the search tree.
+//
+// A tree can be searched by several threads at once, as long as they only
+// call SelectLeaf(position, journal, pool, path, table, add_virtual_loss),
+// IncorporateResults, IncorporateEndGameResult, BackupValue, AddVirtualLoss,
+// RevertVirtualLoss and the methods that fuse them.
+// These methods lock each node they update: a node's mu guards its edges and
+// is_expanded, and the stats of a node (N() and W()) are guarded by the mutex
+// of the parent whose edges hold them, or by the node's own mu if it has no
+// parent. The rest of the node's fields never change once it has been added to
+// the tree. All other methods must only be called while no search is running.
+//
+// If SelectLeaf is given a TranspositionTable, the tree becomes a DAG: an edge
+// can lead to a node that was added for the same position by another edge.
+// That node is still owned by the edge that added it, and its parent is the
+// node that edge is from. Results for a leaf must then be backed up along the
+// Path that SelectLeaf took to it, rather than by following parent pointers.
 class MctsNode {
  public:
+  // Stats of the edge leading to the root of a tree, which has no parent to
+  // hold them.
   struct EdgeStats {
-    // TODO(tom): consider moving N into the MctsNode to save memory.
     float N = 0;
     float W = 0;
-    float P = 0;
-    float original_P = 0;
   };
 
-  static bool CmpN(const EdgeStats& a, const EdgeStats& b) { return a.N < b.N; }
-  static bool CmpW(const EdgeStats& a, const EdgeStats& b) { return a.W < b.W; }
-  static bool CmpP(const EdgeStats& a, const EdgeStats& b) { return a.P < b.P; }
+  // The edges from a node to its children, stored as a structure of arrays so
+  // that the action scores of all edges can be calculated with SIMD
+  // instructions. Edge i is the edge for move[i], with stats N[i], W[i], P[i]
+  // and original_P[i]. child[i] is the child that the edge leads to: it's null
+  // until it's added by SelectLeaf or MaybeAddChild, and is then owned by the
+  // node.
+  //
+  // The arrays are aligned to kPadding floats and padded to a multiple of
+  // kPadding elements, so that SIMD code can process whole vectors. The
+  // padding has a prior of -infinity, which gives it an action score of
+  // -infinity.
+  struct Edges {
+    static constexpr int kPadding = 16;
+
+    // Allocates the arrays for size edges: the stats are all zero, and the
+    // moves must be filled in by the caller.
+    void Allocate(int size);
+
+    bool empty() const { return size == 0; }
+
+    int size = 0;
+    float* N = nullptr;
+    float* W = nullptr;
+    float* P = nullptr;
+    float* original_P = nullptr;
+    MctsNode** child = nullptr;
+    Coord* move = nullptr;
+
+    std::unique_ptr<char[]> buffer;
+  };
+
+  // The nodes of a tree are allocated from Pools, which must outlive them.
+  // Usually all the nodes of a tree share the same pool, but threads that
+  // search the tree in parallel each add nodes from their own pool.
+  using Pool = ObjectPool<MctsNode>;
 
-  // Constructor for root node in the tree.
-  MctsNode(EdgeStats* stats, const Position& position);
+  // A step on the way down the tree from the root of a search: the node, and
+  // the index of the edge that was taken from it.
+  struct PathStep {
+    MctsNode* node;
+    int edge;
+  };
+
+  // The steps that SelectLeaf took from the root of a search to a leaf. The
+  // leaf itself isn't included, so the path from the root to itself is empty.
+  using Path = std::vector<PathStep>;
+
+  // Maps the state_hash() of positions to the nodes of a tree, so that
+  // SelectLeaf can link an edge to the existing node for a transposition of its
+  // child's position, instead of adding a new node & running inference on it
+  // again. The table is thread safe.
+  //
+  // Positions with the same state_hash() are only equivalent up to the
+  // positional superko rule: a linked node's legal moves are those of the first
+  // path to reach it. Nodes are also only linked if their positions have the
+  // same move number, so that the depth of the search is the same along every
+  // path.
+  class TranspositionTable {
+   public:
+    // Returns the node for position, or null if there isn't one.
+    MctsNode* Find(const Position& position);
+
+    // Adds node to the table, unless the table already has a node for its
+    // position.
+    void Insert(MctsNode* node);
+
+    // Prepares for root to become the root of the tree, before everything
+    // outside root's subtree is pruned: the table is reset to the nodes that
+    // root (recursively) owns, and any edges in root's subtree that are linked
+    // to other nodes are cleared. The stats of the cleared edges are kept, and
+    // the next SelectLeaf to take one of them adds a new child for it.
+    void Rebuild(MctsNode* root);
+
+    void Clear();
+
+    size_t size();
+
+   private:
+    absl::Mutex mu_;
+    absl::flat_hash_map<zobrist::Hash, MctsNode*> nodes_ GUARDED_BY(&mu_);
+  };
 
-  // Constructor for child nodes.
-  MctsNode(MctsNode* parent, Coord move);
+  // Constructor for root node in the tree, which must be allocated from pool.
+  // The children of the root node, and their children in turn, are allocated
+  // from pool too unless a different pool is passed to SelectLeaf.
+  MctsNode(Pool* pool, EdgeStats* stats, const Position& position);
 
-  float N() const { return stats->N; }
-  float W() const { return stats->W; }
-  float P() const { return stats->P; }
-  float original_P() const { return stats->original_P; }
+  // Constructor for child nodes, where position is the board position after
+  // playing move from parent, for example a scratch position that's being used
+  // to walk down the tree. The node must be allocated from parent->pool.
+  MctsNode(MctsNode* parent, Coord move, const Position& position);
+
+  // Same as MctsNode(parent, parent->edges.move[edge], position), except that
+  // the node is allocated from pool.
+  MctsNode(Pool* pool, MctsNode* parent, int edge, const Position& position);
+
+  // Returns the node's children (and their descendants) to their pools. Nodes
+  // that are linked to by the node's edges aren't owned by it, and aren't
+  // deleted.
+  ~MctsNode();
+
+  MctsNode(const MctsNode&) = delete;
+  MctsNode& operator=(const MctsNode&) = delete;
+
+  float N() const { return *stats_N; }
+  float W() const { return *stats_W; }
   float Q() const { return W() / (1 + N()); }
   float Q_perspective() const {
     return position.to_play() == Color::kBlack ? Q() : -Q();
   }
 
-  float child_N(int i) const { return edges[i].N; }
-  float child_W(int i) const { return edges[i].W; }
-  float child_P(int i) const { return edges[i].P; }
-  float child_original_P(int i) const { return edges[i].original_P; }
-  float child_Q(int i) const { return child_W(i) / (1 + child_N(i)); }
-  float child_U(int i) const {
-    return kPuct * std::sqrt(std::max<float>(1, N() - 1)) * child_P(i) /
-           (1 + child_N(i));
+  // Returns the index of the edge for move c, or -1 if the node has no edge for
+  // c, either because c isn't legal or because the node's edges haven't been
+  // allocated yet. This is a binary search over the node's edges.
+  int FindEdge(Coord c) const;
+
+  // Stats of the edge for move c, which are all zero if there's no such edge.
+  // Like FindEdge, these search the node's edges: code that looks at all the
+  // edges should iterate over edges instead.
+  float child_N(Coord c) const { return EdgeStat(edges.N, c); }
+  float child_W(Coord c) const { return EdgeStat(edges.W, c); }
+  float child_P(Coord c) const { return EdgeStat(edges.P, c); }
+  float child_original_P(Coord c) const {
+    return EdgeStat(edges.original_P, c);
+  }
+  float child_Q(Coord c) const { return child_W(c) / (1 + child_N(c)); }
+  float child_U(Coord c) const {
+    return kPuct * std::sqrt(std::max<float>(1, N() - 1)) * child_P(c) /
+           (1 + child_N(c));
+  }
+
+  // Returns true if move c is legal from this node's position, including the
+  // positional superko rule.
+  bool IsLegalMove(Coord c) const {
+    return c == Coord::kPass || legal_moves.test(c);
   }
 
   // Finds the best move by visit count, N. Ties are broken using the child
@@ -84,7 +214,7 @@ class MctsNode {
   // After GetMoveHistory returns, history[0] is this MctsNode and history[i] is
   // the MctsNode from i moves ago.
   void GetMoveHistory(int num_moves,
-                      std::vector<const Position::Stones*>* history) const;
+                      std::vector<const PackedPosition*>* history) const;
 
   void InjectNoise(const std::array<float, kNumMoves>& noise);
 
@@ -92,60 +222,193 @@ class MctsNode {
   // If inference is being batched and SelectLeaf chooses a node that has
   // already been added to the batch (IncorporateResults has not yet been
   // called), then SelectLeaf will return that same node.
+  // This rehydrates this node's position to walk down the tree: prefer the
+  // overload that takes a scratch position when selecting many leaves.
   MctsNode* SelectLeaf();
 
+  // Selects the next leaf node for inference, like SelectLeaf(), but walks
+  // down the tree on a scratch position: position must be the board position
+  // of this node. Each move along the path to the returned leaf is played on
+  // position and recorded in journal, so on return position holds the leaf's
+  // board position. The caller is responsible for reverting the moves by
+  // calling position->UndoMove(journal) journal->num_moves() times. Any nodes
+  // that are added to the tree on the way are allocated from pool.
+  //
+  // If path is non-null, the steps taken to the leaf are stored in it. If table
+  // is non-null, edges are linked to the nodes in the table for their
+  // positions where possible and new nodes are added to it: the leaf may then
+  // be reachable along several paths, so path must be non-null too.
+  //
+  // If add_virtual_loss is true, a virtual loss is added along the path as
+  // AddVirtualLoss(path) would, while each node is locked to select the next
+  // edge. This saves walking the path again, and means that no other thread
+  // can select the same edges without seeing the virtual loss. Path must be
+  // non-null, so that the virtual loss can be reverted.
+  //
+  // If first_edge is non-negative, the first step down from this node takes
+  // that edge instead of the one with the best action score, and the steps
+  // below it are selected as usual. The node must be expanded.
+  MctsNode* SelectLeaf(Position* position, UndoJournal* journal, Pool* pool,
+                       Path* path, TranspositionTable* table,
+                       bool add_virtual_loss, int first_edge = -1);
+
+  // The following methods update the stats of each edge from up_to down to
+  // this node, and of up_to itself, by following parent pointers: up_to must
+  // be an ancestor of the node, or the node itself. Nodes that were selected
+  // using a TranspositionTable must use the overloads that take the Path
+  // returned by SelectLeaf instead.
   void IncorporateResults(absl::Span<const float> move_probabilities,
                           float value, MctsNode* up_to);
-
   void IncorporateEndGameResult(float value, MctsNode* up_to);
-
   void BackupValue(float value, MctsNode* up_to);
-
   void AddVirtualLoss(MctsNode* up_to);
-
   void RevertVirtualLoss(MctsNode* up_to);
 
-  // Remove all children from the node except c.
+  // Same as above, for the edges along path and the node at the start of the
+  // path.
+  void IncorporateResults(absl::Span<const float> move_probabilities,
+                          float value, const Path& path);
+  void IncorporateEndGameResult(float value, const Path& path);
+  void BackupValue(float value, const Path& path);
+  void AddVirtualLoss(const Path& path);
+  void RevertVirtualLoss(const Path& path);
+
+  // Same as calling IncorporateResults(move_probabilities, value, path) or
+  // IncorporateEndGameResult(value, path), and then RevertVirtualLoss(path),
+  // except that the path is only walked once.
+  void IncorporateResultsAndRevertVirtualLoss(
+      absl::Span<const float> move_probabilities, float value,
+      const Path& path);
+  void IncorporateEndGameResultAndRevertVirtualLoss(float value,
+                                                    const Path& path);
+
+  // Remove all children from the node except c, returning them to the pool.
   void PruneChildren(Coord c);
 
-  // TODO(tommadams): Validate returning by value has the same performance as
-  // passing a pointer to the output array.
-  std::array<float, kNumMoves> CalculateChildActionScore() const;
+  // Same as PruneChildren, except that the removed children that the node
+  // owns are appended to detached instead of being deleted. The caller must
+  // delete them using DeleteSubtrees.
+  void DetachChildren(Coord c, std::vector<MctsNode*>* detached);
+
+  // Deletes the nodes in roots and the nodes that they (recursively) own. The
+  // nodes must have been detached from the tree, and any nodes that they link
+  // to must still be alive. The subtrees may link to each other's nodes, so
+  // they're deleted together: deleting them one at a time would check whether
+  // a node owns the target of a link after the target had been deleted.
+  //
+  // If concurrently is true, the nodes are deleted using
+  // ObjectPool::DeleteConcurrently, so DeleteSubtrees may be called from a
+  // different thread to the ones that use the nodes' pools.
+  static void DeleteSubtrees(absl::Span<MctsNode* const> roots,
+                             bool concurrently);
+
+  // The number of nodes in a subtree, and an estimate of the memory they use.
+  struct SubtreeSize {
+    size_t num_nodes = 0;
+    size_t num_bytes = 0;
+  };
+
+  // Returns the size of the subtree of nodes that this node (recursively) owns,
+  // including the node itself.
+  SubtreeSize CalculateSubtreeSize() const;
+
+  // Removes the subtrees whose roots have the fewest visits from this node's
+  // subtree, returning them to their pools, until the subtree has at most
+  // max_nodes nodes. The node itself is never removed. The stats of the edges
+  // that led to the removed subtrees are kept, so the search still knows how
+  // good their moves are: the next SelectLeaf to take one of them adds a new
+  // child for it, which is then evaluated again. If the tree is searched using
+  // a TranspositionTable, this node must be the root of the search and table
+  // must be passed too, so that the links to the removed nodes are cleared.
+  // If evicted is non-null, the roots of the removed subtrees are appended to
+  // it instead of being deleted, like DetachChildren. Returns the number of
+  // nodes removed.
+  size_t EvictSubtrees(size_t max_nodes, TranspositionTable* table,
+                       std::vector<MctsNode*>* evicted);
+
+  // Returns the action score of each edge: element i is the score of edge i.
+  inline_vector<float, kNumMoves> CalculateChildActionScore() const;
+
+  // Returns the index of the edge with the highest action score, or the first
+  // such edge if there's a tie. This is ArgMax(CalculateChildActionScore()),
+  // computed in a single pass using AVX-512 or AVX2 when they're enabled at
+  // compile time. The node must have edges.
+  int ArgMaxChildActionScore() const { return ArgMaxChildActionScore(N()); }
+
+  // Same as ArgMaxChildActionScore(), for a node whose visit count is N.
+  int ArgMaxChildActionScore(float N) const;
 
   bool HasPositionBeenPlayedBefore(zobrist::Hash stone_hash) const;
 
+  // Q * to_play + U for edge i, calculated as a single division so that the
+  // SIMD implementation of ArgMaxChildActionScore gives identical results.
   float CalculateSingleMoveChildActionScore(float to_play, float U_scale,
                                             int i) const {
-    float Q = child_Q(i);
-    float U = U_scale * child_P(i) / (1 + child_N(i));
-    return Q * to_play + U - 1000.0f * !legal_moves[i];
+    return (edges.W[i] * to_play + U_scale * edges.P[i]) / (1 + edges.N[i]);
   }
 
+  // Returns the child for move c, creating it if it doesn't exist yet. Creating
+  // a child rehydrates this node's position in order to play c on it. If the
+  // edge for c is linked to a node that this node doesn't own, it's replaced by
+  // a new child: the returned child's parent is always this node.
   MctsNode* MaybeAddChild(Coord c);
 
+  // Same as MaybeAddChild(c), except that if a new child is created, it's
+  // initialized from position, which must be the board position after playing
+  // c from this node.
+  MctsNode* MaybeAddChild(Coord c, const Position& position);
+
+  // Pool that the node was allocated from.
+  Pool* pool;
+
   // Parent node.
   MctsNode* parent;
 
-  // Stats for the edge from parent to this.
-  EdgeStats* stats;
+  // Stats for the edge from parent to this, which live in parent->edges. For
+  // the root node, they live in the EdgeStats passed to the constructor.
+  float* stats_N;
+  float* stats_W;
 
   // Move that led to this position.
   Coord move;
 
-  std::array<EdgeStats, kNumMoves> edges;
+  // Edges for the node's legal moves, in move order. The edges are allocated
+  // when the node is expanded by IncorporateResults, so leaves have none. If a
+  // child is added to a node before it's expanded, the node's edges are
+  // allocated at that point instead. Either way, edges is never reallocated
+  // because the stats of each child point into it.
+  Edges edges;
 
-  std::array<bool, kNumMoves> legal_moves;
-
-  // Map from move to resulting MctsNode.
-  absl::flat_hash_map<uint64_t, std::unique_ptr<MctsNode>> children;
+  // The legal moves on the board, including the positional superko check.
+  // Passing is always legal. Use IsLegalMove rather than testing this directly.
+  BitBoard legal_moves;
 
   bool is_expanded = false;
 
-  // Current board position.
-  Position position;
+  // Value that the node was expanded with, which seeds the W of each of its
+  // edges: it's the Q of every move that hasn't been visited.
+  float expanded_value = 0;
+
+  // Current board position, in packed form. Call position.Unpack to get the
+  // full Position, for example to score it.
+  PackedPosition position;
 
-  // Number of virtual losses on this node.
-  int num_virtual_losses_applied = 0;
+  // Zobrist hash of the stones of the last DualNet::kMoveHistory positions up
+  // to and including this one, and the player to play. This uniquely identifies
+  // the features that DualNet::SetFeatures calculates from GetMoveHistory, so
+  // it can be used to cache inferences. It's calculated from the parent's hash
+  // by rolling the oldest position out of the window & this position into it.
+  zobrist::Hash history_hash;
+
+  // Number of virtual losses on this node. This is atomic because the virtual
+  // losses of a node that has several edges leading to it are guarded by
+  // different mutexes.
+  std::atomic<int> num_virtual_losses_applied{0};
+
+  // Guards the node's edges and is_expanded while the tree is being searched
+  // by multiple threads, along with the stats of its children. See the class
+  // comment.
+  absl::Mutex mu;
 
   // Each position contains a Zobrist hash of its stones, which can be used for
   // superko detection. In order to accelerate superko detection, caches of all
@@ -160,6 +423,37 @@ class MctsNode {
   // contains a non-null superko_cache.
   using SuperkoCache = absl::flat_hash_set<zobrist::Hash>;
   std::unique_ptr<SuperkoCache> superko_cache;
+
+ private:
+  // Returns the mutex that guards the node's stats.
+  absl::Mutex* stats_mu() { return parent != nullptr ? &parent->mu : &mu; }
+
+  // Thread-safe version of MaybeAddChild for SelectLeaf: if edge i has no child
+  // yet, links it to the node for position in table if there is one, or adds
+  // a new child allocated from pool & initialized from position otherwise.
+  // Returns the edge's child.
+  MctsNode* AddChild(int i, const Position& position, Pool* pool,
+                     TranspositionTable* table);
+
+  // Returns the path from up_to down to this node, following parent pointers.
+  Path GetPathFrom(MctsNode* up_to);
+
+  // Updates the stats of each edge along path in a single pass, from this node
+  // up to the start of the path: adds value to W and num_visits to N, then adds
+  // num_virtual_losses virtual losses, which may be negative to revert them.
+  // The stats of the node at the start of the path are updated too, except
+  // that virtual losses are only added to them if the path is empty.
+  void UpdatePath(const Path& path, float value, int num_visits,
+                  int num_virtual_losses);
+
+  // Expands the node by initializing the priors of its edges, unless it has
+  // already been expanded. Returns true if it was expanded.
+  bool Expand(absl::Span<const float> move_probabilities, float value);
+
+  float EdgeStat(const float* stats, Coord c) const {
+    int i = FindEdge(c);
+    return i >= 0 ? stats[i] : 0;
+  }
 };
 
 }  // namespace minigo
@@ -16,8 +16,15 @@
 
 #include <array>
 #include <set>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
 #include "absl/memory/memory.h"
+#include "cc/algorithm.h"
+#include "cc/dual_net/dual_net.h"
 #include "cc/position.h"
 #include "cc/random.h"
 #include "cc/test_utils.h"
@@ -38,6 +45,14 @@ static constexpr char kAlmostDoneBoard[] = R"(
     XXXXXOOOO
     XXXXOOOOO)";
 
+int CountChildren(const MctsNode& node) {
+  int num = 0;
+  for (int i = 0; i < node.edges.size; ++i) {
+    num += node.edges.child[i] != nullptr;
+  }
+  return num;
+}
+
 // Test puct and child action score calculation
 TEST(MctsNodeTest, UpperConfidenceBound) {
   float epsilon = 1e-7;
@@ -46,8 +61,10 @@ TEST(MctsNodeTest, UpperConfidenceBound) {
     prob = 0.02;
   }
 
+  MctsNode::Pool pool;
+
   MctsNode::EdgeStats root_stats;
-  MctsNode root(&root_stats, TestablePosition("", Color::kBlack));
+  MctsNode root(&pool, &root_stats, TestablePosition("", Color::kBlack));
   auto* leaf = root.SelectLeaf();
   EXPECT_EQ(&root, leaf);
   leaf->IncorporateResults(probs, 0.5, &root);
@@ -94,17 +111,64 @@ TEST(MctsNodeTest, ActionFlipping) {
     prob = rnd();
   }
 
+  MctsNode::Pool pool;
   MctsNode::EdgeStats black_stats, white_stats;
-  MctsNode black_root(&black_stats, TestablePosition("", Color::kBlack));
-  MctsNode white_root(&white_stats, TestablePosition("", Color::kWhite));
+  MctsNode black_root(&pool, &black_stats,
+                      TestablePosition("", Color::kBlack));
+  MctsNode white_root(&pool, &white_stats,
+                      TestablePosition("", Color::kWhite));
 
   black_root.SelectLeaf()->IncorporateResults(probs, 0, &black_root);
   white_root.SelectLeaf()->IncorporateResults(probs, 0, &white_root);
   auto* black_leaf = black_root.SelectLeaf();
   auto* white_leaf = white_root.SelectLeaf();
   EXPECT_EQ(black_leaf->move, white_leaf->move);
-  EXPECT_EQ(black_root.CalculateChildActionScore(),
-            white_root.CalculateChildActionScore());
+  auto black_scores = black_root.CalculateChildActionScore();
+  auto white_scores = white_root.CalculateChildActionScore();
+  EXPECT_EQ(std::vector<float>(black_scores.begin(), black_scores.end()),
+            std::vector<float>(white_scores.begin(), white_scores.end()));
+}
+
+// Verifies that ArgMaxChildActionScore, which may be implemented with SIMD
+// instructions, picks the same edge as CalculateChildActionScore, including
+// when several edges tie for the highest score.
+TEST(MctsNodeTest, ArgMaxChildActionScore) {
+  Random rnd(1);
+  std::array<float, kNumMoves> probs;
+  rnd.Uniform(&probs);
+
+  MctsNode::Pool pool;
+
+  // kAlmostDoneBoard has fewer legal moves than a SIMD vector has lanes, while
+  // the empty board has several vectors' worth and some left over.
+  for (const auto* board : {kAlmostDoneBoard, ""}) {
+    for (auto to_play : {Color::kBlack, Color::kWhite}) {
+      MctsNode::EdgeStats root_stats;
+      MctsNode root(&pool, &root_stats, TestablePosition(board, to_play));
+      root.IncorporateResults(probs, 0, &root);
+      auto& edges = root.edges;
+      for (int iteration = 0; iteration < 100; ++iteration) {
+        root_stats.N = rnd.UniformInt(1, 1000);
+        for (int i = 0; i < edges.size; ++i) {
+          edges.N[i] = rnd.UniformInt(0, 10);
+          edges.W[i] = (2 * rnd() - 1) * (edges.N[i] + 1);
+        }
+        int expected = ArgMax(root.CalculateChildActionScore());
+        EXPECT_EQ(expected, root.ArgMaxChildActionScore());
+
+        // Copy the best edge's stats over a couple of other edges: the first
+        // edge with the highest score should still be chosen.
+        for (int j = 0; j < 2; ++j) {
+          int i = rnd.UniformInt(0, edges.size - 1);
+          edges.N[i] = edges.N[expected];
+          edges.W[i] = edges.W[expected];
+          edges.P[i] = edges.P[expected];
+        }
+        EXPECT_EQ(ArgMax(root.CalculateChildActionScore()),
+                  root.ArgMaxChildActionScore());
+      }
+    }
+  }
 }
 
 // Verfies that SelectLeaf chooses the child with the highest action score.
@@ -116,15 +180,17 @@ TEST(MctsNodeTest, SelectLeaf) {
   Coord c = Coord::FromKgs("D9");
   probs[c] = 0.4;
 
+  MctsNode::Pool pool;
+
   MctsNode::EdgeStats root_stats;
   auto board = TestablePosition(kAlmostDoneBoard, Color::kWhite);
-  MctsNode root(&root_stats, board);
+  MctsNode root(&pool, &root_stats, board);
 
   root.SelectLeaf()->IncorporateResults(probs, 0, &root);
 
   EXPECT_EQ(Color::kWhite, root.position.to_play());
   auto* leaf = root.SelectLeaf();
-  EXPECT_EQ(root.children[c].get(), leaf);
+  EXPECT_EQ(root.edges.child[root.FindEdge(c)], leaf);
 }
 
 // Verifies IncorporateResults and BackupValue.
@@ -134,13 +200,17 @@ TEST(MctsNodeTest, BackupIncorporateResults) {
     prob = 0.02;
   }
 
+  MctsNode::Pool pool;
+
   MctsNode::EdgeStats root_stats;
   auto board = TestablePosition(kAlmostDoneBoard, Color::kWhite);
-  MctsNode root(&root_stats, board);
+  MctsNode root(&pool, &root_stats, board);
   root.SelectLeaf()->IncorporateResults(probs, 0, &root);
 
   auto* leaf = root.SelectLeaf();
   leaf->IncorporateResults(probs, -1, &root);  // white wins!
+  EXPECT_EQ(0, root.expanded_value);
+  EXPECT_EQ(-1, leaf->expanded_value);
 
   // Root was visited twice: first at the root, then at this child.
   EXPECT_EQ(2, root.N());
@@ -186,9 +256,11 @@ TEST(MctsNodeTest, DoNotExplorePastFinish) {
     prob = 0.02;
   }
 
+  MctsNode::Pool pool;
+
   MctsNode::EdgeStats root_stats;
   auto board = TestablePosition(kAlmostDoneBoard, Color::kWhite);
-  MctsNode root(&root_stats, board);
+  MctsNode root(&pool, &root_stats, board);
   root.SelectLeaf()->IncorporateResults(probs, 0, &root);
 
   auto* first_pass = root.MaybeAddChild(Coord::kPass);
@@ -196,7 +268,10 @@ TEST(MctsNodeTest, DoNotExplorePastFinish) {
   auto* second_pass = first_pass->MaybeAddChild(Coord::kPass);
   EXPECT_DEATH(second_pass->IncorporateResults(probs, 0, &root),
                "is_game_over");
-  float value = second_pass->position.CalculateScore(0) > 0 ? 1 : -1;
+  TestablePosition final_position("");
+  second_pass->position.Unpack(&final_position);
+  EXPECT_TRUE(final_position.is_game_over());
+  float value = final_position.CalculateScore(0) > 0 ? 1 : -1;
   second_pass->IncorporateEndGameResult(value, &root);
   auto* node_to_explore = second_pass->SelectLeaf();
   // should just stop exploring at the end position.
@@ -204,30 +279,32 @@ TEST(MctsNodeTest, DoNotExplorePastFinish) {
 }
 
 TEST(MctsNodeTest, AddChild) {
+  MctsNode::Pool pool;
   MctsNode::EdgeStats root_stats;
   TestablePosition board("");
-  MctsNode root(&root_stats, board);
+  MctsNode root(&pool, &root_stats, board);
 
   Coord c = Coord::FromKgs("B9");
   auto* child = root.MaybeAddChild(c);
-  EXPECT_EQ(1, root.children.count(c));
+  EXPECT_EQ(child, root.edges.child[root.FindEdge(c)]);
   EXPECT_EQ(&root, child->parent);
   EXPECT_EQ(child->move, c);
 }
 
 TEST(MctsNodeTest, AddChildIdempotency) {
+  MctsNode::Pool pool;
   MctsNode::EdgeStats root_stats;
   TestablePosition board("");
-  MctsNode root(&root_stats, board);
+  MctsNode root(&pool, &root_stats, board);
 
   Coord c = Coord::FromKgs("B9");
   auto* child = root.MaybeAddChild(c);
-  EXPECT_EQ(1, root.children.count(c));
-  EXPECT_EQ(1, root.children.size());
+  EXPECT_EQ(child, root.edges.child[root.FindEdge(c)]);
+  EXPECT_EQ(1, CountChildren(root));
   auto* child2 = root.MaybeAddChild(c);
   EXPECT_EQ(child, child2);
-  EXPECT_EQ(1, root.children.count(c));
-  EXPECT_EQ(1, root.children.size());
+  EXPECT_EQ(child, root.edges.child[root.FindEdge(c)]);
+  EXPECT_EQ(1, CountChildren(root));
 }
 
 TEST(MctsNodeTest, NeverSelectIllegalMoves) {
@@ -238,17 +315,19 @@ TEST(MctsNodeTest, NeverSelectIllegalMoves) {
   // let's say the NN were to accidentally put a high weight on an illegal move
   probs[1] = 0.99;
 
+  MctsNode::Pool pool;
+
   MctsNode::EdgeStats root_stats;
   auto board = TestablePosition(kAlmostDoneBoard, Color::kWhite);
-  MctsNode root(&root_stats, board);
+  MctsNode root(&pool, &root_stats, board);
   root.SelectLeaf()->IncorporateResults(probs, 0, &root);
 
   // and let's say the root were visited a lot of times, which pumps up the
   // action score for unvisited moves...
-  root.stats->N = 100000;
+  root_stats.N = 100000;
   for (int i = 0; i < kNumMoves; ++i) {
-    if (root.position.ClassifyMove(i) != Position::MoveType::kIllegal) {
-      root.edges[i].N = 10000;
+    if (board.ClassifyMove(i) != Position::MoveType::kIllegal) {
+      root.edges.N[root.FindEdge(i)] = 10000;
     }
   }
   // this should not throw an error...
@@ -276,9 +355,11 @@ TEST(MctsNodeTest, DontTraverseUnexpandedChild) {
   // even with a virtual loss.
   probs[17] = 0.99;
 
+  MctsNode::Pool pool;
+
   MctsNode::EdgeStats root_stats;
   auto board = TestablePosition(kAlmostDoneBoard, Color::kWhite);
-  MctsNode root(&root_stats, board);
+  MctsNode root(&pool, &root_stats, board);
   root_stats.N = 5;
   root.SelectLeaf()->IncorporateResults(probs, 0, &root);
 
@@ -304,9 +385,11 @@ TEST(MctsNodeTest, GetMostVisitedPath) {
   probs[15] = 0.5;
   probs[16] = 0.6;
 
+  MctsNode::Pool pool;
+
   MctsNode::EdgeStats root_stats;
   auto board = TestablePosition("", Color::kBlack);
-  MctsNode root(&root_stats, board);
+  MctsNode root(&pool, &root_stats, board);
   root.SelectLeaf()->IncorporateResults(probs, 0, &root);
 
   // We should select the highest probabilty first.
@@ -334,9 +417,11 @@ TEST(MctsNodeTest, TestSelectLeaf) {
   }
   probs[17] = 0.99;
 
+  MctsNode::Pool pool;
+
   MctsNode::EdgeStats root_stats;
   auto board = TestablePosition(kAlmostDoneBoard, Color::kWhite);
-  MctsNode root(&root_stats, board);
+  MctsNode root(&pool, &root_stats, board);
   root.SelectLeaf()->IncorporateResults(probs, 0, &root);
 
   std::set<MctsNode*> leaves;
@@ -366,9 +451,11 @@ TEST(MctsNodeTest, NormalizeTest) {
   probs[17] = 0.005;
   probs[18] = 0;
 
+  MctsNode::Pool pool;
+
   MctsNode::EdgeStats root_stats;
   auto board = TestablePosition("");
-  MctsNode root(&root_stats, board);
+  MctsNode root(&pool, &root_stats, board);
   root.IncorporateResults(probs, 0, &root);
 
   // Adjust for the one value that is five times larger and one missing value.
@@ -391,19 +478,21 @@ TEST(MctsNodeTest, InjectNoiseOnlyLegalMoves) {
     prob = 0.02;
   }
 
+  MctsNode::Pool pool;
+
   MctsNode::EdgeStats root_stats;
   auto board = TestablePosition(kAlmostDoneBoard, Color::kWhite);
-  MctsNode root(&root_stats, board);
+  MctsNode root(&pool, &root_stats, board);
   root.IncorporateResults(probs, 0, &root);
 
   // kAlmostDoneBoard has 6 legal moves including pass.
   float uniform_policy = 1.0 / 6;
 
   for (int i = 0; i < kNumMoves; ++i) {
-    if (root.legal_moves[i]) {
-      EXPECT_FLOAT_EQ(uniform_policy, root.edges[i].P);
+    if (root.IsLegalMove(i)) {
+      EXPECT_FLOAT_EQ(uniform_policy, root.child_P(i));
     } else {
-      EXPECT_FLOAT_EQ(0, root.edges[i].P);
+      EXPECT_FLOAT_EQ(0, root.child_P(i));
     }
   }
 
@@ -414,11 +503,11 @@ TEST(MctsNodeTest, InjectNoiseOnlyLegalMoves) {
   root.InjectNoise(noise);
 
   for (int i = 0; i < kNumMoves; ++i) {
-    if (root.legal_moves[i]) {
-      EXPECT_LT(0.75 * uniform_policy, root.edges[i].P);
-      EXPECT_GT(0.75 * uniform_policy + 0.25, root.edges[i].P);
+    if (root.IsLegalMove(i)) {
+      EXPECT_LT(0.75 * uniform_policy, root.child_P(i));
+      EXPECT_GT(0.75 * uniform_policy + 0.25, root.child_P(i));
     } else {
-      EXPECT_FLOAT_EQ(0, root.edges[i].P);
+      EXPECT_FLOAT_EQ(0, root.child_P(i));
     }
   }
 }
@@ -452,34 +541,380 @@ TEST(MctsNodeTest, TestSuperko) {
   // cache-lookup pair of checks, we run the superko test multiple times, with a
   // different number of moves played at the start each time.
   for (size_t iteration = 0; iteration < non_ko_moves.size(); ++iteration) {
+    MctsNode::Pool pool;
     std::vector<std::unique_ptr<MctsNode>> nodes;
     MctsNode::EdgeStats root_stats;
     BoardVisitor bv;
     GroupVisitor gv;
-    nodes.push_back(absl::make_unique<MctsNode>(
-        &root_stats, Position(&bv, &gv, Color::kBlack)));
+    Position position(&bv, &gv, Color::kBlack);
+    nodes.push_back(absl::make_unique<MctsNode>(&pool, &root_stats, position));
 
     for (size_t move_idx = 0; move_idx < iteration; ++move_idx) {
       Coord c = Coord::FromKgs(non_ko_moves[move_idx]);
-      ASSERT_TRUE(nodes.back()->legal_moves[c]);
-      nodes.push_back(absl::make_unique<MctsNode>(nodes.back().get(), c));
+      ASSERT_TRUE(nodes.back()->IsLegalMove(c));
+      position.PlayMove(c);
+      nodes.push_back(
+          absl::make_unique<MctsNode>(nodes.back().get(), c, position));
     }
 
     for (const auto& move : ko_moves) {
       Coord c = Coord::FromKgs(move);
-      ASSERT_TRUE(nodes.back()->legal_moves[c]);
-      nodes.push_back(absl::make_unique<MctsNode>(nodes.back().get(), c));
+      ASSERT_TRUE(nodes.back()->IsLegalMove(c));
+      position.PlayMove(c);
+      nodes.push_back(
+          absl::make_unique<MctsNode>(nodes.back().get(), c, position));
     }
 
     // Without superko checking, it should look like capturing the second ko at
     // C1 is valid.
     auto c1 = Coord::FromKgs("C1");
-    EXPECT_EQ(Position::MoveType::kCapture,
-              nodes.back()->position.ClassifyMove(c1));
+    EXPECT_EQ(Position::MoveType::kCapture, position.ClassifyMove(c1));
 
     // When checking superko however, playing at C1 is not legal because it
     // repeats a position.
-    EXPECT_FALSE(nodes.back()->legal_moves[c1]);
+    EXPECT_FALSE(nodes.back()->IsLegalMove(c1));
+  }
+}
+
+// Plays two games that transpose to the same position after the first three
+// moves, and checks that the history hashes of their nodes are equal exactly
+// when the input features of the nodes are.
+TEST(MctsNodeTest, HistoryHash) {
+  std::vector<std::string> moves_a = {"A1", "J9", "C1", "H9", "E1", "G9",
+                                      "F1", "F9", "G1", "E9", "H1", "D9",
+                                      "pass", "C9"};
+  auto moves_b = moves_a;
+  std::swap(moves_b[0], moves_b[2]);
+
+  MctsNode::Pool pool;
+  MctsNode::EdgeStats root_stats;
+  auto play = [&pool, &root_stats](const std::vector<std::string>& moves) {
+    std::vector<std::unique_ptr<MctsNode>> nodes;
+    BoardVisitor bv;
+    GroupVisitor gv;
+    Position position(&bv, &gv, Color::kBlack);
+    nodes.push_back(absl::make_unique<MctsNode>(&pool, &root_stats, position));
+    for (const auto& move : moves) {
+      Coord c = Coord::FromKgs(move);
+      position.PlayMove(c);
+      nodes.push_back(
+          absl::make_unique<MctsNode>(nodes.back().get(), c, position));
+    }
+    return nodes;
+  };
+  auto nodes_a = play(moves_a);
+  auto nodes_b = play(moves_b);
+
+  std::vector<const PackedPosition*> history;
+  DualNet::BoardFeatures features_a, features_b;
+  for (size_t i = 0; i < nodes_a.size(); ++i) {
+    const auto* a = nodes_a[i].get();
+    const auto* b = nodes_b[i].get();
+    a->GetMoveHistory(DualNet::kMoveHistory, &history);
+    DualNet::SetFeatures(history, a->position.to_play(), &features_a);
+    b->GetMoveHistory(DualNet::kMoveHistory, &history);
+    DualNet::SetFeatures(history, b->position.to_play(), &features_b);
+
+    // The games differ in the positions after moves 1 and 2, which are part of
+    // the history of the first kMoveHistory + 2 positions.
+    bool same_features = features_a == features_b;
+    EXPECT_EQ(i == 0 || i >= DualNet::kMoveHistory + 2, same_features) << i;
+    EXPECT_EQ(same_features, a->history_hash == b->history_hash) << i;
+  }
+
+  // Consecutive nodes have different hashes, including across the pass that
+  // leaves the stones unchanged.
+  for (size_t i = 1; i < nodes_a.size(); ++i) {
+    EXPECT_NE(nodes_a[i - 1]->history_hash, nodes_a[i]->history_hash);
+  }
+}
+
+// Searches a tree with a TranspositionTable, with priors that only allow a
+// handful of moves so that many sequences of moves transpose, and checks that
+// the visit counts of the DAG are consistent.
+TEST(MctsNodeTest, TranspositionTable) {
+  std::array<float, kNumMoves> probs;
+  probs.fill(0);
+  for (const auto* move : {"A1", "C1", "E1", "G1"}) {
+    probs[Coord::FromKgs(move)] = 0.25;
+  }
+
+  MctsNode::Pool pool;
+  MctsNode::TranspositionTable table;
+  MctsNode::EdgeStats root_stats;
+  BoardVisitor bv;
+  GroupVisitor gv;
+  Position position(&bv, &gv, Color::kBlack);
+  UndoJournal journal;
+  MctsNode::Path path;
+  MctsNode root(&pool, &root_stats, position);
+  const int kNumReadouts = 200;
+  for (int i = 0; i < kNumReadouts; ++i) {
+    auto* leaf =
+        root.SelectLeaf(&position, &journal, &pool, &path, &table, false);
+    leaf->IncorporateResults(probs, 0, path);
+    while (journal.num_moves() != 0) {
+      position.UndoMove(&journal);
+    }
+  }
+  EXPECT_EQ(kNumReadouts, root.N());
+  EXPECT_EQ(pool.num_live(), static_cast<int>(table.size()));
+
+  // Each position has a single node. Each readout that passed through a node
+  // came in along one of its incoming edges and, unless the node was the
+  // readout's leaf, left along one of its outgoing edges.
+  absl::flat_hash_map<const MctsNode*, float> incoming_N = {
+      {&root, root.N()}};
+  absl::flat_hash_set<zobrist::Hash> state_hashes;
+  std::vector<const MctsNode*> nodes = {&root};
+  int num_links = 0;
+  for (size_t j = 0; j < nodes.size(); ++j) {
+    const auto* node = nodes[j];
+    EXPECT_TRUE(state_hashes.insert(node->position.state_hash()).second);
+    for (int i = 0; i < node->edges.size; ++i) {
+      const auto* child = node->edges.child[i];
+      if (child == nullptr) {
+        continue;
+      }
+      if (child->parent == node) {
+        nodes.push_back(child);
+      } else {
+        ++num_links;
+      }
+      incoming_N[child] += node->edges.N[i];
+    }
+  }
+  EXPECT_LT(0, num_links);
+  EXPECT_EQ(pool.num_live() + 1, static_cast<int>(nodes.size()));
+  for (const auto* node : nodes) {
+    float outgoing_N = 0;
+    for (int i = 0; i < node->edges.size; ++i) {
+      outgoing_N += node->edges.N[i];
+    }
+    EXPECT_EQ(incoming_N[node], 1 + outgoing_N);
+  }
+
+  // Playing a move must remove the links to the nodes that are pruned.
+  auto* child = root.MaybeAddChild(Coord::FromKgs("A1"));
+  table.Rebuild(child);
+  root.PruneChildren(Coord::FromKgs("A1"));
+  EXPECT_EQ(pool.num_live(), static_cast<int>(table.size()));
+  nodes = {child};
+  absl::flat_hash_set<const MctsNode*> subtree;
+  for (size_t j = 0; j < nodes.size(); ++j) {
+    const auto* node = nodes[j];
+    subtree.insert(node);
+    for (int i = 0; i < node->edges.size; ++i) {
+      const auto* c = node->edges.child[i];
+      if (c != nullptr && c->parent == node) {
+        nodes.push_back(c);
+      }
+    }
+  }
+  for (const auto* node : nodes) {
+    for (int i = 0; i < node->edges.size; ++i) {
+      const auto* c = node->edges.child[i];
+      EXPECT_TRUE(c == nullptr || subtree.contains(c));
+    }
+  }
+}
+
+// Checks that the fused virtual loss methods give the same results as adding,
+// backing up & reverting virtual losses one walk at a time.
+TEST(MctsNodeTest, FusedVirtualLoss) {
+  Random rnd(614944751);
+  std::array<float, kNumMoves> probs;
+  for (auto& p : probs) {
+    p = rnd();
+  }
+
+  BoardVisitor bv;
+  GroupVisitor gv;
+  Position position(&bv, &gv, Color::kBlack);
+  UndoJournal journal;
+  MctsNode::Pool pool;
+  MctsNode::EdgeStats separate_stats;
+  MctsNode::EdgeStats fused_stats;
+  MctsNode separate_root(&pool, &separate_stats, position);
+  MctsNode fused_root(&pool, &fused_stats, position);
+
+  const int kBatchSize = 4;
+  std::vector<MctsNode::Path> paths(kBatchSize);
+  std::vector<MctsNode*> leaves;
+  std::vector<float> values(kBatchSize);
+  for (int batch = 0; batch < 20; ++batch) {
+    for (auto& value : values) {
+      value = rnd() * 2 - 1;
+    }
+    // Select a batch of leaves on each tree. The first batch selects the
+    // unexpanded roots several times.
+    for (auto* root : {&separate_root, &fused_root}) {
+      bool fused = root == &fused_root;
+      leaves.clear();
+      for (int i = 0; i < kBatchSize; ++i) {
+        auto* leaf = root->SelectLeaf(&position, &journal, &pool, &paths[i],
+                                      nullptr, fused);
+        if (!fused) {
+          leaf->AddVirtualLoss(paths[i]);
+        }
+        leaves.push_back(leaf);
+        while (journal.num_moves() != 0) {
+          position.UndoMove(&journal);
+        }
+      }
+      EXPECT_LT(0, leaves[0]->num_virtual_losses_applied);
+
+      for (int i = 0; i < kBatchSize; ++i) {
+        if (fused) {
+          leaves[i]->IncorporateResultsAndRevertVirtualLoss(probs, values[i],
+                                                            paths[i]);
+        } else {
+          leaves[i]->IncorporateResults(probs, values[i], paths[i]);
+          leaves[i]->RevertVirtualLoss(paths[i]);
+        }
+      }
+    }
+  }
+
+  // Both trees must be identical, with no virtual losses left.
+  std::vector<std::pair<const MctsNode*, const MctsNode*>> nodes = {
+      {&separate_root, &fused_root}};
+  while (!nodes.empty()) {
+    const auto* a = nodes.back().first;
+    const auto* b = nodes.back().second;
+    nodes.pop_back();
+    EXPECT_EQ(a->N(), b->N());
+    EXPECT_FLOAT_EQ(a->W(), b->W());
+    EXPECT_EQ(0, a->num_virtual_losses_applied);
+    EXPECT_EQ(0, b->num_virtual_losses_applied);
+    ASSERT_EQ(a->edges.size, b->edges.size);
+    for (int i = 0; i < a->edges.size; ++i) {
+      ASSERT_EQ(a->edges.child[i] == nullptr, b->edges.child[i] == nullptr);
+      if (a->edges.child[i] != nullptr) {
+        nodes.emplace_back(a->edges.child[i], b->edges.child[i]);
+      }
+    }
+  }
+}
+
+// Checks that SelectLeaf takes the first edge it's given from the root, and
+// selects by action score below it.
+TEST(MctsNodeTest, SelectLeafFirstEdge) {
+  std::array<float, kNumMoves> probs;
+  probs.fill(0.001);
+  probs[Coord::FromKgs("E5")] = 0.9;
+
+  BoardVisitor bv;
+  GroupVisitor gv;
+  Position position(&bv, &gv, Color::kBlack);
+  UndoJournal journal;
+  MctsNode::Pool pool;
+  MctsNode::EdgeStats stats;
+  MctsNode root(&pool, &stats, position);
+  root.IncorporateResults(probs, 0, &root);
+
+  int first_edge = root.FindEdge(Coord::FromKgs("A1"));
+  MctsNode::Path path;
+  auto* leaf = root.SelectLeaf(&position, &journal, &pool, &path, nullptr,
+                               true, first_edge);
+  ASSERT_EQ(1, path.size());
+  EXPECT_EQ(first_edge, path[0].edge);
+  EXPECT_EQ(Coord::FromKgs("A1"), leaf->move);
+  EXPECT_EQ(1, leaf->num_virtual_losses_applied);
+  leaf->IncorporateResultsAndRevertVirtualLoss(probs, 0, path);
+  while (journal.num_moves() != 0) {
+    position.UndoMove(&journal);
+  }
+
+  // Without a first edge, the root's best edge is taken instead.
+  leaf = root.SelectLeaf(&position, &journal, &pool, &path, nullptr, false);
+  EXPECT_EQ(Coord::FromKgs("E5"), leaf->move);
+  while (journal.num_moves() != 0) {
+    position.UndoMove(&journal);
+  }
+
+  // Only the first step is forced.
+  leaf = root.SelectLeaf(&position, &journal, &pool, &path, nullptr, false,
+                         first_edge);
+  ASSERT_EQ(2, path.size());
+  EXPECT_EQ(first_edge, path[0].edge);
+  EXPECT_EQ(Coord::FromKgs("E5"), leaf->move);
+  EXPECT_EQ(Coord::FromKgs("A1"), leaf->parent->move);
+}
+
+TEST(MctsNodeTest, EvictSubtrees) {
+  std::array<float, kNumMoves> probs;
+  probs.fill(0);
+  for (const auto* move : {"A1", "C1", "E1", "G1", "J1", "A9"}) {
+    probs[Coord::FromKgs(move)] = 1.0 / 6;
+  }
+
+  for (bool use_table : {false, true}) {
+    MctsNode::Pool pool;
+    MctsNode::TranspositionTable table;
+    auto* table_ptr = use_table ? &table : nullptr;
+    MctsNode::EdgeStats root_stats;
+    BoardVisitor bv;
+    GroupVisitor gv;
+    Position position(&bv, &gv, Color::kBlack);
+    UndoJournal journal;
+    MctsNode::Path path;
+    MctsNode root(&pool, &root_stats, position);
+    auto search = [&](int num_readouts) {
+      for (int i = 0; i < num_readouts; ++i) {
+        auto* leaf =
+            root.SelectLeaf(&position, &journal, &pool, &path, table_ptr,
+                            false);
+        leaf->IncorporateResults(probs, 0.1, path);
+        while (journal.num_moves() != 0) {
+          position.UndoMove(&journal);
+        }
+      }
+    };
+    search(300);
+
+    auto size = root.CalculateSubtreeSize();
+    EXPECT_EQ(pool.num_live() + 1, static_cast<int>(size.num_nodes));
+    EXPECT_LT(size.num_nodes * sizeof(MctsNode), size.num_bytes);
+    std::vector<float> edge_N(root.edges.N, root.edges.N + root.edges.size);
+    std::vector<float> edge_W(root.edges.W, root.edges.W + root.edges.size);
+    auto best_move = root.GetMostVisitedMove();
+
+    EXPECT_EQ(0, root.EvictSubtrees(size.num_nodes, table_ptr, nullptr));
+    auto num_evicted = root.EvictSubtrees(50, table_ptr, nullptr);
+    EXPECT_EQ(size.num_nodes - 50, num_evicted);
+    EXPECT_EQ(50, root.CalculateSubtreeSize().num_nodes);
+    EXPECT_EQ(49, pool.num_live());
+    if (use_table) {
+      EXPECT_EQ(50, table.size());
+    }
+
+    // The stats of the root's edges are kept, and the most visited subtree is
+    // the last to be evicted.
+    for (int i = 0; i < root.edges.size; ++i) {
+      EXPECT_EQ(edge_N[i], root.edges.N[i]);
+      EXPECT_EQ(edge_W[i], root.edges.W[i]);
+    }
+    EXPECT_NE(nullptr, root.edges.child[root.FindEdge(best_move)]);
+
+    // The search can carry on where it left off, adding new children for the
+    // edges that were evicted.
+    search(100);
+    EXPECT_EQ(400, root.N());
+    float sum = 0;
+    for (int i = 0; i < root.edges.size; ++i) {
+      sum += root.edges.N[i];
+    }
+    EXPECT_EQ(root.N(), 1 + sum);
+    if (use_table) {
+      EXPECT_EQ(pool.num_live() + 1, static_cast<int>(table.size()));
+    }
+
+    // Evicting everything leaves just the root.
+    root.EvictSubtrees(1, table_ptr, nullptr);
+    EXPECT_EQ(0, pool.num_live());
+    EXPECT_EQ(0, CountChildren(root));
+    EXPECT_EQ(400, root.N());
   }
 }
 
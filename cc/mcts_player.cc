@@ -17,6 +17,8 @@
 #include <algorithm>
 #include <cmath>
 #include <iostream>
+#include <limits>
+#include <numeric>
 #include <sstream>
 #include <utility>
 
@@ -31,17 +33,89 @@
 
 namespace minigo {
 
+namespace {
+
+// Sets best & second to the indices of the two most visited edges of node.
+// Returns false if node has fewer than two edges.
+bool FindTwoMostVisitedEdges(const MctsNode& node, int* best, int* second) {
+  const auto& edges = node.edges;
+  if (edges.size < 2) {
+    return false;
+  }
+  *best = edges.N[1] > edges.N[0] ? 1 : 0;
+  *second = 1 - *best;
+  for (int i = 2; i < edges.size; ++i) {
+    if (edges.N[i] > edges.N[*best]) {
+      *second = *best;
+      *best = i;
+    } else if (edges.N[i] > edges.N[*second]) {
+      *second = i;
+    }
+  }
+  return true;
+}
+
+// Constants of the transform sigma(q) = (kGumbelVisitScale + max N) *
+// kGumbelValueScale * q that Gumbel root search applies to Q-values before
+// adding them to logits, so that the values outweigh the priors more as the
+// visit counts grow. These are the values used for Go by Danihelka et al.,
+// "Policy improvement by planning with Gumbel".
+constexpr float kGumbelVisitScale = 50;
+constexpr float kGumbelValueScale = 1;
+
+// Returns the log of the prior of edge i of node.
+float Logit(const MctsNode& node, int i) {
+  return std::log(
+      std::max(node.edges.original_P[i], std::numeric_limits<float>::min()));
+}
+
+// Returns sigma(q) for the completed Q-value of edge i of node, from the
+// perspective of the player to play. Expand seeds each edge's W with the
+// node's value, so the Q of an edge that hasn't been visited is already the
+// node's own value, which completes it. Q-values are rescaled from [-1, 1] to
+// [0, 1] before being transformed.
+float TransformedQ(const MctsNode& node, int i, float max_N) {
+  const auto& edges = node.edges;
+  float Q = edges.W[i] / (1 + edges.N[i]);
+  if (node.position.to_play() == Color::kWhite) {
+    Q = -Q;
+  }
+  return (kGumbelVisitScale + max_N) * kGumbelValueScale * (Q + 1) / 2;
+}
+
+float MaxVisits(const MctsNode& node) {
+  float max_N = 0;
+  for (int i = 0; i < node.edges.size; ++i) {
+    max_N = std::max(max_N, node.edges.N[i]);
+  }
+  return max_N;
+}
+
+}  // namespace
+
 std::ostream& operator<<(std::ostream& os, const MctsPlayer::Options& options) {
   os << "name:" << options.name << " inject_noise:" << options.inject_noise
      << " soft_pick:" << options.soft_pick
      << " random_symmetry:" << options.random_symmetry
      << " resign_threshold:" << options.resign_threshold
      << " resign_enabled:" << options.resign_enabled
-     << " batch_size:" << options.batch_size << " komi:" << options.komi
+     << " adjudicate_pass_alive:" << options.adjudicate_pass_alive
+     << " batch_size:" << options.batch_size
+     << " num_search_threads:" << options.num_search_threads
+     << " pipeline_depth:" << options.pipeline_depth
+     << " use_transposition_table:" << options.use_transposition_table
+     << " max_tree_nodes:" << options.max_tree_nodes
+     << " reclaim_nodes_in_background:" << options.reclaim_nodes_in_background
+     << " komi:" << options.komi
      << " num_readouts:" << options.num_readouts
+     << " fast_readouts:" << options.fast_readouts
+     << " full_search_probability:" << options.full_search_probability
+     << " gumbel_root_search:" << options.gumbel_root_search
+     << " gumbel_num_sampled_actions:" << options.gumbel_num_sampled_actions
      << " seconds_per_move:" << options.seconds_per_move
      << " time_limit:" << options.time_limit
      << " decay_factor:" << options.decay_factor
+     << " early_termination:" << options.early_termination
      << " random_seed:" << options.random_seed;
   return os;
 }
@@ -71,26 +145,72 @@ float TimeRecommendation(int move_num, float seconds_per_move, float time_limit,
          std::pow(decay_factor, std::max(player_move_num - core_moves, 0));
 }
 
-MctsPlayer::MctsPlayer(std::unique_ptr<DualNet> network, const Options& options)
+MctsPlayer::MctsPlayer(std::unique_ptr<DualNet> network,
+                       std::shared_ptr<InferenceCache> inference_cache,
+                       const Options& options)
     : network_(std::move(network)),
-      game_root_(&dummy_stats_, {&bv_, &gv_, Color::kBlack}),
+      inference_cache_(std::move(inference_cache)),
+      root_position_(&bv_, &gv_, Color::kBlack),
       rnd_(options.random_seed),
-      options_(options) {
+      options_(options),
+      search_state_(&root_position_, &undo_journal_, &node_pool_, &rnd_) {
   options_.resign_threshold = -std::abs(options_.resign_threshold);
   // When to do deterministic move selection: 30 moves on a 19x19, 6 on 9x9.
   // divide 2, multiply 2 guarentees that white and black do even number.
   temperature_cutoff_ = !options_.soft_pick ? -1 : (((kN * kN / 12) / 2) * 2);
-  root_ = &game_root_;
+
+  // The schedule of a Gumbel root search is shared by all the batches of a
+  // search, and its rounds are only compared between batches.
+  MG_CHECK(!options_.gumbel_root_search ||
+           (options_.num_search_threads == 1 && options_.pipeline_depth == 1));
 
   if (options_.verbose) {
     std::cerr << "MctsPlayer options: " << options_ << "\n";
     std::cerr << "Random seed used: " << rnd_.seed() << "\n";
   }
 
+  if (options_.use_transposition_table) {
+    transpositions_ = absl::make_unique<MctsNode::TranspositionTable>();
+  }
+
+  for (int i = 1; i < options_.num_search_threads; ++i) {
+    search_threads_.push_back(
+        absl::make_unique<SearchThread>(rnd_.UniformUint64()));
+    auto* thread = search_threads_.back().get();
+    thread->thread = std::thread(&MctsPlayer::RunSearchThread, this, thread);
+  }
+  if (options_.pipeline_depth > 1) {
+    for (int i = 0; i < options_.pipeline_depth; ++i) {
+      pipelined_states_.push_back(absl::make_unique<SearchState>(
+          &root_position_, &undo_journal_, &node_pool_, &rnd_));
+      free_states_.push_back(pipelined_states_.back().get());
+      inference_threads_.emplace_back(&MctsPlayer::RunInferenceThread, this);
+    }
+  }
+  if (options_.reclaim_nodes_in_background) {
+    reclaim_thread_ = std::thread(&MctsPlayer::RunReclaimThread, this);
+  }
+
   InitializeGame({&bv_, &gv_, Color::kBlack});
 }
 
 MctsPlayer::~MctsPlayer() {
+  FinishPipelinedBatches();
+  for (size_t i = 0; i < inference_threads_.size(); ++i) {
+    inference_queue_.Push(nullptr);
+  }
+  for (auto& thread : inference_threads_) {
+    thread.join();
+  }
+  for (auto& thread : search_threads_) {
+    thread->requests.Push(nullptr);
+    thread->thread.join();
+  }
+  if (reclaim_thread_.joinable()) {
+    reclaim_queue_.Push({});
+    reclaim_thread_.join();
+  }
+  node_pool_.Delete(game_root_);
   if (options_.verbose) {
     std::cerr << "Inference history:" << std::endl;
     for (const auto& info : inferences_) {
@@ -101,18 +221,36 @@ MctsPlayer::~MctsPlayer() {
 }
 
 void MctsPlayer::InitializeGame(const Position& position) {
-  game_root_ = {&dummy_stats_, Position(&bv_, &gv_, position)};
-  root_ = &game_root_;
+  ResetTree(position);
   game_over_ = false;
 }
 
 void MctsPlayer::NewGame() {
-  game_root_ = MctsNode(&dummy_stats_, {&bv_, &gv_, Color::kBlack});
-  root_ = &game_root_;
+  ResetTree({&bv_, &gv_, Color::kBlack});
   game_over_ = false;
   history_.clear();
 }
 
+void MctsPlayer::ResetTree(const Position& position) {
+  FinishPipelinedBatches();
+  search_started_ = false;
+  is_full_search_ = true;
+  gumbel_candidates_.clear();
+  gumbel_schedule_.clear();
+  game_search_time_ = absl::ZeroDuration();
+  game_recommended_time_ = absl::ZeroDuration();
+  root_position_ = Position(&bv_, &gv_, position);
+  if (transpositions_ != nullptr) {
+    transpositions_->Clear();
+  }
+  if (game_root_ != nullptr) {
+    detached_nodes_.push_back(game_root_);
+    DeleteDetachedNodes(&detached_nodes_);
+  }
+  game_root_ = node_pool_.New(&node_pool_, &dummy_stats_, root_position_);
+  root_ = game_root_;
+}
+
 Coord MctsPlayer::SuggestMove() {
   auto start = absl::Now();
 
@@ -121,17 +259,87 @@ Coord MctsPlayer::SuggestMove() {
   // time SuggestMove has been called for a game, or PlayMove was called without
   // a prior call to SuggestMove.
   if (!root_->is_expanded) {
-    auto* first_node = root_->SelectLeaf();
+    auto* first_node = root_;
     ProcessLeaves({&first_node, 1}, options_.random_symmetry);
   }
 
-  if (options_.inject_noise) {
+  StartSearch(start);
+  if (search_duration_ != absl::ZeroDuration()) {
+    while (!IsSearchFinished()) {
+      TreeSearch();
+    }
+  } else {
+    // Count the leaves that are still in flight as read until they have all
+    // finished.
+    while (!IsSearchFinished()) {
+      if (root_->N() + num_pipelined_leaves_ < target_readouts_) {
+        TreeSearch();
+      } else {
+        FinishPipelinedBatches();
+      }
+    }
+  }
+  FinishPipelinedBatches();
+  return FinishSearch();
+}
+
+bool MctsPlayer::SelectLeavesForInference(
+    std::vector<const DualNet::BoardFeatures*>* features,
+    std::vector<DualNet::Output*>* outputs) {
+  auto* state = &search_state_;
+  for (;;) {
+    // The search starts once the root has been expanded, which the first
+    // batch of a game does on its own.
+    if (!search_started_ && root_->is_expanded) {
+      StartSearch(absl::Now());
+    }
+    if (search_started_ && IsSearchFinished()) {
+      return false;
+    }
+
+    MaybeEvictSubtrees();
+    SelectLeaves(state);
+    FeaturizeLeaves(state, absl::MakeSpan(state->leaves),
+                    absl::MakeConstSpan(state->paths.data(),
+                                        state->leaves.size()),
+                    options_.random_symmetry);
+    if (state->num_inferences != 0) {
+      break;
+    }
+  }
+
+  state->outputs.resize(state->num_inferences);
+  for (size_t j = 0; j < state->num_inferences; ++j) {
+    features->push_back(&state->features[j]);
+    outputs->push_back(&state->outputs[j]);
+  }
+  return true;
+}
+
+void MctsPlayer::IncorporateInferenceResults(const std::string& model) {
+  auto* state = &search_state_;
+  IncorporateOutputs(
+      state, absl::MakeSpan(state->leaves),
+      absl::MakeConstSpan(state->paths.data(), state->leaves.size()));
+  UpdateInferences(model, state->num_inferences);
+}
+
+void MctsPlayer::StartSearch(absl::Time start_time) {
+  // Fast searches only need to find a reasonable move to advance the game,
+  // so they don't explore.
+  is_full_search_ = options_.seconds_per_move > 0 ||
+                    options_.fast_readouts == 0 ||
+                    rnd_() < options_.full_search_probability;
+  if (options_.inject_noise && is_full_search_ &&
+      (!options_.gumbel_root_search || options_.seconds_per_move > 0)) {
     std::array<float, kNumMoves> noise;
     rnd_.Dirichlet(kDirichletAlpha, &noise);
     root_->InjectNoise(noise);
   }
-  int current_readouts = root_->N();
 
+  search_started_ = true;
+  search_start_time_ = start_time;
+  search_start_readouts_ = root_->N();
   if (options_.seconds_per_move > 0) {
     // Use time to limit the number of reads.
     float seconds_per_move = options_.seconds_per_move;
@@ -140,17 +348,155 @@ Coord MctsPlayer::SuggestMove() {
           TimeRecommendation(root_->position.n(), seconds_per_move,
                              options_.time_limit, options_.decay_factor);
     }
-    while (absl::Now() - start < absl::Seconds(seconds_per_move)) {
-      TreeSearch();
+    search_duration_ = absl::Seconds(seconds_per_move);
+    max_search_duration_ = search_duration_;
+    if (options_.time_limit > 0) {
+      // Only searches that can terminate early are allowed to overrun.
+      auto time_saved = game_recommended_time_ - game_search_time_;
+      if (options_.early_termination && time_saved > absl::ZeroDuration()) {
+        max_search_duration_ += time_saved / 2;
+      }
+      game_recommended_time_ += search_duration_;
     }
+    target_readouts_ = 0;
   } else {
     // Use a fixed number of reads.
-    while (root_->N() < current_readouts + options_.num_readouts) {
-      TreeSearch();
+    search_duration_ = absl::ZeroDuration();
+    int num_readouts =
+        is_full_search_ ? options_.num_readouts : options_.fast_readouts;
+    target_readouts_ = search_start_readouts_ + num_readouts;
+    if (options_.gumbel_root_search) {
+      StartGumbelSearch(num_readouts);
     }
   }
-  int num_readouts = root_->N() - current_readouts;
-  auto elapsed = absl::Now() - start;
+}
+
+void MctsPlayer::StartGumbelSearch(int num_readouts) {
+  // Adding Gumbel noise to the logits & taking the top k samples k moves from
+  // the policy without replacement.
+  const auto& edges = root_->edges;
+  gumbel_logits_.resize(edges.size);
+  if (options_.inject_noise && is_full_search_) {
+    rnd_.Gumbel(&gumbel_logits_);
+  } else {
+    std::fill(gumbel_logits_.begin(), gumbel_logits_.end(), 0);
+  }
+  for (int i = 0; i < edges.size; ++i) {
+    gumbel_logits_[i] += Logit(*root_, i);
+  }
+
+  int num_candidates =
+      std::min(options_.gumbel_num_sampled_actions, edges.size);
+  gumbel_candidates_.resize(edges.size);
+  std::iota(gumbel_candidates_.begin(), gumbel_candidates_.end(), 0);
+  std::partial_sort(
+      gumbel_candidates_.begin(), gumbel_candidates_.begin() + num_candidates,
+      gumbel_candidates_.end(),
+      [this](int a, int b) { return gumbel_logits_[a] > gumbel_logits_[b]; });
+  gumbel_candidates_.resize(num_candidates);
+
+  gumbel_num_readouts_ = num_readouts;
+  gumbel_num_rounds_ =
+      std::max(1, static_cast<int>(std::ceil(std::log2(num_candidates))));
+  gumbel_schedule_.clear();
+  ScheduleGumbelRound();
+}
+
+void MctsPlayer::StartNextGumbelRound() {
+  // Keep the better half of the candidates, but at least two, so that any
+  // readouts that are left after the last round still compare the two best
+  // moves.
+  int num_candidates = gumbel_candidates_.size();
+  num_candidates = std::max(std::min(num_candidates, 2), num_candidates / 2);
+  float max_N = MaxVisits(*root_);
+  std::vector<float> scores(root_->edges.size);
+  for (int i : gumbel_candidates_) {
+    scores[i] = GumbelScore(i, max_N);
+  }
+  std::partial_sort(
+      gumbel_candidates_.begin(), gumbel_candidates_.begin() + num_candidates,
+      gumbel_candidates_.end(),
+      [&scores](int a, int b) { return scores[a] > scores[b]; });
+  gumbel_candidates_.resize(num_candidates);
+  ScheduleGumbelRound();
+}
+
+void MctsPlayer::ScheduleGumbelRound() {
+  // Each round splits an equal share of the readouts evenly between its
+  // candidates, visiting them in turn.
+  int num_candidates = gumbel_candidates_.size();
+  int visits = std::max(
+      1, gumbel_num_readouts_ / (gumbel_num_rounds_ * num_candidates));
+  for (int j = 0; j < visits; ++j) {
+    gumbel_schedule_.insert(gumbel_schedule_.end(),
+                            gumbel_candidates_.rbegin(),
+                            gumbel_candidates_.rend());
+  }
+}
+
+float MctsPlayer::GumbelScore(int i, float max_N) const {
+  return gumbel_logits_[i] + TransformedQ(*root_, i, max_N);
+}
+
+bool MctsPlayer::IsSearchFinished() const {
+  if (search_duration_ != absl::ZeroDuration()) {
+    auto elapsed = absl::Now() - search_start_time_;
+    if (elapsed >= max_search_duration_) {
+      return true;
+    }
+    // Once the recommended time is up, only keep searching while the best
+    // move is unstable.
+    auto deadline = search_duration_;
+    if (elapsed >= search_duration_) {
+      if (!IsBestMoveUnstable()) {
+        return true;
+      }
+      deadline = max_search_duration_;
+    }
+    if (!options_.early_termination || elapsed <= absl::ZeroDuration()) {
+      return false;
+    }
+    // Assume that the rest of the search runs at the same rate as it has so
+    // far.
+    float num_readouts = root_->N() - search_start_readouts_;
+    return IsBestMoveDecided(
+        num_readouts * absl::FDivDuration(deadline - elapsed, elapsed));
+  }
+
+  if (root_->N() >= target_readouts_) {
+    return true;
+  }
+  // A Gumbel search doesn't play the most visited move.
+  return options_.early_termination && gumbel_candidates_.empty() &&
+         IsBestMoveDecided(target_readouts_ - root_->N());
+}
+
+bool MctsPlayer::IsBestMoveDecided(float num_readouts) const {
+  int best, second;
+  if (!FindTwoMostVisitedEdges(*root_, &best, &second)) {
+    return true;
+  }
+  const auto& edges = root_->edges;
+  return edges.N[best] - edges.N[second] > num_readouts;
+}
+
+bool MctsPlayer::IsBestMoveUnstable() const {
+  int best, second;
+  if (!FindTwoMostVisitedEdges(*root_, &best, &second)) {
+    return false;
+  }
+  const auto& edges = root_->edges;
+  float to_play = root_->position.to_play() == Color::kBlack ? 1 : -1;
+  float best_Q = edges.W[best] / (1 + edges.N[best]);
+  float second_Q = edges.W[second] / (1 + edges.N[second]);
+  return second_Q * to_play > best_Q * to_play;
+}
+
+Coord MctsPlayer::FinishSearch() {
+  search_started_ = false;
+  int num_readouts = root_->N() - search_start_readouts_;
+  auto elapsed = absl::Now() - search_start_time_;
+  game_search_time_ += elapsed;
   elapsed = elapsed * 100 / num_readouts;
   if (options_.verbose) {
     std::cerr << "Milliseconds per 100 reads: "
@@ -158,16 +504,41 @@ Coord MctsPlayer::SuggestMove() {
               << " over " << num_readouts
               << " readouts (batched: " << options_.batch_size << ")"
               << std::endl;
+    auto tree_size = root_->CalculateSubtreeSize();
+    std::cerr << "Tree size: " << tree_size.num_nodes << " nodes, "
+              << tree_size.num_bytes / (1024 * 1024) << "MB" << std::endl;
   }
 
-  if (ShouldResign()) {
-    return Coord::kResign;
+  Coord c = Coord::kResign;
+  if (!ShouldResign()) {
+    c = PickMove();
   }
-
-  return PickMove();
+  gumbel_candidates_.clear();
+  gumbel_schedule_.clear();
+  return c;
 }
 
 Coord MctsPlayer::PickMove() {
+  if (!gumbel_candidates_.empty()) {
+    // The Gumbel noise already makes the choice random, so there's no need
+    // for a soft pick.
+    float max_N = MaxVisits(*root_);
+    int best = gumbel_candidates_[0];
+    float best_score = GumbelScore(best, max_N);
+    for (int i : gumbel_candidates_) {
+      float score = GumbelScore(i, max_N);
+      if (score > best_score) {
+        best = i;
+        best_score = score;
+      }
+    }
+    Coord c = root_->edges.move[best];
+    if (options_.verbose) {
+      std::cerr << "Picked gumbel " << c << std::endl;
+    }
+    return c;
+  }
+
   if (root_->position.n() >= temperature_cutoff_) {
     Coord c = root_->GetMostVisitedMove();
     if (options_.verbose) {
@@ -179,12 +550,16 @@ Coord MctsPlayer::PickMove() {
   // Select from the first kN * kN moves (instead of kNumMoves) to avoid
   // randomly choosing to pass early on in the game.
   std::array<float, kN * kN> cdf;
+  cdf.fill(0);
 
   // For moves before the temperature cutoff, exponentiate the probabilities by
   // a temperature slightly larger than unity to encourage diversity in early
   // play and hopefully to move away from 3-3s.
-  for (size_t i = 0; i < cdf.size(); ++i) {
-    cdf[i] = std::pow(root_->child_N(i), kVisitCountSquash);
+  const auto& edges = root_->edges;
+  for (int i = 0; i < edges.size; ++i) {
+    if (edges.move[i] != Coord::kPass) {
+      cdf[edges.move[i]] = std::pow(edges.N[i], kVisitCountSquash);
+    }
   }
   for (size_t i = 1; i < cdf.size(); ++i) {
     cdf[i] += cdf[i - 1];
@@ -199,36 +574,211 @@ Coord MctsPlayer::PickMove() {
 }
 
 absl::Span<MctsNode* const> MctsPlayer::TreeSearch() {
+  // Evict subtrees before starting the search, so that the leaves returned by
+  // the previous call stay valid until this one.
+  MaybeEvictSubtrees();
+
+  // Start a batch on each of the other search threads, then run one on this
+  // thread. The other threads walk down the tree on their own copy of the root
+  // position.
+  absl::BlockingCounter pending(search_threads_.size());
+  for (auto& thread : search_threads_) {
+    thread->position = Position(&thread->bv, &thread->gv, root_position_);
+    thread->requests.Push(&pending);
+  }
+  leaves_.clear();
+  if (pipelined_states_.empty()) {
+    SearchBatch(&search_state_);
+    leaves_.assign(search_state_.leaves.begin(), search_state_.leaves.end());
+    UpdateInferences(search_state_.model, search_state_.num_inferences);
+  } else {
+    PipelineBatch();
+  }
+  pending.Wait();
+
+  for (auto& thread : search_threads_) {
+    const auto& state = thread->state;
+    leaves_.insert(leaves_.end(), state.leaves.begin(), state.leaves.end());
+    UpdateInferences(state.model, state.num_inferences);
+  }
+
+  return absl::MakeConstSpan(leaves_);
+}
+
+void MctsPlayer::MaybeEvictSubtrees() {
+  if (options_.max_tree_nodes <= 0 ||
+      CountTreeNodes() <= options_.max_tree_nodes) {
+    return;
+  }
+  FinishPipelinedBatches();
+  auto num_evicted = root_->EvictSubtrees(options_.max_tree_nodes / 4 * 3,
+                                          transpositions_.get(),
+                                          &detached_nodes_);
+  DeleteDetachedNodes(&detached_nodes_);
+  if (options_.verbose) {
+    std::cerr << "Evicted " << num_evicted << " nodes from the tree"
+              << std::endl;
+  }
+}
+
+void MctsPlayer::SearchBatch(SearchState* state) {
+  SelectLeaves(state);
+  if (!state->leaves.empty()) {
+    EvaluateLeaves(state, absl::MakeSpan(state->leaves),
+                   absl::MakeConstSpan(state->paths.data(),
+                                       state->leaves.size()),
+                   options_.random_symmetry);
+  }
+}
+
+void MctsPlayer::SelectLeaves(SearchState* state) {
   int batch_size = options_.batch_size;
   int max_iterations = batch_size * 2;
 
-  leaves_.resize(0);
+  // Walk down the tree on the scratch position, undoing the moves played on
+  // it after each leaf is selected. This saves copying the position of each
+  // node visited.
+  auto* position = state->position;
+  auto* journal = state->journal;
+  auto& leaves = state->leaves;
+  auto& paths = state->paths;
+  leaves.resize(0);
+  state->num_inferences = 0;
+  if (static_cast<int>(paths.size()) < batch_size) {
+    paths.resize(batch_size);
+  }
+  // A Gumbel round only ends at the start of a batch, so that its candidates
+  // are compared without any virtual losses on them.
+  bool is_gumbel_search = !gumbel_candidates_.empty();
+  if (is_gumbel_search && gumbel_schedule_.empty()) {
+    StartNextGumbelRound();
+  }
   for (int i = 0; i < max_iterations; ++i) {
-    auto* leaf = root_->SelectLeaf();
-    if (leaf == nullptr) {
-      continue;
-    }
-    if (leaf->position.is_game_over() ||
-        leaf->position.n() >= kMaxSearchDepth) {
-      float value = leaf->position.CalculateScore(options_.komi) > 0 ? 1 : -1;
-      leaf->IncorporateEndGameResult(value, root_);
-    } else {
-      leaf->AddVirtualLoss(root_);
-      leaves_.push_back(leaf);
-      if (static_cast<int>(leaves_.size()) == batch_size) {
+    int first_edge = -1;
+    if (is_gumbel_search) {
+      if (gumbel_schedule_.empty()) {
         break;
       }
+      first_edge = gumbel_schedule_.back();
+      gumbel_schedule_.pop_back();
+    }
+    auto& path = paths[leaves.size()];
+    auto* leaf = root_->SelectLeaf(position, journal, state->pool, &path,
+                                   transpositions_.get(), true, first_edge);
+    if (position->is_game_over() || position->n() >= kMaxSearchDepth) {
+      float value = position->CalculateScore(options_.komi) > 0 ? 1 : -1;
+      leaf->IncorporateEndGameResultAndRevertVirtualLoss(value, path);
+    } else {
+      leaves.push_back(leaf);
+    }
+    while (journal->num_moves() != 0) {
+      position->UndoMove(journal);
+    }
+    // Until the root is expanded, every selection ends at it.
+    if (static_cast<int>(leaves.size()) == batch_size || leaf == root_) {
+      break;
+    }
+  }
+}
+
+void MctsPlayer::PipelineBatch() {
+  SearchState* state;
+  while (finished_queue_.TryPop(&state)) {
+    FinishPipelinedBatch(state);
+  }
+  if (free_states_.empty()) {
+    FinishPipelinedBatch(finished_queue_.Pop());
+  }
+  state = free_states_.back();
+  free_states_.pop_back();
+
+  // The leaves of the batches that are still in flight have a virtual loss, so
+  // this batch selects different ones.
+  SelectLeaves(state);
+  auto leaves = absl::MakeSpan(state->leaves);
+  FeaturizeLeaves(state, leaves,
+                  absl::MakeConstSpan(state->paths.data(), leaves.size()),
+                  options_.random_symmetry);
+  if (state->num_inferences == 0) {
+    FinishPipelinedBatch(state);
+    return;
+  }
+  num_pipelined_leaves_ += state->num_inferences;
+  inference_queue_.Push(state);
+}
+
+void MctsPlayer::FinishPipelinedBatch(SearchState* state) {
+  auto leaves = absl::MakeSpan(state->leaves);
+  if (state->num_inferences != 0) {
+    num_pipelined_leaves_ -= state->num_inferences;
+    IncorporateOutputs(state, leaves,
+                       absl::MakeConstSpan(state->paths.data(), leaves.size()));
+  }
+  leaves_.insert(leaves_.end(), leaves.begin(), leaves.end());
+  UpdateInferences(state->model, state->num_inferences);
+  free_states_.push_back(state);
+}
+
+void MctsPlayer::FinishPipelinedBatches() {
+  while (free_states_.size() < pipelined_states_.size()) {
+    FinishPipelinedBatch(finished_queue_.Pop());
+  }
+}
+
+void MctsPlayer::RunInferenceThread() {
+  for (;;) {
+    auto* state = inference_queue_.Pop();
+    if (state == nullptr) {
+      break;
     }
+    RunInference(state);
+    finished_queue_.Push(state);
   }
+}
 
-  if (!leaves_.empty()) {
-    ProcessLeaves(absl::MakeSpan(leaves_), options_.random_symmetry);
-    for (auto* leaf : leaves_) {
-      leaf->RevertVirtualLoss(root_);
+void MctsPlayer::RunSearchThread(SearchThread* thread) {
+  for (;;) {
+    auto* pending = thread->requests.Pop();
+    if (pending == nullptr) {
+      break;
     }
+    SearchBatch(&thread->state);
+    pending->DecrementCount();
   }
+}
 
-  return absl::MakeConstSpan(leaves_);
+void MctsPlayer::DeleteDetachedNodes(std::vector<MctsNode*>* roots) {
+  if (roots->empty()) {
+    return;
+  }
+  if (reclaim_thread_.joinable()) {
+    reclaim_queue_.Push(std::move(*roots));
+  } else {
+    MctsNode::DeleteSubtrees(*roots, false);
+  }
+  roots->clear();
+}
+
+void MctsPlayer::RunReclaimThread() {
+  for (;;) {
+    auto roots = reclaim_queue_.Pop();
+    if (roots.empty()) {
+      break;
+    }
+    MctsNode::DeleteSubtrees(roots, true);
+  }
+}
+
+int MctsPlayer::CountTreeNodes() const {
+  // Every node in the pools is either in the tree below the root, or is one of
+  // the root's ancestors, each of which has been pruned down to one child. The
+  // count also includes any detached nodes that the reclaim thread hasn't
+  // deleted yet, in which case EvictSubtrees may find it has nothing to do.
+  int num_nodes = node_pool_.num_live();
+  for (const auto& thread : search_threads_) {
+    num_nodes += thread->pool.num_live();
+  }
+  return num_nodes - (root_->position.n() - game_root_->position.n());
 }
 
 bool MctsPlayer::ShouldResign() const {
@@ -257,17 +807,24 @@ bool MctsPlayer::PlayMove(Coord c) {
     return true;
   }
 
-  if (!root_->legal_moves[c]) {
+  if (!root_->IsLegalMove(c)) {
     std::cerr << "Move " << c << " is illegal" << std::endl;
     return false;
   }
 
+  FinishPipelinedBatches();
   PushHistory(c);
 
-  root_ = root_->MaybeAddChild(c);
+  root_position_.PlayMove(c);
+  root_ = root_->MaybeAddChild(c, root_position_);
   // Don't need to keep the parent's children around anymore because we'll
-  // never revisit them.
-  root_->parent->PruneChildren(c);
+  // never revisit them. Any links into them from the new root's subtree must
+  // be removed first.
+  if (transpositions_ != nullptr) {
+    transpositions_->Rebuild(root_);
+  }
+  root_->parent->DetachChildren(c, &detached_nodes_);
+  DeleteDetachedNodes(&detached_nodes_);
 
   if (options_.verbose) {
     std::cerr << absl::StreamFormat("%s Q: %0.5f\n", name(), root_->Q());
@@ -275,17 +832,45 @@ bool MctsPlayer::PlayMove(Coord c) {
   }
 
   // Handle consecutive passing.
-  if (root_->position.is_game_over() ||
-      root_->position.n() >= kMaxSearchDepth) {
-    float score = root_->position.CalculateScore(options_.komi);
+  if (root_position_.is_game_over() ||
+      root_position_.n() >= kMaxSearchDepth) {
+    float score = root_position_.CalculateScore(options_.komi);
     result_string_ = FormatScore(score);
     result_ = score < 0 ? -1 : score > 0 ? 1 : 0;
     game_over_ = true;
+  } else if (options_.adjudicate_pass_alive) {
+    float score;
+    if (IsResultDecided(&score)) {
+      result_string_ = FormatScore(score);
+      result_ = score < 0 ? -1 : 1;
+      game_over_ = true;
+      if (options_.verbose) {
+        std::cerr << "Adjudicated " << result_string_ << std::endl;
+      }
+    }
   }
 
   return true;
 }
 
+bool MctsPlayer::IsResultDecided(float* score) const {
+  auto area = root_position_.CalculatePassAliveArea();
+  int black = area[0].count();
+  int white = area[1].count();
+  int undecided = kN * kN - black - white;
+  float black_min = black - white - undecided - options_.komi;
+  float black_max = black - white + undecided - options_.komi;
+  if (black_min > 0) {
+    *score = black_min;
+    return true;
+  }
+  if (black_max < 0) {
+    *score = black_max;
+    return true;
+  }
+  return false;
+}
+
 std::string MctsPlayer::FormatScore(float score) const {
   return absl::StrFormat("%c+%.1f", score > 0 ? 'B' : 'W', std::abs(score));
 }
@@ -296,6 +881,9 @@ void MctsPlayer::PushHistory(Coord c) {
   history.c = c;
   history.comment = root_->Describe();
   history.node = root_;
+  history.is_full_search = is_full_search_;
+  // Moves that are played without being searched for count as full searches.
+  is_full_search_ = true;
 
   if (!inferences_.empty()) {
     // Record which model(s) were used when running tree search for this move.
@@ -315,14 +903,31 @@ void MctsPlayer::PushHistory(Coord c) {
   }
 
   // Convert child visit counts to a probability distribution, pi.
-  if (root_->position.n() < temperature_cutoff_) {
+  const auto& edges = root_->edges;
+  history.search_pi.fill(0);
+  if (options_.gumbel_root_search && options_.seconds_per_move <= 0) {
+    // The improved policy of a Gumbel search is the softmax of the logits
+    // plus the transformed completed Q-values of all the moves.
+    float max_N = MaxVisits(*root_);
+    float max_logit = -std::numeric_limits<float>::infinity();
+    for (int i = 0; i < edges.size; ++i) {
+      float logit = Logit(*root_, i) + TransformedQ(*root_, i, max_N);
+      history.search_pi[edges.move[i]] = logit;
+      max_logit = std::max(max_logit, logit);
+    }
+    for (int i = 0; i < edges.size; ++i) {
+      auto& pi = history.search_pi[edges.move[i]];
+      pi = std::exp(pi - max_logit);
+    }
+  } else if (root_->position.n() < temperature_cutoff_) {
     // Squash counts before normalizing to match softpick behavior in PickMove.
-    for (int i = 0; i < kNumMoves; ++i) {
-      history.search_pi[i] = std::pow(root_->child_N(i), kVisitCountSquash);
+    for (int i = 0; i < edges.size; ++i) {
+      history.search_pi[edges.move[i]] =
+          std::pow(edges.N[i], kVisitCountSquash);
     }
   } else {
-    for (int i = 0; i < kNumMoves; ++i) {
-      history.search_pi[i] = root_->child_N(i);
+    for (int i = 0; i < edges.size; ++i) {
+      history.search_pi[edges.move[i]] = edges.N[i];
     }
   }
   // Normalize counts.
@@ -337,74 +942,151 @@ void MctsPlayer::PushHistory(Coord c) {
 
 void MctsPlayer::ProcessLeaves(absl::Span<MctsNode*> leaves,
                                bool random_symmetry) {
+  EvaluateLeaves(&search_state_, leaves, {}, random_symmetry);
+  UpdateInferences(search_state_.model, search_state_.num_inferences);
+}
+
+void MctsPlayer::EvaluateLeaves(SearchState* state,
+                                absl::Span<MctsNode*> leaves,
+                                absl::Span<const MctsNode::Path> paths,
+                                bool random_symmetry) {
+  FeaturizeLeaves(state, leaves, paths, random_symmetry);
+  if (state->num_inferences != 0) {
+    RunInference(state);
+    IncorporateOutputs(state, leaves, paths);
+  }
+}
+
+void MctsPlayer::IncorporateOutput(absl::Span<MctsNode*> leaves,
+                                   absl::Span<const MctsNode::Path> paths,
+                                   size_t i, const DualNet::Output& output) {
+  if (paths.empty()) {
+    leaves[i]->IncorporateResults(output.policy, output.value, root_);
+  } else {
+    leaves[i]->IncorporateResultsAndRevertVirtualLoss(
+        output.policy, output.value, paths[i]);
+  }
+}
+
+void MctsPlayer::FeaturizeLeaves(SearchState* state,
+                                 absl::Span<MctsNode*> leaves,
+                                 absl::Span<const MctsNode::Path> paths,
+                                 bool random_symmetry) {
+  // Incorporate the outputs that are already cached, and find the leaves that
+  // still need to run inference.
+  auto& indices = state->inference_indices;
+  indices.resize(0);
+  if (inference_cache_ != nullptr) {
+    DualNet::Output output;
+    for (size_t i = 0; i < leaves.size(); ++i) {
+      if (inference_cache_->TryGet(leaves[i]->history_hash, &output)) {
+        IncorporateOutput(leaves, paths, i, output);
+      } else {
+        indices.push_back(i);
+      }
+    }
+  } else {
+    for (size_t i = 0; i < leaves.size(); ++i) {
+      indices.push_back(i);
+    }
+  }
+  state->num_inferences = indices.size();
+  if (indices.empty()) {
+    return;
+  }
+
   // Select symmetry operations to apply.
-  symmetries_used_.resize(0);
+  auto& symmetries_used = state->symmetries_used;
+  symmetries_used.resize(0);
   if (random_symmetry) {
-    symmetries_used_.reserve(leaves.size());
-    for (size_t i = 0; i < leaves.size(); ++i) {
-      symmetries_used_.push_back(static_cast<symmetry::Symmetry>(
-          rnd_.UniformInt(0, symmetry::kNumSymmetries - 1)));
+    symmetries_used.reserve(indices.size());
+    for (size_t j = 0; j < indices.size(); ++j) {
+      symmetries_used.push_back(static_cast<symmetry::Symmetry>(
+          state->rnd->UniformInt(0, symmetry::kNumSymmetries - 1)));
     }
   } else {
-    symmetries_used_.resize(leaves.size(), symmetry::kIdentity);
+    symmetries_used.resize(indices.size(), symmetry::kIdentity);
   }
 
   // Build input features for each leaf, applying random symmetries if
   // requested.
   DualNet::BoardFeatures raw_features;
-  features_.resize(leaves.size());
-  for (size_t i = 0; i < leaves.size(); ++i) {
-    leaves[i]->GetMoveHistory(DualNet::kMoveHistory, &recent_positions_);
-    DualNet::SetFeatures(recent_positions_, leaves[i]->position.to_play(),
+  auto& features = state->features;
+  features.resize(indices.size());
+  for (size_t j = 0; j < indices.size(); ++j) {
+    const auto* leaf = leaves[indices[j]];
+    leaf->GetMoveHistory(DualNet::kMoveHistory, &state->recent_positions);
+    DualNet::SetFeatures(state->recent_positions, leaf->position.to_play(),
                          &raw_features);
     if (network_->GetInputLayout() == DualNet::InputLayout::kNCHW) {
       using OutIter =
           symmetry::NchwOutputIterator<kN, DualNet::kNumStoneFeatures, float>;
       symmetry::ApplySymmetry<kN, DualNet::kNumStoneFeatures>(
-          symmetries_used_[i], raw_features.data(),
-          OutIter(features_[i].data()));
+          symmetries_used[j], raw_features.data(),
+          OutIter(features[j].data()));
     } else {
       symmetry::ApplySymmetry<kN, DualNet::kNumStoneFeatures>(
-          symmetries_used_[i], raw_features.data(), features_[i].data());
+          symmetries_used[j], raw_features.data(), features[j].data());
     }
   }
+}
 
+void MctsPlayer::RunInference(SearchState* state) {
+  const auto& features = state->features;
   std::vector<const DualNet::BoardFeatures*> feature_ptrs;
-  feature_ptrs.reserve(features_.size());
-  for (const auto& feature : features_) {
+  feature_ptrs.reserve(features.size());
+  for (const auto& feature : features) {
     feature_ptrs.push_back(&feature);
   }
 
-  outputs_.resize(leaves.size());
+  auto& outputs = state->outputs;
+  outputs.resize(features.size());
   std::vector<DualNet::Output*> output_ptrs;
-  output_ptrs.reserve(outputs_.size());
-  for (auto& output : outputs_) {
+  output_ptrs.reserve(outputs.size());
+  for (auto& output : outputs) {
     output_ptrs.push_back(&output);
   }
 
   // Run inference.
-  network_->RunMany(std::move(feature_ptrs), std::move(output_ptrs), &model_);
+  network_->RunMany(std::move(feature_ptrs), std::move(output_ptrs),
+                    &state->model);
+}
 
-  // Record some information about the inference.
-  if (!model_.empty()) {
-    if (inferences_.empty() || model_ != inferences_.back().model) {
-      inferences_.emplace_back(model_, root_->position.n());
+void MctsPlayer::IncorporateOutputs(SearchState* state,
+                                    absl::Span<MctsNode*> leaves,
+                                    absl::Span<const MctsNode::Path> paths) {
+  const auto& indices = state->inference_indices;
+  const auto& symmetries_used = state->symmetries_used;
+  const auto& outputs = state->outputs;
+
+  // Incorporate the inference outputs back into tree search, undoing any
+  // previously applied random symmetries, and add them to the cache.
+  DualNet::Output raw_output;
+  for (size_t j = 0; j < indices.size(); ++j) {
+    const auto& output = outputs[j];
+    symmetry::ApplySymmetry<kN, 1>(symmetry::Inverse(symmetries_used[j]),
+                                   output.policy.data(),
+                                   raw_output.policy.data());
+    raw_output.policy[Coord::kPass] = output.policy[Coord::kPass];
+    raw_output.value = output.value;
+    IncorporateOutput(leaves, paths, indices[j], raw_output);
+    if (inference_cache_ != nullptr) {
+      inference_cache_->Add(leaves[indices[j]]->history_hash, raw_output);
     }
-    inferences_.back().last_move = root_->position.n();
-    inferences_.back().total_count += leaves.size();
   }
+}
 
-  // Incorporate the inference outputs back into tree search, undoing any
-  // previously applied random symmetries.
-  std::array<float, kNumMoves> raw_policy;
-  for (size_t i = 0; i < leaves.size(); ++i) {
-    MctsNode* leaf = leaves[i];
-    const auto& output = outputs_[i];
-    symmetry::ApplySymmetry<kN, 1>(symmetry::Inverse(symmetries_used_[i]),
-                                   output.policy.data(), raw_policy.data());
-    raw_policy[Coord::kPass] = output.policy[Coord::kPass];
-    leaf->IncorporateResults(raw_policy, output.value, root_);
+void MctsPlayer::UpdateInferences(const std::string& model,
+                                  size_t num_leaves) {
+  // Record some information about the inference.
+  if (num_leaves == 0 || model.empty()) {
+    return;
+  }
+  if (inferences_.empty() || model != inferences_.back().model) {
+    inferences_.emplace_back(model, root_->position.n());
   }
+  inferences_.back().last_move = root_->position.n();
+  inferences_.back().total_count += num_leaves;
 }
 
 }  // namespace minigo
@@ -20,18 +20,22 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "absl/memory/memory.h"
+#include "absl/synchronization/blocking_counter.h"
 #include "absl/time/time.h"
 #include "absl/types/span.h"
 #include "cc/algorithm.h"
 #include "cc/constants.h"
 #include "cc/dual_net/dual_net.h"
+#include "cc/inference_cache.h"
 #include "cc/mcts_node.h"
 #include "cc/position.h"
 #include "cc/random.h"
 #include "cc/symmetries.h"
+#include "cc/thread_safe_queue.h"
 
 namespace minigo {
 
@@ -53,8 +57,47 @@ class MctsPlayer {
     // incorrectly resigned early, had resignations been enabled.
     bool resign_enabled = true;
 
+    // If true, the game ends as soon as the result is decided by the
+    // pass-alive area of each player (see Position::CalculatePassAliveArea),
+    // even if the points that are still undecided all go to the loser.
+    bool adjudicate_pass_alive = false;
+
     // TODO(tommadams): rename batch_size to virtual_losses.
     int batch_size = 8;
+
+    // Number of threads that search the tree in parallel. Each call to
+    // TreeSearch selects up to batch_size leaves on every thread, and the
+    // threads run inference on their leaves concurrently, so the network must
+    // support concurrent calls to RunMany if num_search_threads > 1.
+    int num_search_threads = 1;
+
+    // Number of batches that the player's thread pipelines. If greater than 1,
+    // TreeSearch selects & featurizes a batch while the batches selected by
+    // earlier calls are still running inference on other threads, and
+    // incorporates their results once they have finished. Up to
+    // pipeline_depth calls to RunMany can be in flight at once, so the network
+    // must support concurrent calls to it. A good value is the network's
+    // GetBufferCount().
+    int pipeline_depth = 1;
+
+    // If true, positions that are reached by more than one sequence of moves
+    // during a search share a single node in the tree, which then becomes a
+    // DAG. See MctsNode::TranspositionTable.
+    bool use_transposition_table = false;
+
+    // If non-zero, the maximum number of nodes in the search tree below the
+    // root. Once the tree grows past this, TreeSearch evicts the subtrees with
+    // the fewest visits until the tree is back down to three quarters of the
+    // limit, keeping the stats of the edges that led to them. This bounds the
+    // memory used by long searches, for example while pondering.
+    int max_tree_nodes = 0;
+
+    // If true, the subtrees that are removed from the tree, when a move is
+    // played, nodes are evicted or a new game is started, are deleted by a
+    // background thread. Freeing a large tree then doesn't delay the next
+    // search.
+    bool reclaim_nodes_in_background = true;
+
     float komi = kDefaultKomi;
     std::string name = "minigo";
 
@@ -65,6 +108,32 @@ class MctsPlayer {
     // Number of readouts to perform (ignored if seconds_per_move is non-zero).
     int num_readouts = 0;
 
+    // If non-zero, playout cap randomization is enabled: the search for each
+    // move is a full search of num_readouts with probability
+    // full_search_probability, and a fast search of fast_readouts without
+    // noise otherwise. Only the positions that were searched in full are
+    // training targets (see History::is_full_search). Ignored if
+    // seconds_per_move is non-zero.
+    int fast_readouts = 0;
+    float full_search_probability = 0.25;
+
+    // If true, the root of each search uses Gumbel sequential halving instead
+    // of PUCT & Dirichlet noise, which makes much better use of a small number
+    // of readouts. gumbel_num_sampled_actions moves are sampled without
+    // replacement from the root's policy by adding Gumbel noise to its logits
+    // and taking the top ones, and the readouts are split evenly between them
+    // over rounds that each halve the number of candidates, keeping the ones
+    // with the best noisy logit plus transformed Q-value. Nodes below the root
+    // are still selected by PUCT. The move played is the best candidate left,
+    // and the training target is the root's policy improved by the completed
+    // Q-values of its moves (see History::search_pi) instead of the visit
+    // counts. The Gumbel noise is only added if inject_noise is true, and
+    // early_termination doesn't apply to these searches. Requires
+    // num_search_threads and pipeline_depth to be 1, and is ignored if
+    // seconds_per_move is non-zero.
+    bool gumbel_root_search = false;
+    int gumbel_num_sampled_actions = 16;
+
     // If non-zero, the number of seconds to spend thinking about each move
     // instead of using a fixed number of readouts.
     float seconds_per_move = 0;
@@ -78,6 +147,15 @@ class MctsPlayer {
     // of time spent thinking as the game progresses.
     float decay_factor = 0.98;
 
+    // If true, the search for a move stops as soon as the most visited move at
+    // the root can't be overtaken in the readouts that are left, or in the
+    // readouts expected to fit in the time that's left. If time_limit is also
+    // non-zero, a search whose best move is unstable can run past its
+    // recommended time, using up to half of the time that earlier searches
+    // saved. This changes the distribution of visits that training targets
+    // are made from, so it's meant for evaluation & GTP play.
+    bool early_termination = false;
+
     // If true, print debug info to stderr.
     bool verbose = true;
 
@@ -85,10 +163,16 @@ class MctsPlayer {
   };
 
   struct History {
+    // The search policy: the root's normalized visit counts, or its improved
+    // policy if options.gumbel_root_search is true.
     std::array<float, kNumMoves> search_pi;
     Coord c = Coord::kPass;
     std::string comment;
     const MctsNode* node = nullptr;
+
+    // False if the move was chosen by a fast search, in which case search_pi
+    // isn't used as a training target.
+    bool is_full_search = true;
   };
 
   // State that tracks which model is used for each inference.
@@ -116,7 +200,12 @@ class MctsPlayer {
   // If position is non-null, the player will be initilized with that board
   // state. Otherwise, the player is initialized with an empty board with black
   // to play.
-  MctsPlayer(std::unique_ptr<DualNet> network, const Options& options);
+  // If inference_cache is non-null, the outputs of network are looked up in it
+  // before running inference, and added to it afterwards. The cache may be
+  // shared with other players that use the same model.
+  MctsPlayer(std::unique_ptr<DualNet> network,
+             std::shared_ptr<InferenceCache> inference_cache,
+             const Options& options);
 
   virtual ~MctsPlayer();
 
@@ -126,6 +215,32 @@ class MctsPlayer {
 
   virtual Coord SuggestMove();
 
+  // The following methods search for a move without blocking on inference,
+  // so that a single thread can interleave the searches of many players and
+  // run inference on all their leaves in one batch. They're used instead of
+  // SuggestMove:
+  //
+  //   while (player->SelectLeavesForInference(&features, &outputs)) {
+  //     network->RunMany(features, outputs, &model);
+  //     player->IncorporateInferenceResults(model);
+  //   }
+  //   player->PlayMove(player->FinishSearch());
+  //
+  // SelectLeavesForInference selects a batch of leaves, and appends their
+  // features & the outputs to write their results to, which belong to the
+  // player and stay valid until IncorporateInferenceResults is called. It
+  // returns false once the search for the current move is finished.
+  bool SelectLeavesForInference(
+      std::vector<const DualNet::BoardFeatures*>* features,
+      std::vector<DualNet::Output*>* outputs);
+
+  // Incorporates the outputs of the leaves that the last call to
+  // SelectLeavesForInference selected, which were computed by model.
+  void IncorporateInferenceResults(const std::string& model);
+
+  // Returns the move to play once the search for it is finished.
+  Coord FinishSearch();
+
   bool PlayMove(Coord c);
 
   bool ShouldResign() const;
@@ -136,6 +251,9 @@ class MctsPlayer {
   MctsNode* root() { return root_; }
   const MctsNode* root() const { return root_; }
 
+  // Returns the full board position of the root node.
+  const Position& root_position() const { return root_position_; }
+
   // Returns true if the game is over, either because both players passed, one
   // player resigned, or the game reached the maximum number of allowed moves.
   bool game_over() const { return game_over_; }
@@ -169,11 +287,19 @@ class MctsPlayer {
 
   // Returns the list of nodes that TreeSearch performed inference on.
   // The contents of the returned Span is valid until the next call TreeSearch.
+  // If options_.pipeline_depth > 1, these are the leaves of the batches whose
+  // inference finished during the call, and the batches that are still in
+  // flight keep a virtual loss on their leaves until FinishPipelinedBatches.
   virtual absl::Span<MctsNode* const> TreeSearch();
 
+  // Waits for all the batches that TreeSearch has pipelined and incorporates
+  // their results. PlayMove, SuggestMove & starting a new game do this
+  // themselves.
+  void FinishPipelinedBatches();
+
   // Returns the root of the game tree.
-  MctsNode* game_root() { return &game_root_; }
-  const MctsNode* game_root() const { return &game_root_; }
+  MctsNode* game_root() { return game_root_; }
+  const MctsNode* game_root() const { return game_root_; }
 
   Random* rnd() { return &rnd_; }
 
@@ -185,19 +311,201 @@ class MctsPlayer {
   void ProcessLeaves(absl::Span<MctsNode*> leaves, bool random_symmetry);
 
  private:
+  // State used by a thread to select leaves & run inference on them.
+  struct SearchState {
+    SearchState(Position* position, UndoJournal* journal, MctsNode::Pool* pool,
+                Random* rnd)
+        : position(position), journal(journal), pool(pool), rnd(rnd) {}
+
+    // Scratch position that's used to walk down the tree from the root.
+    Position* position;
+    UndoJournal* journal;
+
+    // Pool that new nodes are allocated from.
+    MctsNode::Pool* pool;
+
+    // Used to choose the symmetries to apply to the inference features.
+    Random* rnd;
+
+    // Leaves that the last call to SearchBatch ran inference on, and the paths
+    // that were taken to them.
+    std::vector<MctsNode*> leaves;
+    std::vector<MctsNode::Path> paths;
+
+    // Model name returned from the last call to RunMany, and the number of
+    // leaves that the last call to EvaluateLeaves ran inference on, i.e. the
+    // ones that weren't found in the inference cache.
+    std::string model;
+    size_t num_inferences = 0;
+
+    // Vectors reused when running inference.
+    std::vector<DualNet::BoardFeatures> features;
+    std::vector<DualNet::Output> outputs;
+    std::vector<symmetry::Symmetry> symmetries_used;
+    std::vector<const PackedPosition*> recent_positions;
+    std::vector<size_t> inference_indices;
+  };
+
+  // A thread that runs a batch of tree search alongside the player's own
+  // thread for each call to TreeSearch, when num_search_threads > 1. Each
+  // thread has its own scratch position & node pool.
+  struct SearchThread {
+    explicit SearchThread(uint64_t seed)
+        : position(&bv, &gv, Color::kBlack),
+          rnd(seed),
+          state(&position, &journal, &pool, &rnd) {}
+
+    BoardVisitor bv;
+    GroupVisitor gv;
+    Position position;
+    UndoJournal journal;
+    MctsNode::Pool pool;
+    Random rnd;
+    SearchState state;
+
+    // TreeSearch pushes a counter for the thread to decrement once it has run
+    // a batch. A null counter tells the thread to exit.
+    ThreadSafeQueue<absl::BlockingCounter*> requests;
+    std::thread thread;
+  };
+
+  // Injects noise into the root & sets up the limits of the search for the
+  // current move, which started at start_time.
+  void StartSearch(absl::Time start_time);
+
+  // Returns true once the search started by StartSearch has reached its
+  // limits, or the best move is decided if options_.early_termination is true.
+  // Leaves that are still in flight aren't counted.
+  bool IsSearchFinished() const;
+
+  // Returns true if the most visited move at the root can't be overtaken by
+  // the second most visited one in num_readouts more readouts.
+  bool IsBestMoveDecided(float num_readouts) const;
+
+  // Returns true if the second most visited move at the root has a better
+  // action value than the most visited one.
+  bool IsBestMoveUnstable() const;
+
+  // Samples the candidate moves of a Gumbel root search with a budget of
+  // num_readouts, and schedules the visits of its first round.
+  void StartGumbelSearch(int num_readouts);
+
+  // Halves the candidates of a Gumbel root search at the end of a round, and
+  // schedules the visits of the next one.
+  void StartNextGumbelRound();
+
+  // Schedules a round of visits to the candidates of a Gumbel root search.
+  void ScheduleGumbelRound();
+
+  // Returns the score that a Gumbel root search ranks root edge i by: its
+  // noisy logit plus its transformed completed Q-value, where max_N is the
+  // visit count of the root's most visited edge.
+  float GumbelScore(int i, float max_N) const;
+
+  // Evicts subtrees if the tree has grown past options_.max_tree_nodes.
+  void MaybeEvictSubtrees();
+
+  // Selects up to options_.batch_size leaves, runs inference on them &
+  // incorporates the results. It's safe to call SearchBatch from multiple
+  // threads at once, with different states.
+  void SearchBatch(SearchState* state);
+
+  // Selects up to options_.batch_size leaves into state->leaves, with a virtual
+  // loss along each of state->paths. Leaves that end the game are
+  // incorporated straight away. During a Gumbel root search, each leaf is
+  // selected through the next scheduled root edge, and a batch stops at the
+  // end of a round.
+  void SelectLeaves(SearchState* state);
+
+  // Selects a batch into a free pipelined state & starts running inference on
+  // it, after incorporating the results of any batches that have finished.
+  void PipelineBatch();
+
+  // Incorporates the results of a pipelined batch whose inference has
+  // finished, and frees its state.
+  void FinishPipelinedBatch(SearchState* state);
+
+  void RunInferenceThread();
+
+  void RunSearchThread(SearchThread* thread);
+
+  // Same as ProcessLeaves, using the buffers in state. This doesn't update
+  // inferences_, so it's safe to call from multiple threads at once. If paths
+  // is non-empty, leaves[i] must have a virtual loss along paths[i], which is
+  // reverted in the same pass that backs up its results.
+  // Leaves whose outputs are in the inference cache are incorporated without
+  // running inference on them.
+  void EvaluateLeaves(SearchState* state, absl::Span<MctsNode*> leaves,
+                      absl::Span<const MctsNode::Path> paths,
+                      bool random_symmetry);
+
+  // The three stages of EvaluateLeaves. FeaturizeLeaves incorporates the
+  // cached leaves and sets state->num_inferences to the number of features it
+  // built for the others. RunInference only touches state's buffers, so it
+  // can run on another thread while the tree is searched.
+  void FeaturizeLeaves(SearchState* state, absl::Span<MctsNode*> leaves,
+                       absl::Span<const MctsNode::Path> paths,
+                       bool random_symmetry);
+  void RunInference(SearchState* state);
+  void IncorporateOutputs(SearchState* state, absl::Span<MctsNode*> leaves,
+                          absl::Span<const MctsNode::Path> paths);
+
+  // Incorporates the output for leaves[i], reverting the virtual loss along
+  // paths[i] if paths is non-empty.
+  void IncorporateOutput(absl::Span<MctsNode*> leaves,
+                         absl::Span<const MctsNode::Path> paths, size_t i,
+                         const DualNet::Output& output);
+
+  // Returns the number of nodes in the search tree below the root, including
+  // the root itself. This is cheap to calculate from the node pools.
+  int CountTreeNodes() const;
+
+  // Deletes subtrees that have been detached from the tree, on the reclaim
+  // thread if there is one, and clears roots.
+  void DeleteDetachedNodes(std::vector<MctsNode*>* roots);
+
+  void RunReclaimThread();
+
+  // Records that model was used to run inference on num_leaves leaves.
+  void UpdateInferences(const std::string& model, size_t num_leaves);
+
   void PushHistory(Coord c);
 
+  // Replaces the game tree with a new one whose root is at position.
+  void ResetTree(const Position& position);
+
+  // Returns true if the result of the game is decided by the pass-alive area
+  // of each player, in which case score is set to the winner's guaranteed
+  // margin of victory: the score from B perspective if all the undecided
+  // points go to the loser.
+  bool IsResultDecided(float* score) const;
+
   std::unique_ptr<DualNet> network_;
+  std::shared_ptr<InferenceCache> inference_cache_;
   int temperature_cutoff_;
 
   MctsNode::EdgeStats dummy_stats_;
 
-  MctsNode* root_;
-  MctsNode game_root_;
+  // Pool that all the nodes of the game tree are allocated from. The pool
+  // keeps the memory of nodes that are pruned from the tree, and of previous
+  // games' trees, for reuse by later searches.
+  MctsNode::Pool node_pool_;
+
+  MctsNode* root_ = nullptr;
+  MctsNode* game_root_ = nullptr;
+
+  // Null unless options_.use_transposition_table is true.
+  std::unique_ptr<MctsNode::TranspositionTable> transpositions_;
 
   BoardVisitor bv_;
   GroupVisitor gv_;
 
+  // Full board position of the root node. TreeSearch plays moves on it while
+  // walking down the tree, and uses the journal to walk back up again, so the
+  // tree's nodes only need to store PackedPositions.
+  Position root_position_;
+  UndoJournal undo_journal_;
+
   Random rnd_;
 
   Options options_;
@@ -208,15 +516,76 @@ class MctsPlayer {
 
   std::vector<History> history_;
 
-  std::string model_;
   std::vector<InferenceInfo> inferences_;
 
-  // Vectors reused when running TreeSearch.
+  // Search state of the player's own thread, which searches using
+  // root_position_ and node_pool_.
+  SearchState search_state_;
+
+  // The other threads that search the tree, if num_search_threads > 1.
+  std::vector<std::unique_ptr<SearchThread>> search_threads_;
+
+  // Leaves that the last call to TreeSearch ran inference on, from all threads.
   std::vector<MctsNode*> leaves_;
-  std::vector<DualNet::BoardFeatures> features_;
-  std::vector<DualNet::Output> outputs_;
-  std::vector<symmetry::Symmetry> symmetries_used_;
-  std::vector<const Position::Stones*> recent_positions_;
+
+  // If options_.pipeline_depth > 1, the states of the batches that TreeSearch
+  // pipelines, and the threads that run inference on them. The player's thread
+  // selects a batch into a free state & pushes it onto inference_queue_. An
+  // inference thread pops it, runs inference & pushes it onto finished_queue_,
+  // for the player's thread to incorporate. A null state tells an inference
+  // thread to exit. Only the player's thread touches the tree, so the tree
+  // never changes between calls to TreeSearch.
+  std::vector<std::unique_ptr<SearchState>> pipelined_states_;
+  std::vector<SearchState*> free_states_;
+  ThreadSafeQueue<SearchState*> inference_queue_;
+  ThreadSafeQueue<SearchState*> finished_queue_;
+  std::vector<std::thread> inference_threads_;
+
+  // Number of leaves whose inference is in flight.
+  int num_pipelined_leaves_ = 0;
+
+  // Limits of the search for the current move, set by StartSearch. The search
+  // is limited by search_duration_ if it's non-zero, and by target_readouts_
+  // otherwise. While the best move is unstable, a search that's limited by
+  // time can run on for up to max_search_duration_, which is the same as
+  // search_duration_ unless options_.early_termination is true.
+  bool search_started_ = false;
+  bool is_full_search_ = true;
+  absl::Time search_start_time_;
+  absl::Duration search_duration_;
+  absl::Duration max_search_duration_;
+  int search_start_readouts_ = 0;
+  int target_readouts_ = 0;
+
+  // State of the Gumbel root search for the current move, if
+  // options_.gumbel_root_search is true. The candidates are the indices of the
+  // root edges that are left, and are empty unless a Gumbel search is in
+  // progress. The schedule holds the root edges to select the rest of the
+  // round's leaves through, in reverse order. The logits are the noisy logits
+  // of all the root edges.
+  std::vector<int> gumbel_candidates_;
+  std::vector<int> gumbel_schedule_;
+  std::vector<float> gumbel_logits_;
+  int gumbel_num_readouts_ = 0;
+  int gumbel_num_rounds_ = 0;
+
+  // The total time that the searches of the current game have taken, and the
+  // total time that TimeRecommendation allotted to them. If
+  // options_.early_termination is true, half of the time saved on earlier
+  // moves can be spent on a move whose best move is unstable.
+  absl::Duration game_search_time_;
+  absl::Duration game_recommended_time_;
+
+  // If options_.reclaim_nodes_in_background is true, the thread that deletes
+  // detached subtrees, and the queue of batches of subtrees for it to delete.
+  // An empty batch tells the thread to exit. Batches are deleted in the order
+  // they were detached, so any links from a batch's subtrees lead to nodes that
+  // are still alive.
+  ThreadSafeQueue<std::vector<MctsNode*>> reclaim_queue_;
+  std::thread reclaim_thread_;
+
+  // Reused by PlayMove & TreeSearch to collect the subtrees they detach.
+  std::vector<MctsNode*> detached_nodes_;
 };
 
 }  // namespace minigo
@@ -14,10 +14,14 @@
 
 #include "cc/mcts_player.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <utility>
 #include "absl/memory/memory.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "cc/algorithm.h"
 #include "cc/color.h"
 #include "cc/constants.h"
@@ -43,19 +47,21 @@ static constexpr char kAlmostDoneBoard[] = R"(
 class TestablePlayer : public MctsPlayer {
  public:
   explicit TestablePlayer(const Options& options)
-      : MctsPlayer(absl::make_unique<FakeDualNet>(), options) {}
+      : MctsPlayer(absl::make_unique<FakeDualNet>(), nullptr, options) {}
 
   explicit TestablePlayer(std::unique_ptr<DualNet> network,
                           const Options& options)
-      : MctsPlayer(std::move(network), options) {}
+      : MctsPlayer(std::move(network), nullptr, options) {}
 
   TestablePlayer(absl::Span<const float> fake_priors, float fake_value,
                  const Options& options)
       : MctsPlayer(absl::make_unique<FakeDualNet>(fake_priors, fake_value),
-                   options) {}
+                   nullptr, options) {}
 
   using MctsPlayer::PickMove;
   using MctsPlayer::PlayMove;
+  using MctsPlayer::FinishPipelinedBatches;
+  using MctsPlayer::mutable_options;
   using MctsPlayer::ProcessLeaves;
   using MctsPlayer::rnd;
   using MctsPlayer::TreeSearch;
@@ -85,8 +91,8 @@ std::unique_ptr<TestablePlayer> CreateBasicPlayer(MctsPlayer::Options options) {
   auto player = absl::make_unique<TestablePlayer>(options);
   auto* first_node = player->root()->SelectLeaf();
   DualNet::BoardFeatures features;
-  std::vector<const Position::Stones*> positions = {
-      &player->root()->position.stones()};
+  auto stones = player->root_position().stones();
+  std::vector<const Position::Stones*> positions = {&stones};
   DualNet::SetFeatures(positions, Color::kBlack, &features);
   auto output = player->Run(features);
   first_node->IncorporateResults(output.policy, output.value, player->root());
@@ -164,8 +170,8 @@ TEST(MctsPlayerTest, InjectNoise) {
   EXPECT_NEAR(1, sum_P, 0.000001);
 
   // With Dirichelet noise, majority of density should be in one node.
-  int i = ArgMax(root->edges, MctsNode::CmpP);
-  float max_P = root->child_P(i);
+  const auto& edges = root->edges;
+  float max_P = edges.P[ArgMax(absl::MakeConstSpan(edges.P, edges.size))];
   EXPECT_GT(max_P, 3.0 / kNumMoves);
 }
 
@@ -177,9 +183,9 @@ TEST(MctsPlayerTest, PickMoveArgMax) {
   auto player = CreateBasicPlayer(options);
   auto* root = player->root();
 
-  root->edges[Coord(2, 0)].N = 10;
-  root->edges[Coord(1, 0)].N = 5;
-  root->edges[Coord(3, 0)].N = 1;
+  root->edges.N[root->FindEdge(Coord(2, 0))] = 10;
+  root->edges.N[root->FindEdge(Coord(1, 0))] = 5;
+  root->edges.N[root->FindEdge(Coord(3, 0))] = 1;
 
   for (int i = 0; i < 100; ++i) {
     EXPECT_EQ(Coord(2, 0), player->PickMove());
@@ -194,9 +200,9 @@ TEST(MctsPlayerTest, PickMoveSoft) {
   auto player = CreateBasicPlayer(options);
   auto* root = player->root();
 
-  root->edges[Coord(2, 0)].N = 10;
-  root->edges[Coord(1, 0)].N = 5;
-  root->edges[Coord(3, 0)].N = 1;
+  root->edges.N[root->FindEdge(Coord(2, 0))] = 10;
+  root->edges.N[root->FindEdge(Coord(1, 0))] = 5;
+  root->edges.N[root->FindEdge(Coord(3, 0))] = 1;
 
   int count_1_0 = 0;
   int count_2_0 = 0;
@@ -220,14 +226,17 @@ TEST(MctsPlayerTest, PickMoveSoft) {
 TEST(MctsPlayerTest, DontPassIfLosing) {
   auto player = CreateAlmostDonePlayer(0);
   auto* root = player->root();
-  EXPECT_EQ(-0.5, root->position.CalculateScore(player->options().komi));
+  EXPECT_EQ(-0.5,
+            player->root_position().CalculateScore(player->options().komi));
 
   for (int i = 0; i < 20; ++i) {
     player->TreeSearch(1);
   }
 
   // Search should converge on D9 as only winning move.
-  auto best_move = ArgMax(root->edges, MctsNode::CmpN);
+  const auto& edges = root->edges;
+  auto best_move =
+      edges.move[ArgMax(absl::MakeConstSpan(edges.N, edges.size))];
   ASSERT_EQ(Coord::FromKgs("D9"), best_move);
   // D9 should have a positive value.
   EXPECT_LT(0, root->child_Q(best_move));
@@ -252,7 +261,9 @@ TEST(MctsPlayerTest, ParallelTreeSearch) {
   }
 
   // Search should converge on D9 as only winning move.
-  auto best_move = ArgMax(root->edges, MctsNode::CmpN);
+  const auto& edges = root->edges;
+  auto best_move =
+      edges.move[ArgMax(absl::MakeConstSpan(edges.N, edges.size))];
   EXPECT_EQ(Coord::FromString("D9"), best_move);
   // D9 should have a positive value.
   EXPECT_LT(0, root->child_Q(best_move));
@@ -278,6 +289,429 @@ TEST(MctsPlayerTest, RidiculouslyParallelTreeSearch) {
   EXPECT_EQ(0, CountPendingVirtualLosses(root));
 }
 
+// Checks that the visit count of each expanded node in the tree is one more
+// than the sum of its edges' visit counts: one for the node's own evaluation,
+// and one for each evaluation of a leaf below it.
+void CheckVisitCounts(const MctsNode* node) {
+  if (!node->is_expanded) {
+    return;
+  }
+  const auto& edges = node->edges;
+  float sum = 0;
+  for (int i = 0; i < edges.size; ++i) {
+    sum += edges.N[i];
+    if (edges.child[i] != nullptr) {
+      CheckVisitCounts(edges.child[i]);
+    }
+  }
+  EXPECT_EQ(node->N(), 1 + sum);
+}
+
+TEST(MctsPlayerTest, MultiThreadedTreeSearch) {
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.num_search_threads = 4;
+  options.num_readouts = 200;
+  options.verbose = false;
+  auto player =
+      absl::make_unique<TestablePlayer>(absl::Span<const float>(), 0, options);
+
+  for (int i = 0; i < 4; ++i) {
+    int readouts = player->root()->N();
+    auto c = player->SuggestMove();
+    EXPECT_LE(readouts + options.num_readouts, player->root()->N());
+    EXPECT_EQ(0, CountPendingVirtualLosses(player->root()));
+    CheckVisitCounts(player->root());
+    ASSERT_TRUE(player->PlayMove(c));
+  }
+
+  // Every leaf that the threads ran inference on should have been counted.
+  ASSERT_EQ(1, player->inferences().size());
+  EXPECT_LE(4 * options.num_readouts, player->inferences()[0].total_count);
+}
+
+TEST(MctsPlayerTest, TranspositionTable) {
+  // Only allow a few moves, so that the search finds many transpositions.
+  std::vector<float> priors(kNumMoves, 0);
+  for (const auto* move : {"A1", "C1", "E1", "G1", "J1", "A9", "C9", "E9"}) {
+    priors[Coord::FromKgs(move)] = 1;
+  }
+
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.inject_noise = false;
+  options.random_symmetry = false;
+  options.num_search_threads = 2;
+  options.num_readouts = 200;
+  options.use_transposition_table = true;
+  options.verbose = false;
+  auto player = absl::make_unique<TestablePlayer>(priors, 0, options);
+
+  // Playing moves prunes the tree, which must remove the links to the pruned
+  // nodes from the rest of the DAG.
+  for (int i = 0; i < 8; ++i) {
+    int readouts = player->root()->N();
+    auto c = player->SuggestMove();
+    EXPECT_LE(readouts + options.num_readouts, player->root()->N());
+    EXPECT_EQ(0, CountPendingVirtualLosses(player->root()));
+    ASSERT_TRUE(player->PlayMove(c));
+  }
+}
+
+TEST(MctsPlayerTest, MaxTreeNodes) {
+  for (bool use_transposition_table : {false, true}) {
+    MctsPlayer::Options options;
+    options.random_seed = 17;
+    options.num_search_threads = 2;
+    options.use_transposition_table = use_transposition_table;
+    options.num_readouts = 50;
+    options.max_tree_nodes = 100;
+    options.verbose = false;
+    auto player = absl::make_unique<TestablePlayer>(absl::Span<const float>(),
+                                                    0, options);
+
+    for (int i = 0; i < 4; ++i) {
+      auto c = player->SuggestMove();
+      ASSERT_TRUE(player->PlayMove(c));
+      for (int j = 0; j < 20; ++j) {
+        player->TreeSearch(8);
+        // Each search adds at most one node per leaf on each thread.
+        EXPECT_GE(options.max_tree_nodes + 16,
+                  player->root()->CalculateSubtreeSize().num_nodes);
+        EXPECT_EQ(0, CountPendingVirtualLosses(player->root()));
+      }
+    }
+  }
+}
+
+TEST(MctsPlayerTest, InferenceCache) {
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.inject_noise = false;
+  options.random_symmetry = false;
+  options.num_readouts = 100;
+  options.verbose = false;
+  auto cache = std::make_shared<InferenceCache>(10000, 4);
+  auto player = absl::make_unique<MctsPlayer>(
+      absl::make_unique<FakeDualNet>(), cache, options);
+  auto other_player = absl::make_unique<MctsPlayer>(
+      absl::make_unique<FakeDualNet>(), cache, options);
+
+  for (int i = 0; i < 4; ++i) {
+    auto c = player->SuggestMove();
+    EXPECT_EQ(c, other_player->SuggestMove());
+    EXPECT_EQ(player->root()->N(), other_player->root()->N());
+    ASSERT_TRUE(player->PlayMove(c));
+    ASSERT_TRUE(other_player->PlayMove(c));
+  }
+
+  // The other player's searches were the same as the first player's, so all
+  // the positions it evaluated were already in the cache.
+  ASSERT_EQ(1, player->inferences().size());
+  auto num_inferences = player->inferences()[0].total_count;
+  EXPECT_LE(4 * options.num_readouts, num_inferences);
+  EXPECT_TRUE(other_player->inferences().empty());
+  auto stats = cache->GetStats();
+  EXPECT_EQ(num_inferences, stats.size);
+  EXPECT_EQ(num_inferences, stats.num_misses);
+  EXPECT_EQ(num_inferences, stats.num_hits);
+}
+
+// Fake DualNet that records how many calls to RunMany are in flight at once.
+// Each call waits a while for another one to start, so that the calls that
+// can overlap always do.
+class ConcurrencyCountingNet : public FakeDualNet {
+ public:
+  void RunMany(std::vector<const BoardFeatures*> features,
+               std::vector<Output*> outputs, std::string* model) override {
+    {
+      absl::MutexLock lock(&mu_);
+      int num_calls = ++num_calls_;
+      max_num_calls_ = std::max(max_num_calls_, num_calls);
+      mu_.AwaitWithTimeout(
+          absl::Condition(this, &ConcurrencyCountingNet::overlapping),
+          absl::Milliseconds(100));
+    }
+    FakeDualNet::RunMany(std::move(features), std::move(outputs), model);
+    absl::MutexLock lock(&mu_);
+    --num_calls_;
+  }
+
+  int max_num_calls() {
+    absl::MutexLock lock(&mu_);
+    return max_num_calls_;
+  }
+
+ private:
+  bool overlapping() const EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return num_calls_ > 1;
+  }
+
+  absl::Mutex mu_;
+  int num_calls_ GUARDED_BY(mu_) = 0;
+  int max_num_calls_ GUARDED_BY(mu_) = 0;
+};
+
+TEST(MctsPlayerTest, PipelinedTreeSearch) {
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.pipeline_depth = 3;
+  options.num_readouts = 200;
+  options.verbose = false;
+  auto network = absl::make_unique<ConcurrencyCountingNet>();
+  auto* counting_net = network.get();
+  auto player = absl::make_unique<TestablePlayer>(std::move(network), options);
+
+  for (int i = 0; i < 4; ++i) {
+    int readouts = player->root()->N();
+    auto c = player->SuggestMove();
+    EXPECT_LE(readouts + options.num_readouts, player->root()->N());
+    EXPECT_EQ(0, CountPendingVirtualLosses(player->root()));
+    CheckVisitCounts(player->root());
+    ASSERT_TRUE(player->PlayMove(c));
+  }
+
+  // Batches must have been selected while earlier ones were in flight.
+  EXPECT_LE(2, counting_net->max_num_calls());
+  EXPECT_GE(options.pipeline_depth, counting_net->max_num_calls());
+
+  // Batches that are still in flight keep their virtual losses until they're
+  // finished.
+  for (int i = 0; i < 5; ++i) {
+    player->TreeSearch();
+  }
+  EXPECT_LT(0, CountPendingVirtualLosses(player->root()));
+  player->FinishPipelinedBatches();
+  EXPECT_EQ(0, CountPendingVirtualLosses(player->root()));
+  CheckVisitCounts(player->root());
+
+  ASSERT_EQ(1, player->inferences().size());
+  EXPECT_LE(4 * options.num_readouts, player->inferences()[0].total_count);
+}
+
+TEST(MctsPlayerTest, SelectLeavesForInference) {
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.inject_noise = false;
+  options.random_symmetry = false;
+  options.num_readouts = 100;
+  options.verbose = false;
+  auto player = absl::make_unique<TestablePlayer>(options);
+
+  // Search the same game with two players that run inference on their leaves
+  // in the same batch.
+  FakeDualNet network;
+  std::vector<std::unique_ptr<TestablePlayer>> players;
+  for (int i = 0; i < 2; ++i) {
+    players.push_back(absl::make_unique<TestablePlayer>(options));
+  }
+
+  for (int i = 0; i < 4; ++i) {
+    std::vector<const DualNet::BoardFeatures*> features;
+    std::vector<DualNet::Output*> outputs;
+    std::string model;
+    std::vector<TestablePlayer*> searching;
+    for (auto& other : players) {
+      searching.push_back(other.get());
+    }
+    while (!searching.empty()) {
+      features.clear();
+      outputs.clear();
+      for (auto it = searching.begin(); it != searching.end();) {
+        bool selected = (*it)->SelectLeavesForInference(&features, &outputs);
+        it = selected ? it + 1 : searching.erase(it);
+      }
+      network.RunMany(features, outputs, &model);
+      for (auto* other : searching) {
+        other->IncorporateInferenceResults(model);
+      }
+    }
+
+    // The searches must match the one that SuggestMove runs.
+    auto c = player->SuggestMove();
+    for (auto& other : players) {
+      EXPECT_EQ(c, other->FinishSearch());
+      EXPECT_EQ(player->root()->N(), other->root()->N());
+      EXPECT_EQ(0, CountPendingVirtualLosses(other->root()));
+      ASSERT_TRUE(other->PlayMove(c));
+    }
+    ASSERT_TRUE(player->PlayMove(c));
+  }
+
+  for (auto& other : players) {
+    ASSERT_EQ(1, other->inferences().size());
+    EXPECT_EQ(player->inferences()[0].total_count,
+              other->inferences()[0].total_count);
+  }
+}
+
+TEST(MctsPlayerTest, EarlyTermination) {
+  // Make one move much more likely than the others, so that it quickly gets
+  // more visits than the rest of the search could give any other move.
+  std::vector<float> priors(kNumMoves, 0.001);
+  priors[Coord::FromKgs("E5")] = 0.9;
+
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.inject_noise = false;
+  options.soft_pick = false;
+  options.num_readouts = 400;
+  options.verbose = false;
+  auto player = absl::make_unique<TestablePlayer>(priors, 0, options);
+  options.early_termination = true;
+  auto early_player = absl::make_unique<TestablePlayer>(priors, 0, options);
+
+  auto c = player->SuggestMove();
+  EXPECT_EQ(Coord::FromKgs("E5"), c);
+  EXPECT_LE(options.num_readouts, player->root()->N());
+
+  // The early terminating search picks the same move with fewer readouts, and
+  // stops as soon as the move can't be overtaken anymore.
+  EXPECT_EQ(c, early_player->SuggestMove());
+  const auto* root = early_player->root();
+  // The search starts after the root's own evaluation.
+  int readouts_left = 1 + options.num_readouts - root->N();
+  EXPECT_LT(0, readouts_left);
+  float second_N = 0;
+  for (int i = 0; i < root->edges.size; ++i) {
+    if (root->edges.move[i] != c) {
+      second_N = std::max(second_N, root->edges.N[i]);
+    }
+  }
+  // The last batch can have added at most batch_size to the gap and taken as
+  // many readouts from the ones that were left.
+  float gap = root->child_N(c) - second_N;
+  EXPECT_LT(readouts_left, gap);
+  EXPECT_GE(readouts_left + 2 * options.batch_size, gap);
+}
+
+// Checks that a timed search doesn't run past its recommended time to settle an
+// unstable best move unless early termination is enabled.
+TEST(MctsPlayerTest, TimedSearchWithoutEarlyTermination) {
+  std::vector<float> priors(kNumMoves, 0.001);
+  priors[Coord::FromKgs("E5")] = 0.9;
+
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.inject_noise = false;
+  options.soft_pick = false;
+  options.seconds_per_move = 0.8;
+  options.time_limit = 1000;
+  options.early_termination = true;
+  options.verbose = false;
+  auto player = absl::make_unique<TestablePlayer>(priors, 0, options);
+
+  // The first move terminates early, saving a good part of its time.
+  ASSERT_TRUE(player->PlayMove(player->SuggestMove()));
+  player->mutable_options()->early_termination = false;
+  player->mutable_options()->seconds_per_move = 0.2;
+
+  // Make the most visited move at the root much worse than the second, so
+  // that the best move stays unstable for the whole search.
+  auto* root = player->root();
+  if (!root->is_expanded) {
+    player->ProcessLeaves({&root, 1}, false);
+  }
+  float to_play = root->position.to_play() == Color::kBlack ? 1 : -1;
+  int best = root->FindEdge(Coord::FromKgs("A1"));
+  int second = root->FindEdge(Coord::FromKgs("A2"));
+  root->edges.N[best] = 1e6;
+  root->edges.W[best] = -to_play * 1e6;
+  root->edges.N[second] = 1e5;
+  root->edges.W[second] = to_play * 1e5;
+
+  auto start = absl::Now();
+  player->SuggestMove();
+  auto elapsed = absl::ToDoubleSeconds(absl::Now() - start);
+  EXPECT_LE(0.2, elapsed);
+  EXPECT_GT(0.3, elapsed);
+}
+
+TEST(MctsPlayerTest, PlayoutCapRandomization) {
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.num_readouts = 100;
+  options.fast_readouts = 10;
+  options.full_search_probability = 0.5;
+  options.verbose = false;
+  auto player =
+      absl::make_unique<TestablePlayer>(absl::Span<const float>(), 0, options);
+
+  int num_full_searches = 0;
+  for (int i = 0; i < 20; ++i) {
+    int readouts = -player->root()->N();
+    auto c = player->SuggestMove();
+    readouts += player->root()->N();
+    ASSERT_TRUE(player->PlayMove(c));
+    const auto& history = player->history().back();
+    if (history.is_full_search) {
+      EXPECT_LE(options.num_readouts, readouts);
+      num_full_searches += 1;
+    } else {
+      EXPECT_LE(options.fast_readouts, readouts);
+      EXPECT_GT(options.num_readouts, readouts);
+    }
+  }
+  EXPECT_LT(0, num_full_searches);
+  EXPECT_GT(20, num_full_searches);
+}
+
+TEST(MctsPlayerTest, GumbelRootSearch) {
+  MctsPlayer::Options options;
+  options.random_seed = 17;
+  options.num_readouts = 64;
+  options.batch_size = 4;
+  options.gumbel_root_search = true;
+  options.gumbel_num_sampled_actions = 8;
+  options.random_symmetry = false;
+  options.verbose = false;
+
+  // Give the moves different priors, and make passing very unlikely so that
+  // no game ends during the search: every leaf then has the same value.
+  std::array<float, kNumMoves> probs;
+  for (int i = 0; i < kNumMoves; ++i) {
+    probs[i] = 1 + i % 7;
+  }
+  probs[Coord::kPass] = 1e-6;
+  float sum = 0;
+  for (float p : probs) {
+    sum += p;
+  }
+  for (float& p : probs) {
+    p /= sum;
+  }
+
+  auto player = absl::make_unique<TestablePlayer>(probs, 0, options);
+  auto c = player->SuggestMove();
+  const auto* root = player->root();
+  EXPECT_LE(1 + options.num_readouts, root->N());
+  EXPECT_GT(1 + options.num_readouts + options.batch_size, root->N());
+
+  // Only the sampled moves are visited, and the move played is one of the
+  // two candidates of the last round, which are the most visited.
+  int num_visited = 0;
+  float max_N = 0;
+  for (int i = 0; i < root->edges.size; ++i) {
+    num_visited += root->edges.N[i] != 0;
+    max_N = std::max(max_N, root->edges.N[i]);
+  }
+  int num_most_visited = 0;
+  for (int i = 0; i < root->edges.size; ++i) {
+    num_most_visited += root->edges.N[i] == max_N;
+  }
+  EXPECT_EQ(options.gumbel_num_sampled_actions, num_visited);
+  EXPECT_GE(2, num_most_visited);
+  EXPECT_EQ(max_N, root->child_N(c));
+
+  // All the moves have the same completed Q-value, so the improved policy is
+  // the prior.
+  ASSERT_TRUE(player->PlayMove(c));
+  const auto& search_pi = player->history().back().search_pi;
+  for (int i = 0; i < kNumMoves; ++i) {
+    EXPECT_NEAR(probs[i], search_pi[i], 1e-5);
+  }
+}
+
 TEST(MctsPlayerTest, LongGameTreeSearch) {
   auto player = CreateAlmostDonePlayer(kMaxSearchDepth - 2);
   // Test that an almost complete game.
@@ -375,6 +809,33 @@ TEST(MctsPlayerTest, ExtractDataNormalEnd) {
   EXPECT_EQ("W+7.5", player->result_string());
 }
 
+TEST(MctsPlayerTest, AdjudicatePassAlive) {
+  // Black's chain has nine single point eyes, so it's pass-alive and all the
+  // points on the top four rows belong to black. Playing J5 adds nine more
+  // points, which is enough to win by 1.5 even if white gets the rest of the
+  // board.
+  auto board = TestablePosition(R"(
+      .X.X.X.X.
+      XXXXXXXXX
+      X.X.X.X.X
+      XXXXXXXXX
+      XXXXXXXX.)");
+
+  for (bool adjudicate : {false, true}) {
+    MctsPlayer::Options options;
+    options.adjudicate_pass_alive = adjudicate;
+    auto player = absl::make_unique<TestablePlayer>(options);
+    player->InitializeGame(board);
+    player->TreeSearch(1);
+    EXPECT_TRUE(player->PlayMove(Coord::FromKgs("J5")));
+    EXPECT_EQ(adjudicate, player->game_over());
+    if (adjudicate) {
+      EXPECT_EQ(1, player->result());
+      EXPECT_EQ("B+1.5", player->result_string());
+    }
+  }
+}
+
 TEST(MctsPlayerTest, ExtractDataResignEnd) {
   auto player = absl::make_unique<TestablePlayer>(MctsPlayer::Options());
   player->TreeSearch(1);
@@ -384,10 +845,9 @@ TEST(MctsPlayerTest, ExtractDataResignEnd) {
   player->TreeSearch(1);
   player->PlayMove(Coord::kResign);
 
-  auto* root = player->root();
-
   // Black is winning on the board.
-  EXPECT_LT(0, root->position.CalculateScore(player->options().komi));
+  EXPECT_LT(0,
+            player->root_position().CalculateScore(player->options().komi));
 
   EXPECT_EQ(-1, player->result());
   EXPECT_EQ("W+R", player->result_string());
@@ -448,8 +908,11 @@ TEST(MctsPlayerTest, SymmetriesTest) {
   std::vector<std::unique_ptr<MctsNode>> nodes;
   std::vector<std::string> moves = {"B3", "F1", "C7"};
   auto* parent = root;
+  auto position = player.root_position();
   for (const auto& move : moves) {
-    nodes.push_back(absl::make_unique<MctsNode>(parent, Coord::FromKgs(move)));
+    Coord c = Coord::FromKgs(move);
+    position.PlayMove(c);
+    nodes.push_back(absl::make_unique<MctsNode>(parent, c, position));
     parent = nodes.back().get();
   }
 
@@ -0,0 +1,128 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_OBJECT_POOL_H_
+#define CC_OBJECT_POOL_H_
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "cc/check.h"
+
+namespace minigo {
+
+// ObjectPool allocates objects of type T from blocks of kBlockSize objects.
+// The blocks are never returned to the system while the pool is alive: when
+// an object is deleted, its memory is put on a free list to be reused by the
+// next call to New. This means that a pool that repeatedly creates & deletes a
+// similar number of objects (for example, the nodes of a search tree that
+// grows during a search and is pruned after each move) only calls malloc a
+// handful of times, and keeps reusing the same pages of memory.
+//
+// ObjectPool is not thread safe, except that DeleteConcurrently may be called
+// from any thread.
+template <typename T, int kBlockSize = 64>
+class ObjectPool {
+ public:
+  ObjectPool() = default;
+  ObjectPool(const ObjectPool&) = delete;
+  ObjectPool& operator=(const ObjectPool&) = delete;
+
+  // All objects must have been deleted before the pool is destroyed.
+  ~ObjectPool() { MG_DCHECK(num_live() == 0) << num_live(); }
+
+  // Constructs a new object in the pool.
+  template <typename... Args>
+  T* New(Args&&... args) {
+    Slot* slot = free_list_;
+    if (slot == nullptr &&
+        remote_free_list_.load(std::memory_order_relaxed) != nullptr) {
+      // Take all the objects that were deleted by other threads at once.
+      slot = remote_free_list_.exchange(nullptr, std::memory_order_acquire);
+    }
+    if (slot != nullptr) {
+      free_list_ = slot->next;
+    } else {
+      if (blocks_.empty() || num_used_in_last_block_ == kBlockSize) {
+        blocks_.push_back(absl::make_unique<Block>());
+        num_used_in_last_block_ = 0;
+      }
+      slot = &(*blocks_.back())[num_used_in_last_block_++];
+    }
+    ++num_live_;
+    return new (&slot->storage) T(std::forward<Args>(args)...);
+  }
+
+  // Destroys an object that was created by New & returns its memory to the
+  // pool.
+  void Delete(T* t) {
+    MG_DCHECK(num_live_ > 0);
+    t->~T();
+    auto* slot = reinterpret_cast<Slot*>(t);
+    slot->next = free_list_;
+    free_list_ = slot;
+    --num_live_;
+  }
+
+  // Same as Delete, except that it may be called from a different thread to
+  // the one that uses the pool, while that thread is calling New & Delete. The
+  // object's memory is pushed onto a lock-free list, which New takes over once
+  // the pool's own free list is empty. This lets another thread pay for
+  // destroying a large number of objects.
+  void DeleteConcurrently(T* t) {
+    t->~T();
+    auto* slot = reinterpret_cast<Slot*>(t);
+    slot->next = remote_free_list_.load(std::memory_order_relaxed);
+    while (!remote_free_list_.compare_exchange_weak(
+        slot->next, slot, std::memory_order_release,
+        std::memory_order_relaxed)) {
+    }
+    num_remote_deleted_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Returns the number of objects that have been created and not yet deleted.
+  int num_live() const {
+    return num_live_ - num_remote_deleted_.load(std::memory_order_relaxed);
+  }
+
+  // Returns the number of objects the pool has allocated memory for.
+  int capacity() const { return static_cast<int>(blocks_.size()) * kBlockSize; }
+
+ private:
+  union Slot {
+    Slot* next;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+  using Block = std::array<Slot, kBlockSize>;
+
+  std::vector<std::unique_ptr<Block>> blocks_;
+  int num_used_in_last_block_ = 0;
+  Slot* free_list_ = nullptr;
+  int num_live_ = 0;
+
+  // Objects deleted by DeleteConcurrently. New only ever takes the whole list,
+  // so pushing onto it with a compare & swap is safe from the ABA problem.
+  std::atomic<Slot*> remote_free_list_{nullptr};
+  std::atomic<int> num_remote_deleted_{0};
+};
+
+}  // namespace minigo
+
+#endif  // CC_OBJECT_POOL_H_
@@ -0,0 +1,124 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/object_pool.h"
+
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+struct Counted {
+  explicit Counted(int* count) : count(count) { ++*count; }
+  ~Counted() { --*count; }
+  int* count;
+};
+
+TEST(ObjectPoolTest, NewAndDelete) {
+  int count = 0;
+  ObjectPool<Counted, 4> pool;
+  std::vector<Counted*> objects;
+  for (int i = 0; i < 10; ++i) {
+    objects.push_back(pool.New(&count));
+  }
+  EXPECT_EQ(10, count);
+  EXPECT_EQ(10, pool.num_live());
+  EXPECT_EQ(12, pool.capacity());
+
+  // All objects must be distinct.
+  std::set<Counted*> unique(objects.begin(), objects.end());
+  EXPECT_EQ(objects.size(), unique.size());
+
+  for (auto* x : objects) {
+    pool.Delete(x);
+  }
+  EXPECT_EQ(0, count);
+  EXPECT_EQ(0, pool.num_live());
+}
+
+TEST(ObjectPoolTest, ReusesMemory) {
+  int count = 0;
+  ObjectPool<Counted, 4> pool;
+  std::vector<Counted*> objects;
+  for (int i = 0; i < 8; ++i) {
+    objects.push_back(pool.New(&count));
+  }
+  std::set<Counted*> original(objects.begin(), objects.end());
+
+  // Repeatedly deleting & recreating objects reuses the same memory rather
+  // than allocating new blocks.
+  for (int j = 0; j < 3; ++j) {
+    for (auto* x : objects) {
+      pool.Delete(x);
+    }
+    objects.clear();
+    for (int i = 0; i < 8; ++i) {
+      objects.push_back(pool.New(&count));
+      EXPECT_EQ(1, original.count(objects.back()));
+    }
+    EXPECT_EQ(8, pool.capacity());
+  }
+
+  for (auto* x : objects) {
+    pool.Delete(x);
+  }
+  EXPECT_EQ(0, count);
+}
+
+TEST(ObjectPoolTest, DeleteConcurrently) {
+  ObjectPool<int, 4> pool;
+  std::vector<int*> objects;
+  for (int i = 0; i < 100; ++i) {
+    objects.push_back(pool.New(i));
+  }
+  std::set<int*> original(objects.begin(), objects.end());
+
+  // Delete half the objects on another thread while this one keeps creating &
+  // deleting objects.
+  std::vector<int*> remote(objects.begin(), objects.begin() + 50);
+  objects.erase(objects.begin(), objects.begin() + 50);
+  std::thread thread([&pool, &remote]() {
+    for (auto* x : remote) {
+      pool.DeleteConcurrently(x);
+    }
+  });
+  for (int i = 0; i < 1000; ++i) {
+    pool.Delete(objects.back());
+    objects.back() = pool.New(i);
+  }
+  thread.join();
+  EXPECT_EQ(50, pool.num_live());
+
+  // Once the pool's own free list is empty, the memory of the objects deleted
+  // on the other thread is reused.
+  int capacity = pool.capacity();
+  for (int i = 0; i < 50; ++i) {
+    objects.push_back(pool.New(i));
+    EXPECT_EQ(1, original.count(objects.back()));
+  }
+  EXPECT_EQ(capacity, pool.capacity());
+  EXPECT_EQ(100, pool.num_live());
+
+  for (auto* x : objects) {
+    pool.Delete(x);
+  }
+  EXPECT_EQ(0, pool.num_live());
+}
+
+}  // namespace
+}  // namespace minigo
@@ -0,0 +1,68 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/packed_position.h"
+
+#include "cc/check.h"
+
+namespace minigo {
+
+constexpr int PackedPosition::kPointsPerWord;
+constexpr int PackedPosition::kNumWords;
+
+PackedPosition::PackedPosition(const Position& position)
+    : stones_(),
+      stone_hash_(position.stone_hash()),
+      n_(static_cast<uint16_t>(position.n_)),
+      previous_move_(position.previous_move_),
+      ko_(position.ko_),
+      to_play_(static_cast<uint8_t>(position.to_play_)),
+      num_consecutive_passes_(
+          static_cast<uint8_t>(position.num_consecutive_passes_)) {
+  MG_DCHECK(position.n_ <= 0xffff);
+  for (int i = 0; i < 2; ++i) {
+    MG_DCHECK(position.num_captures_[i] <= 0xffff);
+    num_captures_[i] = static_cast<uint16_t>(position.num_captures_[i]);
+  }
+  for (int c = 0; c < kN * kN; ++c) {
+    auto bits = static_cast<uint64_t>(position.board_[ToPadded(c)].color());
+    stones_[c / kPointsPerWord] |= bits << (2 * (c % kPointsPerWord));
+  }
+}
+
+void PackedPosition::Unpack(Position* position) const {
+  // Only the identity stone hash is stored, so the hashes of the other
+  // symmetries are recalculated along with the groups.
+  position->stone_hashes_.fill(0);
+  for (int c = 0; c < kN * kN; ++c) {
+    auto color = this->color(c);
+    if (color == Color::kEmpty) {
+      position->board_[ToPadded(c)] = Stone();
+    } else {
+      position->board_[ToPadded(c)] = Stone(color, 0);
+      position->UpdateStoneHashes(c, color);
+    }
+  }
+  MG_DCHECK(position->stone_hash() == stone_hash_);
+  position->RebuildGroups();
+
+  position->to_play_ = to_play();
+  position->previous_move_ = previous_move_;
+  position->ko_ = ko_;
+  position->num_captures_ = num_captures();
+  position->n_ = n_;
+  position->num_consecutive_passes_ = num_consecutive_passes_;
+}
+
+}  // namespace minigo
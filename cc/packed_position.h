@@ -0,0 +1,90 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CC_PACKED_POSITION_H_
+#define CC_PACKED_POSITION_H_
+
+#include <array>
+#include <cstdint>
+
+#include "cc/color.h"
+#include "cc/constants.h"
+#include "cc/coord.h"
+#include "cc/position.h"
+#include "cc/zobrist.h"
+
+namespace minigo {
+
+// PackedPosition is a compact snapshot of a Position, used to store the board
+// state in each node of the search tree.
+//
+// The color of each point is packed into 2 bits, and only the state that can't
+// be derived from the stones is stored alongside them (to_play, ko, the number
+// of consecutive passes, etc). The groups & liberties that Position tracks are
+// not stored: they are recalculated from the stones by Unpack. A 19x19
+// PackedPosition is 120 bytes, compared to many kB for a Position.
+//
+// The accessors that the search needs on every node are available directly on
+// the snapshot, so a full Position only has to be rehydrated when a node is
+// expanded.
+class PackedPosition {
+ public:
+  explicit PackedPosition(const Position& position);
+
+  // Overwrites the board state of position with this snapshot, rebuilding its
+  // groups. The position's BoardVisitor and GroupVisitor are preserved.
+  void Unpack(Position* position) const;
+
+  // Returns the color of the stone at point c, or kEmpty.
+  Color color(Coord c) const {
+    return static_cast<Color>((stones_[c / kPointsPerWord] >>
+                               (2 * (c % kPointsPerWord))) &
+                              3);
+  }
+
+  Color to_play() const { return static_cast<Color>(to_play_); }
+  Coord previous_move() const { return previous_move_; }
+  Coord ko() const { return ko_; }
+  int n() const { return n_; }
+  std::array<int, 2> num_captures() const {
+    return {{num_captures_[0], num_captures_[1]}};
+  }
+  int num_consecutive_passes() const { return num_consecutive_passes_; }
+  bool is_game_over() const { return num_consecutive_passes_ >= 2; }
+  zobrist::Hash stone_hash() const { return stone_hash_; }
+
+  // Returns the same hash as Position::state_hash().
+  zobrist::Hash state_hash() const {
+    return stone_hash_ ^ zobrist::ToPlayHash(to_play()) ^
+           zobrist::KoHash(ko_) ^ zobrist::PassHash(num_consecutive_passes_);
+  }
+
+ private:
+  static constexpr int kPointsPerWord = 32;
+  static constexpr int kNumWords =
+      (kN * kN + kPointsPerWord - 1) / kPointsPerWord;
+
+  std::array<uint64_t, kNumWords> stones_;
+  zobrist::Hash stone_hash_;
+  std::array<uint16_t, 2> num_captures_;
+  uint16_t n_;
+  Coord previous_move_;
+  Coord ko_;
+  uint8_t to_play_;
+  uint8_t num_consecutive_passes_;
+};
+
+}  // namespace minigo
+
+#endif  // CC_PACKED_POSITION_H_
@@ -0,0 +1,106 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cc/packed_position.h"
+
+#include <vector>
+
+#include "cc/constants.h"
+#include "cc/position.h"
+#include "cc/random.h"
+#include "cc/symmetries.h"
+#include "cc/test_utils.h"
+#include "cc/zobrist.h"
+#include "gtest/gtest.h"
+
+namespace minigo {
+namespace {
+
+TEST(PackedPositionTest, Accessors) {
+  TestablePosition position(R"(
+      .XO
+      X.O)");
+  position.PlayMove("pass");
+  position.PlayMove("D9");
+
+  PackedPosition packed(position);
+  EXPECT_EQ(Color::kEmpty, packed.color(Coord::FromKgs("A9")));
+  EXPECT_EQ(Color::kBlack, packed.color(Coord::FromKgs("A8")));
+  EXPECT_EQ(Color::kBlack, packed.color(Coord::FromKgs("B9")));
+  EXPECT_EQ(Color::kWhite, packed.color(Coord::FromKgs("C9")));
+  EXPECT_EQ(Color::kWhite, packed.color(Coord::FromKgs("D9")));
+  EXPECT_EQ(Color::kBlack, packed.to_play());
+  EXPECT_EQ(Coord::FromKgs("D9"), packed.previous_move());
+  EXPECT_EQ(2, packed.n());
+  EXPECT_EQ(0, packed.num_consecutive_passes());
+  EXPECT_FALSE(packed.is_game_over());
+  EXPECT_EQ(position.stone_hash(), packed.stone_hash());
+  EXPECT_EQ(position.state_hash(), packed.state_hash());
+}
+
+// Packs & unpacks the positions of a random game, verifying that the unpacked
+// position is equivalent to the original.
+TEST(PackedPositionTest, RoundTrip) {
+  Random rnd(1618033);
+  TestablePosition position("");
+  TestablePosition unpacked("");
+
+  for (int i = 0; i < 1000; ++i) {
+    PackedPosition packed(position);
+    packed.Unpack(&unpacked);
+
+    ASSERT_EQ(position.ToSimpleString(), unpacked.ToSimpleString());
+    ASSERT_EQ(position.stone_hash(), unpacked.stone_hash());
+    ASSERT_EQ(position.state_hash(), unpacked.state_hash());
+    for (int sym = 0; sym < symmetry::kNumSymmetries; ++sym) {
+      auto s = static_cast<symmetry::Symmetry>(sym);
+      ASSERT_EQ(position.stone_hash(s), unpacked.stone_hash(s));
+    }
+    ASSERT_EQ(position.to_play(), unpacked.to_play());
+    ASSERT_EQ(position.previous_move(), unpacked.previous_move());
+    ASSERT_EQ(position.n(), unpacked.n());
+    ASSERT_EQ(position.is_game_over(), unpacked.is_game_over());
+    ASSERT_EQ(position.num_captures(), unpacked.num_captures());
+
+    // Group IDs aren't preserved, but the groups themselves must be. Comparing
+    // the classification of every move also checks that ko is preserved.
+    std::vector<Coord> legal_moves;
+    for (int c = 0; c < kN * kN; ++c) {
+      auto expected_group = position.GroupAt(c);
+      auto actual_group = unpacked.GroupAt(c);
+      ASSERT_EQ(expected_group.size, actual_group.size);
+      ASSERT_EQ(expected_group.liberties, actual_group.liberties);
+      auto move_type = position.ClassifyMove(c);
+      ASSERT_EQ(move_type, unpacked.ClassifyMove(c));
+      if (move_type != Position::MoveType::kIllegal) {
+        legal_moves.push_back(c);
+      }
+    }
+
+    Coord c = Coord::kPass;
+    if (!legal_moves.empty() && rnd.UniformInt(0, 19) != 0) {
+      c = legal_moves[rnd.UniformInt(0, legal_moves.size() - 1)];
+    }
+    position.PlayMove(c);
+  }
+}
+
+}  // namespace
+}  // namespace minigo
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  ::minigo::zobrist::Init(614944751);
+  return RUN_ALL_TESTS();
+}
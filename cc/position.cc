@@ -16,6 +16,7 @@
 
 #include <sstream>
 #include <utility>
+#include <vector>
 
 #include "absl/strings/str_format.h"
 #include "cc/tiny_set.h"
@@ -53,12 +54,54 @@ const std::array<inline_vector<Coord, 4>, kN* kN> kNeighborCoords = []() {
   return result;
 }();
 
+const std::array<uint16_t, kN * kN> kCoordToPadded = []() {
+  std::array<uint16_t, kN * kN> result;
+  for (int row = 0; row < kN; ++row) {
+    for (int col = 0; col < kN; ++col) {
+      result[row * kN + col] = (row + 1) * kPaddedN + col + 1;
+    }
+  }
+  return result;
+}();
+
+const std::array<uint16_t, kNumPaddedPoints> kPaddedToCoord = []() {
+  std::array<uint16_t, kNumPaddedPoints> result;
+  result.fill(Coord::kInvalid);
+  for (int c = 0; c < kN * kN; ++c) {
+    result[kCoordToPadded[c]] = c;
+  }
+  return result;
+}();
+
+const std::array<std::array<uint16_t, kN * kN>, symmetry::kNumSymmetries>
+    kSymmetricCoords = []() {
+      std::array<uint16_t, kN * kN> coords;
+      for (int c = 0; c < kN * kN; ++c) {
+        coords[c] = c;
+      }
+      std::array<std::array<uint16_t, kN * kN>, symmetry::kNumSymmetries>
+          result;
+      for (int sym = 0; sym < symmetry::kNumSymmetries; ++sym) {
+        // After applying the symmetry, transformed[c] holds the coordinate of
+        // the point that was moved to c.
+        std::array<uint16_t, kN * kN> transformed;
+        symmetry::ApplySymmetry<kN, 1>(static_cast<symmetry::Symmetry>(sym),
+                                       coords.begin(), transformed.begin());
+        for (int c = 0; c < kN * kN; ++c) {
+          result[sym][transformed[c]] = c;
+        }
+      }
+      return result;
+    }();
+
 Position::Position(BoardVisitor* bv, GroupVisitor* gv, Color to_play, int n)
-    : board_visitor_(bv),
-      group_visitor_(gv),
-      to_play_(to_play),
-      n_(n),
-      stone_hash_(0) {}
+    : board_visitor_(bv), group_visitor_(gv), to_play_(to_play), n_(n) {
+  for (int p = 0; p < kNumPaddedPoints; ++p) {
+    if (kPaddedToCoord[p] == Coord::kInvalid) {
+      board_[p] = Stone::OffBoard();
+    }
+  }
+}
 
 Position::Position(BoardVisitor* bv, GroupVisitor* gv, const Position& position)
     : Position(position) {
@@ -88,12 +131,94 @@ void Position::PlayMove(Coord c, Color color) {
   previous_move_ = c;
 }
 
+void Position::PlayMove(Coord c, Color color, UndoJournal* journal) {
+  UndoJournal::Move move;
+  move.to_play = to_play_;
+  move.previous_move = previous_move_;
+  move.ko = ko_;
+  move.num_captures = num_captures_;
+  move.n = n_;
+  move.num_consecutive_passes = num_consecutive_passes_;
+  move.stone_hashes = stone_hashes_;
+#ifndef MG_BITBOARD_POSITION
+  move.groups = groups_.checkpoint();
+  move.num_group_changes = journal->group_changes_.size();
+  move.num_next_stone_changes = journal->next_stone_changes_.size();
+  // MutableGroup uses the GroupVisitor to only record each group once.
+  group_visitor_->Begin();
+#endif
+  move.num_stone_changes = journal->stone_changes_.size();
+  journal->moves_.push_back(move);
+
+  journal_ = journal;
+  PlayMove(c, color);
+  journal_ = nullptr;
+}
+
+void Position::UndoMove(UndoJournal* journal) {
+  MG_CHECK(!journal->moves_.empty());
+  const auto& move = journal->moves_.back();
+
+  // Revert changes in the reverse order they were made.
+  auto& stone_changes = journal->stone_changes_;
+  while (static_cast<int>(stone_changes.size()) > move.num_stone_changes) {
+    auto p = stone_changes.back().first;
+    auto s = stone_changes.back().second;
+#ifdef MG_BITBOARD_POSITION
+    Coord c = kPaddedToCoord[p];
+    occupied_[0].reset(c);
+    occupied_[1].reset(c);
+    if (!s.empty()) {
+      occupied(s.color()).set(c);
+    }
+#endif
+    board_[p] = s;
+    stone_changes.pop_back();
+  }
+
+#ifndef MG_BITBOARD_POSITION
+  // Groups must be reverted before the pool, which may release groups that
+  // were allocated by the move.
+  auto& group_changes = journal->group_changes_;
+  while (static_cast<int>(group_changes.size()) > move.num_group_changes) {
+    groups_[group_changes.back().first] = group_changes.back().second;
+    group_changes.pop_back();
+  }
+  groups_.restore(move.groups);
+
+  auto& next_stone_changes = journal->next_stone_changes_;
+  while (static_cast<int>(next_stone_changes.size()) >
+         move.num_next_stone_changes) {
+    next_stone_[next_stone_changes.back().first] =
+        next_stone_changes.back().second;
+    next_stone_changes.pop_back();
+  }
+#endif
+
+  to_play_ = move.to_play;
+  previous_move_ = move.previous_move;
+  ko_ = move.ko;
+  num_captures_ = move.num_captures;
+  n_ = move.n;
+  num_consecutive_passes_ = move.num_consecutive_passes;
+  stone_hashes_ = move.stone_hashes;
+  journal->moves_.pop_back();
+}
+
+Position::Stones Position::stones() const {
+  Stones stones;
+  for (int c = 0; c < kN * kN; ++c) {
+    stones[c] = board_[ToPadded(c)];
+  }
+  return stones;
+}
+
 std::string Position::ToSimpleString() const {
   std::ostringstream oss;
   for (int row = 0; row < kN; ++row) {
     for (int col = 0; col < kN; ++col) {
       Coord c(row, col);
-      auto color = stones_[c].color();
+      auto color = board_[ToPadded(c)].color();
       if (color == Color::kWhite) {
         oss << "O";
       } else if (color == Color::kBlack) {
@@ -107,24 +232,6 @@ std::string Position::ToSimpleString() const {
   return oss.str();
 }
 
-std::string Position::ToGroupString() const {
-  std::ostringstream oss;
-  for (int row = 0; row < kN; ++row) {
-    for (int col = 0; col < kN; ++col) {
-      Coord c(row, col);
-      Stone s = stones_[c];
-      if (s.empty()) {
-        oss << kPrintEmpty << ".  ";
-      } else {
-        oss << (s.color() == Color::kWhite ? kPrintWhite : kPrintBlack);
-        oss << absl::StreamFormat("%02x ", s.group_id());
-      }
-    }
-    oss << kPrintNormal << "\n";
-  }
-  return oss.str();
-}
-
 std::string Position::ToPrettyString(bool use_ansi_colors) const {
   std::ostringstream oss;
 
@@ -146,7 +253,7 @@ std::string Position::ToPrettyString(bool use_ansi_colors) const {
     oss << absl::StreamFormat("%2d ", kN - row);
     for (int col = 0; col < kN; ++col) {
       Coord c(row, col);
-      auto color = stones_[c].color();
+      auto color = board_[ToPadded(c)].color();
       if (color == Color::kWhite) {
         oss << print_white << "O ";
       } else if (color == Color::kBlack) {
@@ -162,6 +269,19 @@ std::string Position::ToPrettyString(bool use_ansi_colors) const {
   return oss.str();
 }
 
+zobrist::Hash Position::CanonicalStoneHash(symmetry::Symmetry* sym) const {
+  int best = 0;
+  for (int i = 1; i < symmetry::kNumSymmetries; ++i) {
+    if (stone_hashes_[i] < stone_hashes_[best]) {
+      best = i;
+    }
+  }
+  if (sym != nullptr) {
+    *sym = static_cast<symmetry::Symmetry>(best);
+  }
+  return stone_hashes_[best];
+}
+
 void Position::PassMove() {
   n_ += 1;
   num_consecutive_passes_ += 1;
@@ -170,35 +290,186 @@ void Position::PassMove() {
   previous_move_ = Coord::kPass;
 }
 
+Color Position::IsKoish(Coord c) const {
+  int p = ToPadded(c);
+  if (!board_[p].empty()) {
+    return Color::kEmpty;
+  }
+
+  Color ko_color = Color::kEmpty;
+  for (int offset : kNeighborOffsets) {
+    Stone s = board_[p + offset];
+    if (s.empty()) {
+      return Color::kEmpty;
+    }
+    if (s.off_board()) {
+      continue;
+    }
+    if (s.color() != ko_color) {
+      if (ko_color == Color::kEmpty) {
+        ko_color = s.color();
+      } else {
+        return Color::kEmpty;
+      }
+    }
+  }
+  return ko_color;
+}
+
+std::array<BitBoard, 2> Position::CalculatePassAliveArea() const {
+  BitBoard empty;
+  std::array<BitBoard, 2> occupied;
+  for (int c = 0; c < kN * kN; ++c) {
+    auto color = board_[ToPadded(c)].color();
+    if (color == Color::kEmpty) {
+      empty.set(c);
+    } else {
+      occupied[static_cast<int>(color) - 1].set(c);
+    }
+  }
+
+  std::array<BitBoard, 2> result;
+  for (int i = 0; i < 2; ++i) {
+    // Split the player's stones into chains, and the rest of the board into
+    // regions: the maximal connected sets of points without the player's
+    // stones.
+    const auto& stones = occupied[i];
+    std::vector<BitBoard> chains;
+    for (auto remaining = stones; !remaining.empty();) {
+      chains.push_back(BitBoard(remaining.first()).FloodFill(stones));
+      remaining ^= chains.back();
+    }
+    std::vector<BitBoard> regions;
+    for (auto remaining = ~stones; !remaining.empty();) {
+      regions.push_back(BitBoard(remaining.first()).FloodFill(~stones));
+      remaining ^= regions.back();
+    }
+
+    // For each region, find the chains that border it and the chains that it's
+    // vital to: a region is vital to a chain if all its empty points are
+    // liberties of the chain.
+    std::vector<std::vector<int>> bordering_chains(regions.size());
+    std::vector<std::vector<int>> vital_chains(regions.size());
+    for (size_t r = 0; r < regions.size(); ++r) {
+      auto region_empty = regions[r] & empty;
+      auto region_neighbors = regions[r].Neighbors();
+      for (size_t j = 0; j < chains.size(); ++j) {
+        if ((region_neighbors & chains[j]).empty()) {
+          continue;
+        }
+        bordering_chains[r].push_back(j);
+        if ((region_empty & ~chains[j].Neighbors()).empty()) {
+          vital_chains[r].push_back(j);
+        }
+      }
+    }
+
+    // Repeatedly remove the chains that have fewer than two vital regions, and
+    // the regions that border a removed chain, until nothing changes. The
+    // chains that remain are pass-alive.
+    std::vector<bool> alive(chains.size(), true);
+    std::vector<bool> healthy(regions.size(), true);
+    for (bool changed = true; changed;) {
+      changed = false;
+      std::vector<int> num_vital(chains.size(), 0);
+      for (size_t r = 0; r < regions.size(); ++r) {
+        if (healthy[r]) {
+          for (int j : vital_chains[r]) {
+            num_vital[j] += 1;
+          }
+        }
+      }
+      for (size_t j = 0; j < chains.size(); ++j) {
+        if (alive[j] && num_vital[j] < 2) {
+          alive[j] = false;
+          changed = true;
+        }
+      }
+      for (size_t r = 0; r < regions.size(); ++r) {
+        if (!healthy[r]) {
+          continue;
+        }
+        for (int j : bordering_chains[r]) {
+          if (!alive[j]) {
+            healthy[r] = false;
+            changed = true;
+            break;
+          }
+        }
+      }
+    }
+
+    for (size_t j = 0; j < chains.size(); ++j) {
+      if (alive[j]) {
+        result[i] |= chains[j];
+      }
+    }
+    for (size_t r = 0; r < regions.size(); ++r) {
+      if (healthy[r] && !vital_chains[r].empty()) {
+        result[i] |= regions[r];
+      }
+    }
+  }
+  return result;
+}
+
+// The methods below implement the GroupPool based board logic. The bitboard
+// implementation of these methods lives in position_bitboard.cc.
+#ifndef MG_BITBOARD_POSITION
+
+std::string Position::ToGroupString() const {
+  std::ostringstream oss;
+  for (int row = 0; row < kN; ++row) {
+    for (int col = 0; col < kN; ++col) {
+      Coord c(row, col);
+      Stone s = board_[ToPadded(c)];
+      if (s.empty()) {
+        oss << kPrintEmpty << ".  ";
+      } else {
+        oss << (s.color() == Color::kWhite ? kPrintWhite : kPrintBlack);
+        oss << absl::StreamFormat("%02x ", s.group_id());
+      }
+    }
+    oss << kPrintNormal << "\n";
+  }
+  return oss.str();
+}
+
 void Position::AddStoneToBoard(Coord c, Color color) {
   auto potential_ko = IsKoish(c);
   auto opponent_color = OtherColor(color);
+  int p = ToPadded(c);
 
   // Traverse the coord's neighbors, building useful information:
   //  - list of captured groups (if any).
-  //  - coordinates of the new stone's liberties.
-  //  - set of neighboring groups of each color.
-  inline_vector<std::pair<GroupId, Coord>, 4> captured_groups;
-  inline_vector<Coord, 4> liberties;
-  tiny_set<GroupId, 4> opponent_groups;
+  //  - the new stone's liberties.
+  //  - set of neighboring groups of the same color.
+  // Opponent groups lose their liberty at c.
+  inline_vector<std::pair<GroupId, int>, 4> captured_groups;
+  BitBoard liberties;
   tiny_set<GroupId, 4> neighbor_groups;
-  for (auto nc : kNeighborCoords[c]) {
-    auto neighbor = stones_[nc];
+  // neighbor_points[i] is a stone of the group neighbor_groups[i].
+  inline_vector<int, 4> neighbor_points;
+  for (int offset : kNeighborOffsets) {
+    int np = p + offset;
+    auto neighbor = board_[np];
     auto neighbor_color = neighbor.color();
     auto neighbor_group_id = neighbor.group_id();
     if (neighbor_color == Color::kEmpty) {
-      // Remember the coord of this liberty.
-      liberties.push_back(nc);
+      liberties.set(kPaddedToCoord[np]);
     } else if (neighbor_color == color) {
-      // Remember neighboring groups of same color.
-      neighbor_groups.insert(neighbor_group_id);
+      if (neighbor_groups.insert(neighbor_group_id)) {
+        neighbor_points.push_back(np);
+      }
     } else if (neighbor_color == opponent_color) {
-      // Decrement neighboring opponent group liberty counts and remember the
-      // gorups we have captured. We'll remove them from the board shortly.
-      if (opponent_groups.insert(neighbor_group_id)) {
-        Group& opponent_group = groups_[neighbor_group_id];
-        if (--opponent_group.num_liberties == 0) {
-          captured_groups.emplace_back(neighbor_group_id, nc);
+      // Remove the liberty from neighboring opponent groups and remember the
+      // groups we have captured. We'll remove them from the board shortly.
+      // RemoveLiberty is a no-op if we've already seen this group.
+      if (groups_[neighbor_group_id].liberties.test(c)) {
+        Group& opponent_group = MutableGroup(neighbor_group_id);
+        opponent_group.RemoveLiberty(c);
+        if (opponent_group.num_liberties == 0) {
+          captured_groups.emplace_back(neighbor_group_id, np);
         }
       }
     }
@@ -207,150 +478,114 @@ void Position::AddStoneToBoard(Coord c, Color color) {
   // Place the new stone on the board.
   if (neighbor_groups.empty()) {
     // The stone doesn't connect to any neighboring groups: create a new group.
-    stones_[c] = {color, groups_.alloc(1, liberties.size())};
+    if (journal_ != nullptr) {
+      // If alloc is going to reuse a previously freed group, record its
+      // current state: undoing an earlier move may bring that group back.
+      auto checkpoint = groups_.checkpoint();
+      if (checkpoint.num_free_ids != 0) {
+        MutableGroup(checkpoint.last_free_id);
+      }
+    }
+    SetStone(p, {color, groups_.alloc(1, liberties)});
+    SetNextStone(p, p);
   } else {
-    // The stone connects to at least one neighbor: merge it into the first
-    // group we found.
+    // The stone connects to at least one neighbor: merge it into the largest
+    // neighboring group, which minimizes the number of stones that need to be
+    // relabeled if there are multiple neighboring groups.
     auto group_id = neighbor_groups[0];
-    if (neighbor_groups.size() == 1) {
-      // Only one neighbor: update the group's size and liberty count, being
-      // careful not to add count coords that were already liberties of the
-      // group.
-      Group& group = groups_[group_id];
-      ++group.size;
-      --group.num_liberties;
-      for (auto nc : liberties) {
-        if (!HasNeighboringGroup(nc, group_id)) {
-          ++group.num_liberties;
-        }
+    for (int i = 1; i < neighbor_groups.size(); ++i) {
+      if (groups_[neighbor_groups[i]].size > groups_[group_id].size) {
+        group_id = neighbor_groups[i];
       }
-      stones_[c] = {color, group_id};
-    } else {
-      // The stone joins multiple groups, merge them.
-      // Incrementally updating the merged liberty counts is hard, so we just
-      // recalculate the merged group's size and liberty count from scratch.
-      // This is the relatively infrequent slow path.
-      stones_[c] = {color, group_id};
-      MergeGroup(c);
-      for (int i = 1; i < neighbor_groups.size(); ++i) {
-        groups_.free(neighbor_groups[i]);
+    }
+    // Join the new stone and the rings of all the neighboring groups.
+    SetNextStone(p, p);
+    for (int i = 0; i < neighbor_groups.size(); ++i) {
+      if (neighbor_groups[i] != group_id) {
+        MergeGroup(group_id, neighbor_points[i]);
       }
+      SpliceRings(p, neighbor_points[i]);
     }
+    Group& group = MutableGroup(group_id);
+    ++group.size;
+    group.RemoveLiberty(c);
+    group.AddLiberties(liberties);
+    SetStone(p, {color, group_id});
   }
-  stone_hash_ ^= zobrist::MoveHash(c, color);
+  UpdateStoneHashes(c, color);
 
   // Remove captured groups.
-  for (const auto& p : captured_groups) {
-    int num_captured_stones = groups_[p.first].size;
-    if (color == Color::kBlack) {
-      num_captures_[0] += num_captured_stones;
-    } else {
-      num_captures_[1] += num_captured_stones;
-    }
-    RemoveGroup(p.second);
+  int num_captured_stones = 0;
+  for (const auto& captured : captured_groups) {
+    num_captured_stones += groups_[captured.first].size;
+    RemoveGroup(captured.second);
+  }
+  if (color == Color::kBlack) {
+    num_captures_[0] += num_captured_stones;
+  } else {
+    num_captures_[1] += num_captured_stones;
   }
 
   // Update ko.
-  if (captured_groups.size() == 1 &&
-      groups_[captured_groups[0].first].size == 1 &&
+  if (captured_groups.size() == 1 && num_captured_stones == 1 &&
       potential_ko == opponent_color) {
-    ko_ = captured_groups[0].second;
+    ko_ = kPaddedToCoord[captured_groups[0].second];
   } else {
     ko_ = Coord::kInvalid;
   }
 }
 
-void Position::RemoveGroup(Coord c) {
+void Position::RemoveGroup(int p) {
   // Remember the first stone from the group we're about to remove.
-  auto removed_color = stones_[c].color();
+  auto removed_color = board_[p].color();
   auto other_color = OtherColor(removed_color);
-  auto removed_group_id = stones_[c].group_id();
-
-  group_visitor_->Begin();
-  board_visitor_->Begin();
-  board_visitor_->Visit(c);
-  while (!board_visitor_->Done()) {
-    c = board_visitor_->Next();
-
-    MG_CHECK(stones_[c].group_id() == removed_group_id);
-    stones_[c] = {};
-    stone_hash_ ^= zobrist::MoveHash(c, removed_color);
-    tiny_set<GroupId, 4> other_groups;
-    for (auto nc : kNeighborCoords[c]) {
-      auto ns = stones_[nc];
-      auto neighbor_color = ns.color();
-      auto neighbor_group_id = ns.group_id();
-      if (neighbor_color == other_color) {
-        if (other_groups.insert(neighbor_group_id)) {
-          ++groups_[neighbor_group_id].num_liberties;
-        }
-      } else if (neighbor_color == removed_color) {
-        board_visitor_->Visit(nc);
+  auto removed_group_id = board_[p].group_id();
+
+  // Walk the group's ring of stones. The links are left in place: they're
+  // ignored for empty points and reset when a stone is next played there.
+  int q = p;
+  do {
+    Coord c = kPaddedToCoord[q];
+    MG_DCHECK(board_[q].group_id() == removed_group_id);
+    SetStone(q, {});
+    UpdateStoneHashes(c, removed_color);
+    for (int offset : kNeighborOffsets) {
+      auto ns = board_[q + offset];
+      if (ns.color() == other_color) {
+        MutableGroup(ns.group_id()).AddLiberty(c);
       }
     }
-  }
+    q = next_stone_[q];
+  } while (q != p);
 
   groups_.free(removed_group_id);
 }
 
-void Position::MergeGroup(Coord c) {
-  Stone s = stones_[c];
-  Color color = s.color();
-  Color opponent_color = OtherColor(color);
-  Group& group = groups_[s.group_id()];
-  group.num_liberties = 0;
-  group.size = 0;
-
-  board_visitor_->Begin();
-  board_visitor_->Visit(c);
-  while (!board_visitor_->Done()) {
-    c = board_visitor_->Next();
-    if (stones_[c].color() == Color::kEmpty) {
-      ++group.num_liberties;
-    } else {
-      MG_CHECK(stones_[c].color() == color);
-      ++group.size;
-      stones_[c] = s;
-      for (auto nc : kNeighborCoords[c]) {
-        if (stones_[nc].color() != opponent_color) {
-          // We visit neighboring stones of the same color and empty coords.
-          // Visiting empty coords through the BoardVisitor API ensures that
-          // each one is only counted as a liberty once, even if it is
-          // neighbored by multiple stones in this group.
-          board_visitor_->Visit(nc);
-        }
-      }
-    }
-  }
-}
-
-Color Position::IsKoish(Coord c) const {
-  if (!stones_[c].empty()) {
-    return Color::kEmpty;
-  }
-
-  Color ko_color = Color::kEmpty;
-  for (Coord nc : kNeighborCoords[c]) {
-    Stone s = stones_[nc];
-    if (s.empty()) {
-      return Color::kEmpty;
-    }
-    if (s.color() != ko_color) {
-      if (ko_color == Color::kEmpty) {
-        ko_color = s.color();
-      } else {
-        return Color::kEmpty;
-      }
-    }
-  }
-  return ko_color;
+void Position::MergeGroup(GroupId group_id, int p) {
+  Stone s = board_[p];
+  auto other_group_id = s.group_id();
+  Stone merged_stone(s.color(), group_id);
+  Group& group = MutableGroup(group_id);
+  const Group& other = groups_[other_group_id];
+  group.size += other.size;
+  group.AddLiberties(other.liberties);
+
+  // Relabel the stones of the other group.
+  int q = p;
+  do {
+    SetStone(q, merged_stone);
+    q = next_stone_[q];
+  } while (q != p);
+
+  groups_.free(other_group_id);
 }
 
 Position::MoveType Position::ClassifyMove(Coord c) const {
   if (c == Coord::kPass || c == Coord::kResign) {
     return MoveType::kNoCapture;
   }
-  if (!stones_[c].empty()) {
+  int p = ToPadded(c);
+  if (!board_[p].empty()) {
     return MoveType::kIllegal;
   }
   if (c == ko_) {
@@ -359,22 +594,22 @@ Position::MoveType Position::ClassifyMove(Coord c) const {
 
   auto result = MoveType::kIllegal;
   auto other_color = OtherColor(to_play_);
-  for (auto nc : kNeighborCoords[c]) {
-    Stone s = stones_[nc];
+  for (int offset : kNeighborOffsets) {
+    Stone s = board_[p + offset];
     if (s.empty()) {
-      // At least one liberty at nc after playing at c.
+      // At least one liberty at the neighbor after playing at c.
       if (result == MoveType::kIllegal) {
         result = MoveType::kNoCapture;
       }
     } else if (s.color() == other_color) {
       if (groups_[s.group_id()].num_liberties == 1) {
-        // Will capture opponent group that has a stone at nc.
+        // Will capture the neighboring opponent group.
         result = MoveType::kCapture;
       }
-    } else {
+    } else if (s.color() == to_play_) {
       if (groups_[s.group_id()].num_liberties > 1) {
-        // Connecting to a same colored group at nc that has more than one
-        // liberty.
+        // Connecting to a neighboring same colored group that has more than
+        // one liberty.
         if (result == MoveType::kIllegal) {
           result = MoveType::kNoCapture;
         }
@@ -384,35 +619,85 @@ Position::MoveType Position::ClassifyMove(Coord c) const {
   return result;
 }
 
-bool Position::HasNeighboringGroup(Coord c, GroupId group_id) const {
-  for (auto nc : kNeighborCoords[c]) {
-    Stone s = stones_[nc];
-    if (!s.empty() && s.group_id() == group_id) {
-      return true;
+void Position::ClassifyAllMoves(
+    std::array<bool, kN * kN>* legal,
+    std::array<zobrist::Hash, kN * kN>* stone_hashes) const {
+  auto other_color = OtherColor(to_play_);
+
+  // Calculate the hash of the stones in each opponent group that only has one
+  // liberty: these are the stones that get removed when that liberty is
+  // played.
+  std::array<zobrist::Hash, Group::kMaxNumGroups> capture_hashes;
+  group_visitor_->Begin();
+  for (int c = 0; c < kN * kN; ++c) {
+    Stone s = board_[ToPadded(c)];
+    if (s.color() != other_color || groups_[s.group_id()].num_liberties != 1) {
+      continue;
+    }
+    auto stone_hash = zobrist::MoveHash(c, other_color);
+    if (group_visitor_->Visit(s.group_id())) {
+      capture_hashes[s.group_id()] = stone_hash;
+    } else {
+      capture_hashes[s.group_id()] ^= stone_hash;
+    }
+  }
+
+  for (int c = 0; c < kN * kN; ++c) {
+    int p = ToPadded(c);
+    if (!board_[p].empty() || c == ko_) {
+      (*legal)[c] = false;
+      continue;
+    }
+
+    // Same logic as ClassifyMove.
+    auto result = MoveType::kIllegal;
+    auto new_hash = stone_hash() ^ zobrist::MoveHash(c, to_play_);
+    tiny_set<GroupId, 4> captured_groups;
+    for (int offset : kNeighborOffsets) {
+      Stone s = board_[p + offset];
+      if (s.empty()) {
+        if (result == MoveType::kIllegal) {
+          result = MoveType::kNoCapture;
+        }
+      } else if (s.color() == other_color) {
+        if (groups_[s.group_id()].num_liberties == 1) {
+          result = MoveType::kCapture;
+          if (captured_groups.insert(s.group_id())) {
+            new_hash ^= capture_hashes[s.group_id()];
+          }
+        }
+      } else if (s.color() == to_play_) {
+        if (groups_[s.group_id()].num_liberties > 1) {
+          if (result == MoveType::kIllegal) {
+            result = MoveType::kNoCapture;
+          }
+        }
+      }
     }
+    (*legal)[c] = result != MoveType::kIllegal;
+    (*stone_hashes)[c] = new_hash;
   }
-  return false;
 }
 
-float Position::CalculateScore(float komi) {
+float Position::CalculateScore(float komi) const {
   int score = 0;
 
   static_assert(static_cast<int>(Color::kEmpty) == 0, "Color::kEmpty != 0");
   static_assert(static_cast<int>(Color::kBlack) == 1, "Color::kBlack != 1");
   static_assert(static_cast<int>(Color::kWhite) == 2, "Color::kWhite != 2");
 
-  auto score_empty_area = [this](Coord c) {
+  auto score_empty_area = [this]() {
     int num_visited = 0;
     int found_bits = 0;
     do {
-      c = board_visitor_->Next();
+      int p = board_visitor_->Next();
       ++num_visited;
-      for (auto nc : kNeighborCoords[c]) {
-        Color color = stones_[nc].color();
-        if (color == Color::kEmpty) {
-          board_visitor_->Visit(nc);
-        } else {
-          found_bits |= static_cast<int>(color);
+      for (int offset : kNeighborOffsets) {
+        Stone s = board_[p + offset];
+        if (s.empty()) {
+          board_visitor_->Visit(p + offset);
+        } else if (!s.off_board()) {
+          found_bits |= static_cast<int>(s.color());
         }
       }
     } while (!board_visitor_->Done());
@@ -430,12 +715,12 @@ float Position::CalculateScore(float komi) {
   board_visitor_->Begin();
   for (int row = 0; row < kN; ++row) {
     for (int col = 0; col < kN; ++col) {
-      Coord c(row, col);
-      Stone s = stones_[c];
+      int p = ToPadded(Coord(row, col));
+      Stone s = board_[p];
       if (s.empty()) {
-        if (board_visitor_->Visit(c)) {
+        if (board_visitor_->Visit(p)) {
           // First time visiting this empty coord.
-          score += score_empty_area(c);
+          score += score_empty_area();
         }
       } else if (group_visitor_->Visit(s.group_id())) {
         // First time visiting this group of stones.
@@ -452,4 +737,45 @@ float Position::CalculateScore(float komi) {
   return static_cast<float>(score) - komi;
 }
 
+void Position::RebuildGroups() {
+  BitBoard empty;
+  std::array<BitBoard, 2> occupied;
+  for (int c = 0; c < kN * kN; ++c) {
+    auto color = board_[ToPadded(c)].color();
+    if (color == Color::kEmpty) {
+      empty.set(c);
+    } else {
+      occupied[static_cast<int>(color) - 1].set(c);
+    }
+  }
+
+  groups_.clear();
+  BitBoard labeled;
+  for (int c = 0; c < kN * kN; ++c) {
+    auto color = board_[ToPadded(c)].color();
+    if (color == Color::kEmpty || labeled.test(c)) {
+      continue;
+    }
+    auto chain = BitBoard(c).FloodFill(occupied[static_cast<int>(color) - 1]);
+    auto group_id = groups_.alloc(chain.count(), chain.Neighbors() & empty);
+    int first = ToPadded(chain.first());
+    int prev = first;
+    chain.ForEach([&](Coord cc) {
+      int p = ToPadded(cc);
+      board_[p] = {color, group_id};
+      next_stone_[prev] = p;
+      prev = p;
+    });
+    next_stone_[prev] = first;
+    labeled |= chain;
+  }
+}
+
+Group Position::GroupAt(Coord c) const {
+  auto s = board_[ToPadded(c)];
+  return s.empty() ? Group() : groups_[s.group_id()];
+}
+
+#endif  // MG_BITBOARD_POSITION
+
 }  // namespace minigo
@@ -20,7 +20,10 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "cc/bitboard.h"
 #include "cc/check.h"
 #include "cc/color.h"
 #include "cc/constants.h"
@@ -28,21 +31,50 @@
 #include "cc/group.h"
 #include "cc/inline_vector.h"
 #include "cc/stone.h"
+#include "cc/symmetries.h"
 #include "cc/zobrist.h"
 
 namespace minigo {
 extern const std::array<inline_vector<Coord, 4>, kN * kN> kNeighborCoords;
 
-// BoardVisitor visits points on the board only once.
+// Internally, Position stores the board surrounded by a one point wide border
+// of off-board points (see Stone::OffBoard()). Every point on the board then
+// has exactly four neighbors at fixed offsets, so the board logic's inner loops
+// don't need to handle the edges of the board. The padded layout is an
+// implementation detail: Position's API takes and returns Coords.
+constexpr int kPaddedN = kN + 2;
+constexpr int kNumPaddedPoints = kPaddedN * kPaddedN;
+
+// Offsets from a point in the padded board to its four neighbors.
+constexpr std::array<int, 4> kNeighborOffsets = {{-1, 1, -kPaddedN, kPaddedN}};
+
+// Tables that map between a Coord on the board and the index of the point in
+// the padded board. Points on the border map to Coord::kInvalid.
+extern const std::array<uint16_t, kN * kN> kCoordToPadded;
+extern const std::array<uint16_t, kNumPaddedPoints> kPaddedToCoord;
+
+// Returns the index of the point at coordinate c in the padded board.
+inline int ToPadded(Coord c) { return kCoordToPadded[c]; }
+
+// kSymmetricCoords[sym][c] is the coordinate that the point at coordinate c is
+// moved to when symmetry::ApplySymmetry transforms the board by sym.
+extern const std::array<std::array<uint16_t, kN * kN>,
+                        symmetry::kNumSymmetries>
+    kSymmetricCoords;
+
+// BoardVisitor visits points on the board only once. Points are identified by
+// their index in Position's padded board.
 // A simple example that visits all points on the board only once:
 //   BoardVisitor bv;
 //   bv.Begin()
-//   bv.Visit(0);
+//   bv.Visit(ToPadded(0));
 //   while (!bv.Done()) {
-//     Coord coord = bv.Next();
-//     std::cout << "Visiting " << coord << "\n";
-//     for (auto neighbor_coord : GetNeighbors(coord)) {
-//       bv.Visit(neighbor_coord);
+//     int p = bv.Next();
+//     std::cout << "Visiting " << Coord(kPaddedToCoord[p]) << "\n";
+//     for (int offset : kNeighborOffsets) {
+//       if (stones[p + offset] is on the board) {
+//         bv.Visit(p + offset);
+//       }
 //     }
 //   }
 //
@@ -64,28 +96,28 @@ class BoardVisitor {
   // Returns true when there are no more points to visit.
   bool Done() const { return stack_.empty(); }
 
-  // Returns the coordinates of the next point in the queue to visit.
-  Coord Next() {
-    auto c = stack_.back();
+  // Returns the next point in the queue to visit.
+  int Next() {
+    auto p = stack_.back();
     stack_.pop_back();
-    return c;
+    return p;
   }
 
-  // If this is the first time Visit has been passed coordinate c since the most
-  // recent call to Begin, Visit pushes the coordinate onto its queue of points
-  // to visit and returns true. Otherwise, Visit returns false.
-  bool Visit(Coord c) {
-    if (visited_[c] != epoch_) {
-      visited_[c] = epoch_;
-      stack_.push_back(c);
+  // If this is the first time Visit has been passed point p since the most
+  // recent call to Begin, Visit pushes the point onto its queue of points to
+  // visit and returns true. Otherwise, Visit returns false.
+  bool Visit(int p) {
+    if (visited_[p] != epoch_) {
+      visited_[p] = epoch_;
+      stack_.push_back(p);
       return true;
     }
     return false;
   }
 
  private:
-  inline_vector<Coord, kN * kN> stack_;
-  std::array<uint8_t, kN * kN> visited_;
+  inline_vector<uint16_t, kNumPaddedPoints> stack_;
+  std::array<uint8_t, kNumPaddedPoints> visited_;
 
   // Initializing to 0xff means the visited_ array will get initialized on the
   // first call to Begin().
@@ -122,6 +154,50 @@ class GroupVisitor {
   uint8_t epoch_ = 0xff;
 };
 
+class PackedPosition;
+class Position;
+
+// UndoJournal records the changes that Position::PlayMove makes to a position,
+// so that Position::UndoMove can revert them. A journal can record any number
+// of moves, which must be undone in reverse order. Rather than saving a copy of
+// the whole position, the journal only records the stones and groups that each
+// move modifies, which makes it cheap to walk up and down a search tree on a
+// single scratch position.
+class UndoJournal {
+ public:
+  // Returns the number of moves that can be undone.
+  int num_moves() const { return static_cast<int>(moves_.size()); }
+
+ private:
+  friend class Position;
+
+  // State of the position before a move was played.
+  struct Move {
+    Color to_play;
+    Coord previous_move = Coord::kInvalid;
+    Coord ko = Coord::kInvalid;
+    std::array<int, 2> num_captures;
+    int n;
+    int num_consecutive_passes;
+    std::array<zobrist::Hash, symmetry::kNumSymmetries> stone_hashes;
+#ifndef MG_BITBOARD_POSITION
+    GroupPool::Checkpoint groups;
+    int num_group_changes;
+    int num_next_stone_changes;
+#endif
+    int num_stone_changes;
+  };
+
+  std::vector<Move> moves_;
+  // Previous stone at each changed point, indexed by padded board point.
+  std::vector<std::pair<int, Stone>> stone_changes_;
+#ifndef MG_BITBOARD_POSITION
+  std::vector<std::pair<GroupId, Group>> group_changes_;
+  // Previous next_stone_ link of each changed point.
+  std::vector<std::pair<int, uint16_t>> next_stone_changes_;
+#endif
+};
+
 // Position represents a single board position.
 // It tracks the stones on the board and their groups, and contains the logic
 // for removing groups with no remaining liberties and merging neighboring
@@ -137,6 +213,18 @@ class GroupVisitor {
 // caller of the Position code must pass pointers to previously allocated
 // instances of BoardVisitor and GroupVisitor. These can then be reused by all
 // instances of the Position class.
+//
+// There are two implementations of the board logic, selected at compile time:
+//  - By default, Position tracks a GroupPool of groups and links the stones of
+//    each group into a ring, so that captures and merges only need to visit
+//    the stones of the groups involved (position.cc).
+//  - When MG_BITBOARD_POSITION is defined (bazel --define=position=bitboard),
+//    Position tracks the stones of each color as a BitBoard and finds chains,
+//    liberties and territory using word-parallel flood fills
+//    (position_bitboard.cc). The bitboard implementation does not use the
+//    BoardVisitor and GroupVisitor.
+// Both implementations maintain the same padded array of stones, so the rest of
+// the code doesn't need to know which one is in use.
 class Position {
  public:
   Position(BoardVisitor* bv, GroupVisitor* gv, Color to_play, int n = 0);
@@ -152,9 +240,17 @@ class Position {
 
   void PlayMove(Coord c, Color color = Color::kEmpty);
 
+  // Plays a move, recording the changes it makes in journal so that they can
+  // be reverted by UndoMove.
+  void PlayMove(Coord c, Color color, UndoJournal* journal);
+
+  // Reverts the most recent move recorded in journal, which must have been
+  // played on this position.
+  void UndoMove(UndoJournal* journal);
+
   // Adds the stone to the board.
   // Removes newly surrounded opponent groups.
-  // Updates liberty counts of remaining groups.
+  // Updates liberties of remaining groups.
   // Updates num_captures_.
   // If the move captures a single stone, sets ko_ to the coordinate of that
   // stone. Sets ko_ to kInvalid otherwise.
@@ -164,7 +260,16 @@ class Position {
 
   // Calculates the score from B perspective. If W is winning, score is
   // negative.
-  float CalculateScore(float komi);
+  float CalculateScore(float komi) const;
+
+  // Finds the area of the board that belongs to each player however the game
+  // continues, using Benson's algorithm for unconditional life. Returns the
+  // pass-alive area of (B, W): the chains of stones that can't be captured
+  // even if their owner always passes, plus the regions that they surround in
+  // which every empty point is a liberty of one of those chains (and so in
+  // which the opponent can never make an eye). Opponent stones in such a
+  // region are dead and count as part of the area.
+  std::array<BitBoard, 2> CalculatePassAliveArea() const;
 
   // Returns true if playing this move is legal.
   // Does not check positional superko.
@@ -188,24 +293,61 @@ class Position {
   };
   MoveType ClassifyMove(Coord c) const;
 
+  // Classifies every point on the board in a single sweep for the player whose
+  // turn it is to play.
+  // On return, (*legal)[c] is false if ClassifyMove(c) would return kIllegal.
+  // Otherwise, (*stone_hashes)[c] is the stone_hash() of the position after
+  // playing at c, including the removal of any captured stones. The hashes of
+  // captured stones are calculated from the groups they belong to, so there's
+  // no need to copy the position and play the move. This is more efficient
+  // than calling ClassifyMove and AddStoneToBoard for each point.
+  // Like ClassifyMove, ClassifyAllMoves does not check positional superko.
+  void ClassifyAllMoves(std::array<bool, kN * kN>* legal,
+                        std::array<zobrist::Hash, kN * kN>* stone_hashes) const;
+
   std::string ToSimpleString() const;
   std::string ToGroupString() const;
   std::string ToPrettyString(bool use_ansi_colors = true) const;
 
   Color to_play() const { return to_play_; }
   Coord previous_move() const { return previous_move_; }
-  const Stones& stones() const { return stones_; }
+  // Returns the stones on the board, indexed by Coord.
+  Stones stones() const;
   int n() const { return n_; }
   bool is_game_over() const { return num_consecutive_passes_ >= 2; }
-  zobrist::Hash stone_hash() const { return stone_hash_; }
+  zobrist::Hash stone_hash() const {
+    return stone_hashes_[symmetry::kIdentity];
+  }
+
+  // Returns the stone_hash() of the position transformed by sym. The hashes
+  // of all the symmetries are updated incrementally as stones are played and
+  // captured.
+  zobrist::Hash stone_hash(symmetry::Symmetry sym) const {
+    return stone_hashes_[sym];
+  }
+
+  // Returns the smallest stone hash over all the symmetries of the position,
+  // which is the same for every rotation & reflection of the stones. If sym is
+  // non-null, it's set to the symmetry that transforms the position into the
+  // canonical one: stone_hash(*sym) == CanonicalStoneHash().
+  // The player to play & the number of consecutive passes are invariant under
+  // symmetry, so they can be combined with the canonical hash directly; a ko
+  // point must be transformed by *sym first.
+  zobrist::Hash CanonicalStoneHash(symmetry::Symmetry* sym = nullptr) const;
+
+  // Returns a Zobrist hash of the full state of the position that determines
+  // which moves are legal: the stones, the player to play, the ko point and
+  // the number of consecutive passes. Unlike stone_hash(), positions with the
+  // same state_hash() are interchangeable during search (ignoring superko).
+  zobrist::Hash state_hash() const {
+    return stone_hash() ^ zobrist::ToPlayHash(to_play_) ^
+           zobrist::KoHash(ko_) ^ zobrist::PassHash(num_consecutive_passes_);
+  }
 
   // The following methods are protected to enable direct testing by unit tests.
  protected:
   // Returns the Group of the stone at the given coordinate. Used for testing.
-  Group GroupAt(Coord c) const {
-    auto s = stones_[c];
-    return s.empty() ? Group() : groups_[s.group_id()];
-  }
+  Group GroupAt(Coord c) const;
 
   // Returns color C if the position at idx is empty and surrounded on all
   // sides by stones of color C.
@@ -213,26 +355,107 @@ class Position {
   Color IsKoish(Coord c) const;
 
  private:
+  friend class PackedPosition;
+
   // Play a pass move.
   void PassMove();
 
-  // Removes the group with a stone at the given coordinate from the board,
-  // updating the liberty counts of neighboring groups.
-  void RemoveGroup(Coord c);
+  // Recalculates the groups (or the bitboards of each color's stones) from
+  // board_, discarding the group IDs currently stored in board_. Used to
+  // rehydrate a Position from a PackedPosition.
+  void RebuildGroups();
 
-  // Merge neighboring groups of the same color as the stone at coordinate c
-  // into that stone's group. Called when a stone is placed on the board that
-  // has two or more distinct neighboring groups of the same color.
-  void MergeGroup(Coord c);
+  // Toggles a stone of the given color at coordinate c in the stone hash of
+  // every symmetry.
+  void UpdateStoneHashes(Coord c, Color color) {
+    for (int sym = 0; sym < symmetry::kNumSymmetries; ++sym) {
+      stone_hashes_[sym] ^= zobrist::MoveHash(kSymmetricCoords[sym][c], color);
+    }
+  }
+
+  // Sets the stone at padded board point p, recording the previous stone in the
+  // undo journal if there is one.
+  void SetStone(int p, Stone s) {
+    if (journal_ != nullptr) {
+      journal_->stone_changes_.emplace_back(p, board_[p]);
+    }
+    board_[p] = s;
+  }
 
-  // Returns true if the point at coordinate c neighbors the given group.
-  bool HasNeighboringGroup(Coord c, GroupId group_id) const;
+#ifdef MG_BITBOARD_POSITION
+  // Returns the stones of the given color.
+  BitBoard& occupied(Color color) {
+    return occupied_[static_cast<int>(color) - 1];
+  }
+  const BitBoard& occupied(Color color) const {
+    return occupied_[static_cast<int>(color) - 1];
+  }
+
+  // Returns the empty points on the board.
+  BitBoard EmptyPoints() const { return ~(occupied_[0] | occupied_[1]); }
 
-  Stones stones_;
+  // Returns the chain of stones connected to the stone at coordinate c.
+  BitBoard ChainAt(Coord c) const {
+    return BitBoard(c).FloodFill(occupied(board_[ToPadded(c)].color()));
+  }
+#else
+  // Removes the group with a stone at padded board point p from the board,
+  // updating the liberties of neighboring groups.
+  void RemoveGroup(int p);
+
+  // Returns the group with the given ID for modification, recording the
+  // group's current state in the undo journal if there is one.
+  Group& MutableGroup(GroupId id) {
+    if (journal_ != nullptr && group_visitor_->Visit(id)) {
+      journal_->group_changes_.emplace_back(id, groups_[id]);
+    }
+    return groups_[id];
+  }
+
+  // Merges the group with a stone at padded board point p into the group
+  // group_id: the liberty sets are combined and the stones of the merged group
+  // are relabeled. Called when a stone is placed on the board that has two or
+  // more distinct neighboring groups of the same color. The stone rings of the
+  // two groups are not joined: see SpliceRings.
+  void MergeGroup(GroupId group_id, int p);
+
+  // Sets the next stone in the ring of the stone at padded board point p,
+  // recording the previous link in the undo journal if there is one.
+  void SetNextStone(int p, int next) {
+    if (journal_ != nullptr) {
+      journal_->next_stone_changes_.emplace_back(p, next_stone_[p]);
+    }
+    next_stone_[p] = next;
+  }
+
+  // Joins the stone rings containing the stones at padded board points a and
+  // b, which must be different rings, into a single ring.
+  void SpliceRings(int a, int b) {
+    int next_a = next_stone_[a];
+    SetNextStone(a, next_stone_[b]);
+    SetNextStone(b, next_a);
+  }
+#endif
+
+  // The stones on the board, in the padded layout: board_[ToPadded(c)] is the
+  // stone at coordinate c, and the points around the board are off-board.
+  std::array<Stone, kNumPaddedPoints> board_;
   BoardVisitor* board_visitor_;
   GroupVisitor* group_visitor_;
+#ifdef MG_BITBOARD_POSITION
+  // Stones of each color, indexed by static_cast<int>(color) - 1.
+  // The group IDs stored in board_ are not used by the bitboard
+  // implementation and are always 0.
+  std::array<BitBoard, 2> occupied_;
+#else
   GroupPool groups_;
 
+  // The stones of each group are linked into a circular list:
+  // next_stone_[p] is the padded board point of the next stone in the same
+  // group as the stone at p. Only meaningful for points that have a stone.
+  std::array<uint16_t, kNumPaddedPoints> next_stone_;
+#endif
+
   Color to_play_;
   Coord previous_move_ = Coord::kInvalid;
   Coord ko_ = Coord::kInvalid;
@@ -243,10 +466,15 @@ class Position {
   int n_;
   int num_consecutive_passes_ = 0;
 
-  // Zobrist hash of the stones. It can be used for positional superko.
-  // This has does not include number of consecutive passes or ko, so should not
-  // be used for caching inferences.
-  zobrist::Hash stone_hash_ = 0;
+  // Zobrist hashes of the stones, transformed by each symmetry. The identity
+  // hash can be used for positional superko.
+  // These hashes do not include the player to play, number of consecutive
+  // passes or ko: see state_hash() for a hash that does.
+  std::array<zobrist::Hash, symmetry::kNumSymmetries> stone_hashes_{};
+
+  // Journal that records the changes made by a move. Only non-null for the
+  // duration of PlayMove(c, color, journal).
+  UndoJournal* journal_ = nullptr;
 };
 
 }  // namespace minigo
@@ -12,11 +12,13 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <array>
 #include <string>
 #include <vector>
 
 #include "benchmark/benchmark.h"
 #include "cc/coord.h"
+#include "cc/packed_position.h"
 #include "cc/position.h"
 
 using minigo::BoardVisitor;
@@ -24,11 +26,15 @@ using minigo::Color;
 using minigo::Coord;
 using minigo::GroupVisitor;
 using minigo::kDefaultKomi;
+using minigo::kN;
+using minigo::PackedPosition;
 using minigo::Position;
+using minigo::UndoJournal;
 
 namespace {
 
-void BM_PlayGame(benchmark::State& state) {  // NOLINT(runtime/references)
+// Returns the moves of a complete 19x19 game.
+std::vector<Coord> GetGameMoves() {
   std::vector<std::string> str_moves = {
       "pd", "dd", "qp", "dp", "fq", "hq", "oq", "cn", "qj", "nc", "pf", "pb",
       "cf", "fc", "qc", "ld", "bd", "ch", "cc", "ce", "be", "df", "dg", "cg",
@@ -58,11 +64,27 @@ void BM_PlayGame(benchmark::State& state) {  // NOLINT(runtime/references)
   for (const auto& str_move : str_moves) {
     moves.push_back(Coord::FromSgf(str_move));
   }
+  return moves;
+}
+
+// Returns every position reached while playing the moves of GetGameMoves().
+std::vector<Position> GetGamePositions(BoardVisitor* bv, GroupVisitor* gv) {
+  std::vector<Position> positions;
+  positions.emplace_back(bv, gv, Color::kBlack);
+  for (const auto& move : GetGameMoves()) {
+    positions.push_back(positions.back());
+    positions.back().PlayMove(move);
+  }
+  return positions;
+}
+
+void BM_PlayGame(benchmark::State& state) {  // NOLINT(runtime/references)
+  auto moves = GetGameMoves();
 
   BoardVisitor bv;
   GroupVisitor gv;
   std::vector<Position> boards;
-  boards.reserve(str_moves.size());
+  boards.reserve(moves.size() + 1);
   for (auto _ : state) {
     for (int i = 0; i < 1000; ++i) {
       // For a fair comparison with the Python performance, create a new board
@@ -79,6 +101,143 @@ void BM_PlayGame(benchmark::State& state) {  // NOLINT(runtime/references)
 
 BENCHMARK(BM_PlayGame);
 
+// Plays a game on a single position then undoes all the moves, which is how
+// tree search walks up and down the tree.
+void BM_PlayUndoGame(benchmark::State& state) {  // NOLINT(runtime/references)
+  auto moves = GetGameMoves();
+
+  BoardVisitor bv;
+  GroupVisitor gv;
+  Position position(&bv, &gv, Color::kBlack);
+  UndoJournal journal;
+  for (auto _ : state) {
+    for (int i = 0; i < 1000; ++i) {
+      for (const auto& move : moves) {
+        position.PlayMove(move, Color::kEmpty, &journal);
+      }
+      while (journal.num_moves() != 0) {
+        position.UndoMove(&journal);
+      }
+    }
+  }
+}
+
+BENCHMARK(BM_PlayUndoGame);
+
+// Classifies every point on the board for each position in a game, which is
+// what MctsNode does when it calculates the legal moves of a new node.
+void BM_ClassifyMoves(benchmark::State& state) {  // NOLINT(runtime/references)
+  BoardVisitor bv;
+  GroupVisitor gv;
+  auto positions = GetGamePositions(&bv, &gv);
+  for (auto _ : state) {
+    int num_legal_moves = 0;
+    for (const auto& position : positions) {
+      for (int c = 0; c < kN * kN; ++c) {
+        if (position.ClassifyMove(c) != Position::MoveType::kIllegal) {
+          ++num_legal_moves;
+        }
+      }
+    }
+    benchmark::DoNotOptimize(num_legal_moves);
+  }
+}
+
+BENCHMARK(BM_ClassifyMoves);
+
+// Same as BM_ClassifyMoves but uses ClassifyAllMoves, which also calculates
+// the stone hash resulting from each legal move.
+void BM_ClassifyAllMoves(
+    benchmark::State& state) {  // NOLINT(runtime/references)
+  BoardVisitor bv;
+  GroupVisitor gv;
+  auto positions = GetGamePositions(&bv, &gv);
+  std::array<bool, kN * kN> legal;
+  std::array<minigo::zobrist::Hash, kN * kN> stone_hashes;
+  for (auto _ : state) {
+    for (const auto& position : positions) {
+      position.ClassifyAllMoves(&legal, &stone_hashes);
+      benchmark::DoNotOptimize(legal);
+      benchmark::DoNotOptimize(stone_hashes);
+    }
+  }
+}
+
+BENCHMARK(BM_ClassifyAllMoves);
+
+// Scores each position in a game.
+void BM_CalculateScore(benchmark::State& state) {  // NOLINT(runtime/references)
+  BoardVisitor bv;
+  GroupVisitor gv;
+  auto positions = GetGamePositions(&bv, &gv);
+  for (auto _ : state) {
+    float score = 0;
+    for (auto& position : positions) {
+      score += position.CalculateScore(kDefaultKomi);
+    }
+    benchmark::DoNotOptimize(score);
+  }
+}
+
+BENCHMARK(BM_CalculateScore);
+
+// Finds the pass-alive area of each position in a game, which is what
+// selfplay does after every move when adjudicating games early.
+void BM_CalculatePassAliveArea(
+    benchmark::State& state) {  // NOLINT(runtime/references)
+  BoardVisitor bv;
+  GroupVisitor gv;
+  auto positions = GetGamePositions(&bv, &gv);
+  for (auto _ : state) {
+    int area = 0;
+    for (const auto& position : positions) {
+      auto pass_alive = position.CalculatePassAliveArea();
+      area += pass_alive[0].count() + pass_alive[1].count();
+    }
+    benchmark::DoNotOptimize(area);
+  }
+}
+
+BENCHMARK(BM_CalculatePassAliveArea);
+
+// Packs each position in a game into the snapshot that MctsNode stores.
+// Reports the bytes per node used to store the board position before (a full
+// Position) and after (a PackedPosition).
+void BM_PackPosition(benchmark::State& state) {  // NOLINT(runtime/references)
+  BoardVisitor bv;
+  GroupVisitor gv;
+  auto positions = GetGamePositions(&bv, &gv);
+  for (auto _ : state) {
+    for (const auto& position : positions) {
+      PackedPosition packed(position);
+      benchmark::DoNotOptimize(packed);
+    }
+  }
+  state.counters["position_bytes"] = sizeof(Position);
+  state.counters["packed_bytes"] = sizeof(PackedPosition);
+}
+
+BENCHMARK(BM_PackPosition);
+
+// Rehydrates each position in a game from its packed snapshot.
+void BM_UnpackPosition(benchmark::State& state) {  // NOLINT(runtime/references)
+  BoardVisitor bv;
+  GroupVisitor gv;
+  std::vector<PackedPosition> packed_positions;
+  for (const auto& position : GetGamePositions(&bv, &gv)) {
+    packed_positions.emplace_back(position);
+  }
+  Position position(&bv, &gv, Color::kBlack);
+  for (auto _ : state) {
+    for (const auto& packed : packed_positions) {
+      packed.Unpack(&position);
+      benchmark::DoNotOptimize(position);
+    }
+  }
+}
+
+BENCHMARK(BM_UnpackPosition);
+
 }  // namespace
 
 BENCHMARK_MAIN();
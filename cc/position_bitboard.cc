@@ -0,0 +1,277 @@
+// Copyright 2018 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Bitboard implementation of the Position board logic, enabled by defining
+// MG_BITBOARD_POSITION. The methods shared by both implementations live in
+// position.cc.
+
+#include "cc/position.h"
+
+#ifdef MG_BITBOARD_POSITION
+
+#include <sstream>
+
+#include "absl/strings/str_format.h"
+
+namespace minigo {
+
+namespace {
+
+// Returns true if the stone at padded board point p has an empty neighbor other
+// than the point exclude. This is a cheap test that lets us skip the flood fill
+// of most chains when looking for liberties.
+bool HasOtherEmptyNeighbor(const std::array<Stone, kNumPaddedPoints>& board,
+                           int p, int exclude) {
+  for (int offset : kNeighborOffsets) {
+    int np = p + offset;
+    if (np != exclude && board[np].empty()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns true if the chain of stones in the set chain_color that is connected
+// to the stone at coordinate c neighbors any point in liberties. Stops growing
+// the chain as soon as it finds a liberty.
+bool ChainHasLiberty(Coord c, const BitBoard& chain_color,
+                     const BitBoard& liberties) {
+  BitBoard chain(c);
+  for (;;) {
+    auto neighbors = chain.Neighbors();
+    if (!(neighbors & liberties).empty()) {
+      return true;
+    }
+    auto grown = (chain | neighbors) & chain_color;
+    if (grown == chain) {
+      return false;
+    }
+    chain = grown;
+  }
+}
+
+constexpr char kPrintWhite[] = "\x1b[0;31;47m";
+constexpr char kPrintBlack[] = "\x1b[0;31;40m";
+constexpr char kPrintEmpty[] = "\x1b[0;31;43m";
+constexpr char kPrintNormal[] = "\x1b[0m";
+
+}  // namespace
+
+std::string Position::ToGroupString() const {
+  // The bitboard implementation doesn't assign IDs to groups, so number the
+  // chains in the order that they're first encountered.
+  std::array<int, kN * kN> chain_ids;
+  BitBoard labeled;
+  int num_chains = 0;
+  for (int c = 0; c < kN * kN; ++c) {
+    if (!board_[ToPadded(c)].empty() && !labeled.test(c)) {
+      auto chain = ChainAt(c);
+      chain.ForEach([&](Coord cc) { chain_ids[cc] = num_chains; });
+      labeled |= chain;
+      ++num_chains;
+    }
+  }
+
+  std::ostringstream oss;
+  for (int row = 0; row < kN; ++row) {
+    for (int col = 0; col < kN; ++col) {
+      Coord c(row, col);
+      Stone s = board_[ToPadded(c)];
+      if (s.empty()) {
+        oss << kPrintEmpty << ".  ";
+      } else {
+        oss << (s.color() == Color::kWhite ? kPrintWhite : kPrintBlack);
+        oss << absl::StreamFormat("%02x ", chain_ids[c]);
+      }
+    }
+    oss << kPrintNormal << "\n";
+  }
+  return oss.str();
+}
+
+void Position::AddStoneToBoard(Coord c, Color color) {
+  auto potential_ko = IsKoish(c);
+  auto opponent_color = OtherColor(color);
+  int p = ToPadded(c);
+
+  // Place the new stone on the board.
+  occupied(color).set(c);
+  SetStone(p, {color, 0});
+  UpdateStoneHashes(c, color);
+
+  // Find the opponent chains neighboring the new stone that have no liberties
+  // left. A captured chain is only removed once, even if it touches the new
+  // stone on several sides.
+  auto empty = EmptyPoints();
+  BitBoard captured;
+  int num_captured_chains = 0;
+  for (int offset : kNeighborOffsets) {
+    int np = p + offset;
+    if (board_[np].color() != opponent_color) {
+      continue;
+    }
+    Coord nc = kPaddedToCoord[np];
+    if (captured.test(nc) || HasOtherEmptyNeighbor(board_, np, p) ||
+        ChainHasLiberty(nc, occupied(opponent_color), empty)) {
+      continue;
+    }
+    captured |= ChainAt(nc);
+    ++num_captured_chains;
+  }
+
+  // Remove captured chains.
+  if (num_captured_chains != 0) {
+    int num_captured_stones = captured.count();
+    if (color == Color::kBlack) {
+      num_captures_[0] += num_captured_stones;
+    } else {
+      num_captures_[1] += num_captured_stones;
+    }
+    occupied(opponent_color) ^= captured;
+    captured.ForEach([&](Coord cc) {
+      SetStone(ToPadded(cc), {});
+      UpdateStoneHashes(cc, opponent_color);
+    });
+  }
+
+  // Update ko.
+  if (num_captured_chains == 1 && captured.count() == 1 &&
+      potential_ko == opponent_color) {
+    ko_ = captured.first();
+  } else {
+    ko_ = Coord::kInvalid;
+  }
+}
+
+Position::MoveType Position::ClassifyMove(Coord c) const {
+  if (c == Coord::kPass || c == Coord::kResign) {
+    return MoveType::kNoCapture;
+  }
+  int p = ToPadded(c);
+  if (!board_[p].empty()) {
+    return MoveType::kIllegal;
+  }
+  if (c == ko_) {
+    return MoveType::kIllegal;
+  }
+
+  auto liberties = EmptyPoints();
+  liberties.reset(c);
+  auto other_color = OtherColor(to_play_);
+  auto result = MoveType::kIllegal;
+  for (int offset : kNeighborOffsets) {
+    int np = p + offset;
+    Stone s = board_[np];
+    if (s.empty()) {
+      // At least one liberty at np after playing at c.
+      if (result == MoveType::kIllegal) {
+        result = MoveType::kNoCapture;
+      }
+      continue;
+    }
+    if (s.off_board()) {
+      continue;
+    }
+
+    // The chain at np has a liberty at c. Check whether it has any others.
+    bool has_other_liberty =
+        HasOtherEmptyNeighbor(board_, np, p) ||
+        ChainHasLiberty(kPaddedToCoord[np], occupied(s.color()), liberties);
+    if (s.color() == other_color) {
+      if (!has_other_liberty) {
+        // Will capture opponent group that has a stone at np.
+        return MoveType::kCapture;
+      }
+    } else if (has_other_liberty) {
+      // Connecting to a same colored group at np that has more than one
+      // liberty.
+      result = MoveType::kNoCapture;
+    }
+  }
+  return result;
+}
+
+void Position::ClassifyAllMoves(
+    std::array<bool, kN * kN>* legal,
+    std::array<zobrist::Hash, kN * kN>* stone_hashes) const {
+  auto other_color = OtherColor(to_play_);
+  auto empty = EmptyPoints();
+  for (int c = 0; c < kN * kN; ++c) {
+    auto move_type = ClassifyMove(c);
+    (*legal)[c] = move_type != MoveType::kIllegal;
+    if (move_type == MoveType::kIllegal) {
+      continue;
+    }
+
+    auto new_hash = stone_hash() ^ zobrist::MoveHash(c, to_play_);
+    if (move_type == MoveType::kCapture) {
+      // Find the opponent chains whose only liberty is c.
+      auto liberties = empty;
+      liberties.reset(c);
+      BitBoard captured;
+      int p = ToPadded(c);
+      for (int offset : kNeighborOffsets) {
+        if (board_[p + offset].color() != other_color) {
+          continue;
+        }
+        Coord nc = kPaddedToCoord[p + offset];
+        if (!captured.test(nc) &&
+            !ChainHasLiberty(nc, occupied(other_color), liberties)) {
+          captured |= ChainAt(nc);
+        }
+      }
+      captured.ForEach(
+          [&](Coord cc) { new_hash ^= zobrist::MoveHash(cc, other_color); });
+    }
+    (*stone_hashes)[c] = new_hash;
+  }
+}
+
+float Position::CalculateScore(float komi) const {
+  // Empty points are territory for a color if they can reach stones of that
+  // color but not of the other color.
+  auto empty = EmptyPoints();
+  const auto& black = occupied(Color::kBlack);
+  const auto& white = occupied(Color::kWhite);
+  auto black_reach = (black.Neighbors() & empty).FloodFill(empty);
+  auto white_reach = (white.Neighbors() & empty).FloodFill(empty);
+
+  int score = black.count() - white.count();
+  score += (black_reach & ~white_reach).count();
+  score -= (white_reach & ~black_reach).count();
+  return static_cast<float>(score) - komi;
+}
+
+void Position::RebuildGroups() {
+  occupied_[0] = BitBoard();
+  occupied_[1] = BitBoard();
+  for (int c = 0; c < kN * kN; ++c) {
+    auto color = board_[ToPadded(c)].color();
+    if (color != Color::kEmpty) {
+      occupied(color).set(c);
+    }
+  }
+}
+
+Group Position::GroupAt(Coord c) const {
+  if (board_[ToPadded(c)].empty()) {
+    return Group();
+  }
+  auto chain = ChainAt(c);
+  return Group(chain.count(), chain.Neighbors() & EmptyPoints());
+}
+
+}  // namespace minigo
+
+#endif  // MG_BITBOARD_POSITION
@@ -14,15 +14,20 @@
 
 #include "cc/position.h"
 
+#include <algorithm>
 #include <set>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "absl/strings/ascii.h"
+#include "absl/strings/string_view.h"
+#include "cc/bitboard.h"
 #include "cc/constants.h"
 #include "cc/random.h"
+#include "cc/symmetries.h"
 #include "cc/test_utils.h"
+#include "cc/zobrist.h"
 #include "gtest/gtest.h"
 
 namespace minigo {
@@ -361,6 +366,53 @@ TEST(PositionTest, TestKoTracking) {
             board.ToSimpleString());
 }
 
+// Tests that state_hash includes the player to play, ko and passes, which the
+// stone_hash doesn't.
+TEST(PositionTest, TestStateHash) {
+  auto board = TestablePosition(R"(
+      XO.O.....
+      .XO......)");
+
+  // Same stones, different player to play.
+  auto white_to_play = board;
+  white_to_play.PlayMove("pass");
+  EXPECT_EQ(board.stone_hash(), white_to_play.stone_hash());
+  EXPECT_NE(board.state_hash(), white_to_play.state_hash());
+
+  // Same stones & player to play, different number of passes.
+  auto two_passes = white_to_play;
+  two_passes.PlayMove("pass");
+  EXPECT_EQ(board.stone_hash(), two_passes.stone_hash());
+  EXPECT_EQ(board.to_play(), two_passes.to_play());
+  EXPECT_NE(board.state_hash(), two_passes.state_hash());
+
+  // Same stones & player to play, with and without a ko.
+  auto ko = board;
+  ko.PlayMove("C9", Color::kBlack);
+  auto no_ko = TestablePosition(R"(
+      X..O.....
+      .XO......)");
+  no_ko.PlayMove("C9", Color::kBlack);
+  ASSERT_EQ(CleanBoardString(R"(
+      X*XO.....
+      .XO......)"),
+            ko.ToSimpleString());
+  EXPECT_EQ(ko.stone_hash(), no_ko.stone_hash());
+  EXPECT_EQ(ko.to_play(), no_ko.to_play());
+  EXPECT_NE(ko.state_hash(), no_ko.state_hash());
+
+  // The same state reached by different move orders has the same hash.
+  auto a = board;
+  a.PlayMove("J9");
+  a.PlayMove("J1");
+  a.PlayMove("H9");
+  auto b = board;
+  b.PlayMove("H9");
+  b.PlayMove("J1");
+  b.PlayMove("J9");
+  EXPECT_EQ(a.state_hash(), b.state_hash());
+}
+
 TEST(PositionTest, TestSeki) {
   auto board = TestablePosition(R"(
     O....XXXX
@@ -418,6 +470,95 @@ TEST(PositionTest, TestScoring) {
   }
 }
 
+// Returns the points of the board in a string in the format of
+// ToSimpleString() that are marked with c.
+BitBoard PointsMarked(absl::string_view board_str, char c) {
+  auto str = CleanBoardString(board_str);
+  BitBoard result;
+  int i = 0;
+  for (char x : str) {
+    if (x == '\n') {
+      continue;
+    }
+    if (x == c) {
+      result.set(i);
+    }
+    ++i;
+  }
+  return result;
+}
+
+TEST(PositionTest, TestPassAliveArea) {
+  // Black has a chain with two eyes in the top left, one of which contains a
+  // dead white stone. Black's chain in the top right only has one eye, and
+  // white's stones at the bottom have no eyes at all.
+  auto board = TestablePosition(R"(
+      .X.OX..X.
+      XXXXX..XX
+      .........
+      .........
+      .........
+      .........
+      .........
+      OOOO.....
+      ...O.....)");
+  auto area = board.CalculatePassAliveArea();
+  EXPECT_EQ(PointsMarked(R"(
+      BBBBB....
+      BBBBB....)",
+                         'B'),
+            area[0]);
+  EXPECT_TRUE(area[1].empty());
+
+  // Give white a second eye.
+  board.PlayMove("B1", Color::kWhite);
+  area = board.CalculatePassAliveArea();
+  EXPECT_EQ(PointsMarked(R"(
+      .........
+      .........
+      .........
+      .........
+      .........
+      .........
+      .........
+      WWWW.....
+      WWWW.....)",
+                         'W'),
+            area[1]);
+}
+
+// Plays random games and checks that the pass-alive areas of the two players
+// never overlap, and that the area of each player never contains the
+// opponent's pass-alive stones.
+TEST(PositionTest, PassAliveAreasAreDisjoint) {
+  Random rnd(1732050);
+  for (int game = 0; game < 20; ++game) {
+    TestablePosition position("");
+    int num_alive = 0;
+    for (int i = 0; i < 500 && !position.is_game_over(); ++i) {
+      // Prefer moves that don't fill the player's own eyes, so that games
+      // produce pass-alive groups.
+      std::vector<Coord> legal_moves;
+      for (int c = 0; c < kN * kN; ++c) {
+        if (position.ClassifyMove(c) != Position::MoveType::kIllegal &&
+            position.IsKoish(c) != position.to_play()) {
+          legal_moves.push_back(c);
+        }
+      }
+      Coord c = Coord::kPass;
+      if (!legal_moves.empty()) {
+        c = legal_moves[rnd.UniformInt(0, legal_moves.size() - 1)];
+      }
+      position.PlayMove(c);
+
+      auto area = position.CalculatePassAliveArea();
+      ASSERT_TRUE((area[0] & area[1]).empty());
+      num_alive += !area[0].empty() + !area[1].empty();
+    }
+    EXPECT_LT(0, num_alive);
+  }
+}
+
 // Plays through an example game and verifies that the outcome is as expected.
 TEST(PositionTest, PlayGame) {
   std::vector<std::string> moves = {
@@ -477,5 +618,255 @@ TEST(PositionTest, PlayRandomLegalMoves) {
   }
 }
 
+// Plays random legal moves and checks that the size and liberties of every
+// group match a brute force flood fill of the board.
+TEST(PositionTest, GroupLibertiesMatchBoard) {
+  Random rnd(614889);
+  TestablePosition position("");
+
+  for (int i = 0; i < 2000; ++i) {
+    std::vector<Coord> legal_moves;
+    for (int c = 0; c < kN * kN; ++c) {
+      if (position.ClassifyMove(c) != Position::MoveType::kIllegal) {
+        legal_moves.push_back(c);
+      }
+    }
+    if (!legal_moves.empty()) {
+      auto c = legal_moves[rnd.UniformInt(0, legal_moves.size() - 1)];
+      position.PlayMove(c, position.to_play());
+    } else {
+      position.PlayMove(Coord::kPass, position.to_play());
+    }
+
+    const auto& stones = position.stones();
+    for (int c = 0; c < kN * kN; ++c) {
+      if (stones[c].empty()) {
+        continue;
+      }
+      auto color = stones[c].color();
+      BitBoard chain;
+      BitBoard liberties;
+      std::vector<Coord> pending;
+      pending.push_back(c);
+      chain.set(c);
+      while (!pending.empty()) {
+        auto pc = pending.back();
+        pending.pop_back();
+        for (auto nc : kNeighborCoords[pc]) {
+          if (stones[nc].empty()) {
+            liberties.set(nc);
+          } else if (stones[nc].color() == color && !chain.test(nc)) {
+            chain.set(nc);
+            pending.push_back(nc);
+          }
+        }
+      }
+
+      auto group = position.GroupAt(c);
+      ASSERT_EQ(chain.count(), group.size) << Coord(c);
+      ASSERT_EQ(liberties.count(), group.num_liberties) << Coord(c);
+      ASSERT_EQ(liberties, group.liberties) << Coord(c);
+    }
+  }
+}
+
+// Plays random legal moves and checks that the incrementally updated stone
+// hash of each symmetry matches the hash of the board transformed by
+// ApplySymmetry.
+TEST(PositionTest, SymmetricStoneHashes) {
+  Random rnd(1414213);
+  TestablePosition position("");
+
+  for (int i = 0; i < 1000; ++i) {
+    std::vector<Coord> legal_moves;
+    for (int c = 0; c < kN * kN; ++c) {
+      if (position.ClassifyMove(c) != Position::MoveType::kIllegal) {
+        legal_moves.push_back(c);
+      }
+    }
+    Coord c = Coord::kPass;
+    if (!legal_moves.empty() && rnd.UniformInt(0, 19) != 0) {
+      c = legal_moves[rnd.UniformInt(0, legal_moves.size() - 1)];
+    }
+    position.PlayMove(c);
+
+    auto stones = position.stones();
+    Position::Stones transformed;
+    zobrist::Hash min_hash = ~zobrist::Hash(0);
+    for (int sym = 0; sym < symmetry::kNumSymmetries; ++sym) {
+      symmetry::ApplySymmetry<kN, 1>(static_cast<symmetry::Symmetry>(sym),
+                                     stones.begin(), transformed.begin());
+      zobrist::Hash expected = 0;
+      for (int tc = 0; tc < kN * kN; ++tc) {
+        expected ^= zobrist::MoveHash(tc, transformed[tc].color());
+      }
+      ASSERT_EQ(expected,
+                position.stone_hash(static_cast<symmetry::Symmetry>(sym)));
+      min_hash = std::min(min_hash, expected);
+    }
+
+    symmetry::Symmetry canonical_sym;
+    ASSERT_EQ(min_hash, position.CanonicalStoneHash(&canonical_sym));
+    ASSERT_EQ(min_hash, position.stone_hash(canonical_sym));
+  }
+}
+
+// Checks that rotations & reflections of a position have the same canonical
+// hash.
+TEST(PositionTest, CanonicalStoneHash) {
+  auto board = TestablePosition(R"(
+      .X.......
+      ..O......
+      .........
+      .........
+      .........
+      .........
+      .........
+      .........
+      ........X)");
+  auto rotated = TestablePosition(R"(
+      X........
+      .........
+      .........
+      .........
+      .........
+      .........
+      .........
+      ......O..
+      .......X.)");
+  auto reflected = TestablePosition(R"(
+      .......X.
+      ......O..
+      .........
+      .........
+      .........
+      .........
+      .........
+      .........
+      X........)");
+  auto different = TestablePosition(R"(
+      .X.......
+      ..X......
+      .........
+      .........
+      .........
+      .........
+      .........
+      .........
+      ........O)");
+  EXPECT_NE(board.stone_hash(), rotated.stone_hash());
+  EXPECT_NE(board.stone_hash(), reflected.stone_hash());
+  EXPECT_EQ(board.CanonicalStoneHash(), rotated.CanonicalStoneHash());
+  EXPECT_EQ(board.CanonicalStoneHash(), reflected.CanonicalStoneHash());
+  EXPECT_NE(board.CanonicalStoneHash(), different.CanonicalStoneHash());
+}
+
+// Plays random legal moves and checks that ClassifyAllMoves agrees with
+// ClassifyMove, and that the stone hashes it returns match those from actually
+// playing each move.
+TEST(PositionTest, ClassifyAllMoves) {
+  Random rnd(2718281);
+  TestablePosition position("");
+
+  std::array<bool, kN * kN> legal;
+  std::array<zobrist::Hash, kN * kN> stone_hashes;
+  int num_captures = 0;
+  for (int i = 0; i < 1000; ++i) {
+    position.ClassifyAllMoves(&legal, &stone_hashes);
+
+    std::vector<Coord> legal_moves;
+    for (int c = 0; c < kN * kN; ++c) {
+      auto move_type = position.ClassifyMove(c);
+      ASSERT_EQ(move_type != Position::MoveType::kIllegal, legal[c]);
+      if (!legal[c]) {
+        continue;
+      }
+      legal_moves.push_back(c);
+      if (move_type == Position::MoveType::kCapture) {
+        num_captures += 1;
+      }
+      Position new_position(position);
+      new_position.AddStoneToBoard(c, position.to_play());
+      ASSERT_EQ(new_position.stone_hash(), stone_hashes[c]);
+    }
+
+    if (!legal_moves.empty()) {
+      auto c = legal_moves[rnd.UniformInt(0, legal_moves.size() - 1)];
+      position.PlayMove(c, position.to_play());
+    } else {
+      position.PlayMove(Coord::kPass, position.to_play());
+    }
+  }
+
+  // Make sure the test actually exercised some capturing moves.
+  EXPECT_LT(0, num_captures);
+}
+
+// Randomly plays and undoes moves, checking that UndoMove restores the exact
+// state of the position before each move was played.
+TEST(PositionTest, UndoMove) {
+  Random rnd(1618033);
+  TestablePosition position("");
+  UndoJournal journal;
+  std::vector<Position> history;
+
+  auto expect_equal = [&position](const Position& expected) {
+    TestablePosition expected_position("");
+    static_cast<Position&>(expected_position) = expected;
+    ASSERT_EQ(expected.ToSimpleString(), position.ToSimpleString());
+    ASSERT_EQ(expected.ToGroupString(), position.ToGroupString());
+    for (int sym = 0; sym < symmetry::kNumSymmetries; ++sym) {
+      auto s = static_cast<symmetry::Symmetry>(sym);
+      ASSERT_EQ(expected.stone_hash(s), position.stone_hash(s));
+    }
+    ASSERT_EQ(expected.to_play(), position.to_play());
+    ASSERT_EQ(expected.previous_move(), position.previous_move());
+    ASSERT_EQ(expected.n(), position.n());
+    ASSERT_EQ(expected.is_game_over(), position.is_game_over());
+    ASSERT_EQ(expected.num_captures(), position.num_captures());
+    for (int c = 0; c < kN * kN; ++c) {
+      auto expected_group = expected_position.GroupAt(c);
+      auto actual_group = position.GroupAt(c);
+      ASSERT_EQ(expected_group.size, actual_group.size);
+      ASSERT_EQ(expected_group.liberties, actual_group.liberties);
+    }
+  };
+
+  for (int i = 0; i < 3000; ++i) {
+    if (history.empty() || rnd.UniformInt(0, 9) < 6) {
+      std::vector<Coord> legal_moves;
+      for (int c = 0; c < kN * kN; ++c) {
+        if (position.ClassifyMove(c) != Position::MoveType::kIllegal) {
+          legal_moves.push_back(c);
+        }
+      }
+      Coord c = Coord::kPass;
+      if (!legal_moves.empty() && rnd.UniformInt(0, 19) != 0) {
+        c = legal_moves[rnd.UniformInt(0, legal_moves.size() - 1)];
+      }
+      history.push_back(position);
+      position.PlayMove(c, position.to_play(), &journal);
+    } else {
+      position.UndoMove(&journal);
+      expect_equal(history.back());
+      history.pop_back();
+    }
+    ASSERT_EQ(history.size(), journal.num_moves());
+  }
+
+  while (!history.empty()) {
+    position.UndoMove(&journal);
+    expect_equal(history.back());
+    history.pop_back();
+  }
+  EXPECT_EQ(0, journal.num_moves());
+}
+
 }  // namespace
 }  // namespace minigo
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  ::minigo::zobrist::Init(614944751);
+  return RUN_ALL_TESTS();
+}
@@ -41,6 +41,13 @@ void Random::Dirichlet(float alpha, absl::Span<float> samples) {
   }
 }
 
+void Random::Gumbel(absl::Span<float> samples) {
+  std::extreme_value_distribution<float> distribution(0, 1);
+  for (float& sample : samples) {
+    sample = distribution(impl_);
+  }
+}
+
 void Random::Uniform(float mn, float mx, absl::Span<float> samples) {
   std::uniform_real_distribution<float> distribution(mn, mx);
   for (float& sample : samples) {
@@ -37,6 +37,15 @@ class Random {
     Dirichlet(alpha, {array_like->data(), array_like->size()});
   }
 
+  // Draw samples from the standard Gumbel distribution.
+  void Gumbel(absl::Span<float> samples);
+
+  // Draw samples from the standard Gumbel distribution.
+  template <typename T>
+  void Gumbel(T* array_like) {
+    Gumbel({array_like->data(), array_like->size()});
+  }
+
   // Draw multiple unform random samples in the half-open range [mn, mx).
   void Uniform(float mn, float mx, absl::Span<float> samples);
 
@@ -90,5 +90,26 @@ TEST(RandomTest, Dirichlet) {
   }
 }
 
+TEST(RandomTest, Gumbel) {
+  Random rnd(123);
+
+  // The standard Gumbel distribution has a mean of the Euler-Mascheroni
+  // constant and a variance of pi^2 / 6.
+  float sum = 0;
+  float sum_squares = 0;
+  for (int iter = 0; iter < 1000; ++iter) {
+    std::array<float, 100> samples;
+    rnd.Gumbel(&samples);
+    for (float sample : samples) {
+      sum += sample;
+      sum_squares += sample * sample;
+    }
+  }
+  float mean = sum / 100000;
+  float variance = sum_squares / 100000 - mean * mean;
+  EXPECT_NEAR(0.5772, mean, 0.02);
+  EXPECT_NEAR(1.6449, variance, 0.05);
+}
+
 }  // namespace
 }  // namespace minigo
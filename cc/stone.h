@@ -27,6 +27,9 @@ namespace minigo {
 // empty point on the board.
 // Stone tracks both the color (empty, black or white) and group the ID of the
 // stone's.
+// Position also uses Stone::OffBoard() to mark the border of points that
+// surrounds its board. The color of an off-board stone is none of kEmpty,
+// kBlack or kWhite, so it never matches a color test.
 class Stone {
  public:
   Stone() = default;
@@ -38,11 +41,20 @@ class Stone {
 
   Stone& operator=(const Stone& other) = default;
 
+  static Stone OffBoard() {
+    Stone s;
+    s.value_ = kOffBoard;
+    return s;
+  }
+
   bool empty() const { return value_ == 0; }
+  bool off_board() const { return value_ == kOffBoard; }
   Color color() const { return static_cast<Color>(value_ & 3); }
   GroupId group_id() const { return value_ >> 2; }
 
  private:
+  static constexpr uint16_t kOffBoard = 3;
+
   uint16_t value_ = 0;
 };
 
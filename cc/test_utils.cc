@@ -88,8 +88,10 @@ int CountPendingVirtualLosses(const MctsNode* node) {
     pending.pop_back();
     assert(node->num_virtual_losses_applied >= 0);
     num += node->num_virtual_losses_applied;
-    for (const auto& p : node->children) {
-      pending.push_back(p.second.get());
+    for (int i = 0; i < node->edges.size; ++i) {
+      if (node->edges.child[i] != nullptr) {
+        pending.push_back(node->edges.child[i]);
+      }
     }
   }
   return num;
@@ -42,9 +42,11 @@ class TestablePosition : public Position {
   Group GroupAt(absl::string_view str) const {
     return Position::GroupAt(Coord::FromString(str));
   }
+  using Position::GroupAt;
   Color IsKoish(absl::string_view str) const {
     return Position::IsKoish(Coord::FromString(str));
   }
+  using Position::IsKoish;
   MoveType ClassifyMove(absl::string_view str) const {
     return Position::ClassifyMove(Coord::FromString(str));
   }
@@ -101,8 +101,12 @@ std::vector<tensorflow::Example> MakeExamples(const MctsPlayer& player) {
   std::vector<tensorflow::Example> examples;
   examples.reserve(player.history().size());
   DualNet::BoardFeatures features;
-  std::vector<const Position::Stones*> recent_positions;
+  std::vector<const PackedPosition*> recent_positions;
   for (const auto& h : player.history()) {
+    // Positions that were only searched quickly don't make good targets.
+    if (!h.is_full_search) {
+      continue;
+    }
     h.node->GetMoveHistory(DualNet::kMoveHistory, &recent_positions);
     DualNet::SetFeatures(recent_positions, h.node->position.to_play(),
                          &features);
@@ -23,7 +23,8 @@ namespace minigo {
 namespace tf_utils {
 
 // Writes a list of tensorflow Example protos to a zlib compressed TFRecord
-// file, one for each position in the player's move history.
+// file, one for each position in the player's move history that was searched
+// in full (see MctsPlayer::History::is_full_search).
 // Each example contains:
 //   x: the input BoardFeatures as bytes.
 //   pi: the search pi as a float array, serialized as bytes.
@@ -34,7 +35,8 @@ void WriteGameExamples(const std::string& output_dir,
                        const MctsPlayer& player);
 
 // Writes a list of tensorflow Example protos to the specified
-// Bigtable, one example per row, starting at the given row cursor.
+// Bigtable, one example per row, starting at the given row cursor. As above,
+// only positions that were searched in full are written.
 // Returns the value of the row cursor after having written out
 // the examples.
 void WriteGameExamples(const std::string& gcp_project_name,
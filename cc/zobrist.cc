@@ -22,6 +22,7 @@ namespace zobrist {
 Hash kBlackToPlayHash;
 std::array<std::array<Hash, 3>, kNumMoves> kMoveHashes;
 std::array<Hash, kN * kN> kKoHashes;
+std::array<Hash, 3> kPassHashes;
 
 void Init(uint64_t seed) {
   minigo::Random rnd(seed);
@@ -35,6 +36,9 @@ void Init(uint64_t seed) {
   for (auto& x : kKoHashes) {
     x = rnd.UniformUint64();
   }
+  for (size_t i = 0; i < kPassHashes.size(); ++i) {
+    kPassHashes[i] = i == 0 ? 0 : rnd.UniformUint64();
+  }
 }
 
 }  // namespace zobrist
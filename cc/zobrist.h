@@ -31,6 +31,7 @@ using Hash = uint64_t;
 extern Hash kBlackToPlayHash;
 extern std::array<std::array<Hash, 3>, kNumMoves> kMoveHashes;
 extern std::array<Hash, kN * kN> kKoHashes;
+extern std::array<Hash, 3> kPassHashes;
 
 inline Hash ToPlayHash(Color color) {
   return color == Color::kBlack ? kBlackToPlayHash : 0;
@@ -42,6 +43,12 @@ inline Hash MoveHash(Coord c, Color color) {
 
 inline Hash KoHash(Coord c) { return c == Coord::kInvalid ? 0 : kKoHashes[c]; }
 
+// Returns the hash of the number of consecutive passes played. Any number of
+// passes >= 2 hashes the same, since they all end the game.
+inline Hash PassHash(int num_consecutive_passes) {
+  return kPassHashes[std::min(num_consecutive_passes, 2)];
+}
+
 void Init(uint64_t seed);
 
 }  // namespace zobrist